@@ -0,0 +1,173 @@
+#ifndef ADDRESS_SPACE_H_
+#define ADDRESS_SPACE_H_
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "stdbool.h"
+
+#include "types.h"
+#include "memory.h"
+#include "decode_cache.h"
+
+// the simulated 1 MB. data accesses come in as segment:offset packed into a u32 far pointer, segment
+// in the high half like the 8086 stores them. a word's high byte is at offset + 1 in the same segment,
+// so a word at offset 0xffff wraps to the start of its segment rather than running into the next 64 KB,
+// and addresses past the top of the 1 MB wrap to the bottom.
+//
+// with a trace attached every data access is logged as a little endian u32:
+//   bits 0-19 physical address of the first byte, bit 20 word, bit 21 write
+// instruction fetches go through the decode cache and aren't logged
+#define TRACE_BUFFER_SIZE 16384 // records between writes
+#define TRACE_WORD  (1u << 20)
+#define TRACE_WRITE (1u << 21)
+
+// with a dirty map attached every write marks its 4 KB page, snapshots only copy what's marked
+#define DIRTY_PAGE_BITS 12
+#define DIRTY_PAGE_SIZE (1u << DIRTY_PAGE_BITS)
+#define DIRTY_PAGE_COUNT (MEMORY_SIZE >> DIRTY_PAGE_BITS)
+
+// with a translated map attached (the block engine's, see block.h) a write to any byte marked in it
+// is counted, whatever the decode cache still holds
+#define TRANSLATED_WORDS (MEMORY_SIZE / 64)
+
+struct access_trace {
+  FILE* file;
+  u32 used;
+  u64 reads;
+  u64 writes;
+  u64 odd_words; // word accesses at an odd address, those cost the 8086 an extra bus cycle
+  u32 records[TRACE_BUFFER_SIZE];
+};
+
+struct address_space {
+  u8* bytes;
+  struct decode_cache* cache; // writes keep it honest when there is one
+  struct access_trace* trace; // NULL unless accesses are being logged
+  u8* dirty_pages;            // DIRTY_PAGE_COUNT flags, NULL unless snapshots are being taken
+  const u64* translated;      // TRANSLATED_WORDS, a bit per byte, NULL unless blocks are running
+  u32 translated_writes;
+};
+
+static u32 physical_address(u16 segment, u16 offset);
+static u32 far_pointer(u16 segment, u16 offset);
+static bool is_translated(const u64* translated, u32 address);
+static u16 read_memory(const struct address_space* memory, u32 far, bool wide);
+static void write_memory(struct address_space* memory, u32 far, u16 value, bool wide);
+static MAYBE_UNUSED struct access_trace* open_trace(const char* file_name);
+static MAYBE_UNUSED bool close_trace(struct access_trace* trace);
+
+
+u32 physical_address(u16 segment, u16 offset) {
+  return (((u32)segment << 4) + offset) & MEMORY_MASK;
+}
+
+u32 far_pointer(u16 segment, u16 offset) {
+  return ((u32)segment << 16) | offset;
+}
+
+static u32 far_physical(u32 far) {
+  return physical_address((u16)(far >> 16), (u16)far);
+}
+
+// where the high byte of a word at far goes
+static u32 far_physical_high(u32 far) {
+  return physical_address((u16)(far >> 16), (u16)(far + 1));
+}
+
+static void flush_trace(struct access_trace* trace) {
+  if (trace->used && fwrite(trace->records, sizeof(u32), trace->used, trace->file) != trace->used) {
+    perror("writing memory trace failed\n");
+  }
+  trace->used = 0;
+}
+
+// only reached with a trace attached, the untraced path pays for the one pointer check
+static void trace_access(const struct address_space* memory, u32 address, bool wide, bool write) {
+  struct access_trace* trace = memory->trace;
+  trace->records[trace->used++] = address | (wide ? TRACE_WORD : 0) | (write ? TRACE_WRITE : 0);
+  if (write) {
+    ++trace->writes;
+  } else {
+    ++trace->reads;
+  }
+  if (wide && (address & 1)) {
+    ++trace->odd_words;
+  }
+  if (trace->used == TRACE_BUFFER_SIZE) {
+    flush_trace(trace);
+  }
+}
+
+bool is_translated(const u64* translated, u32 address) {
+  return translated[address / 64] & (1ull << (address % 64));
+}
+
+u16 read_memory(const struct address_space* memory, u32 far, bool wide) {
+  u32 address = far_physical(far);
+  if (memory->trace) {
+    trace_access(memory, address, wide, false);
+  }
+
+  u16 value = memory->bytes[address];
+  if (wide) {
+    value |= (u16)(memory->bytes[far_physical_high(far)] << 8);
+  }
+  return value;
+}
+
+void write_memory(struct address_space* memory, u32 far, u16 value, bool wide) {
+  u32 address = far_physical(far);
+  if (memory->trace) {
+    trace_access(memory, address, wide, true);
+  }
+
+  u32 high = far_physical_high(far);
+  memory->bytes[address] = (u8)value;
+  if (wide) {
+    memory->bytes[high] = (u8)(value >> 8);
+  }
+
+  if (memory->dirty_pages) {
+    memory->dirty_pages[address >> DIRTY_PAGE_BITS] = 1;
+    memory->dirty_pages[high >> DIRTY_PAGE_BITS] = 1;
+  }
+
+  if (memory->translated && (is_translated(memory->translated, address) || (wide && is_translated(memory->translated, high)))) {
+    ++memory->translated_writes;
+  }
+
+  if (memory->cache) {
+    invalidate_code(memory->cache, address);
+    if (wide) {
+      invalidate_code(memory->cache, high);
+    }
+  }
+}
+
+struct access_trace* open_trace(const char* file_name) {
+  struct access_trace* trace = (struct access_trace*)calloc(1, sizeof(struct access_trace));
+  if (!trace) {
+    perror("calloc for memory trace failed\n");
+    return NULL;
+  }
+
+  trace->file = fopen(file_name, "wb");
+  if (!trace->file) {
+    perror("fopen for memory trace failed\n");
+    free(trace);
+    return NULL;
+  }
+
+  return trace;
+}
+
+// writes out what's buffered, false if any of the trace didn't make it to the file
+bool close_trace(struct access_trace* trace) {
+  flush_trace(trace);
+  bool ok = !ferror(trace->file);
+  ok &= fclose(trace->file) == 0;
+  free(trace);
+  return ok;
+}
+
+#endif // ADDRESS_SPACE_H_
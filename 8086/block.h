@@ -0,0 +1,627 @@
+#ifndef BLOCK_H_
+#define BLOCK_H_
+
+#include "stddef.h"
+#include "stdlib.h"
+#include "string.h"
+
+#include "types.h"
+#include "opcodes.h"
+#include "instruction.h"
+#include "decode_cache.h"
+#include "address_space.h"
+#include "sim.h"
+
+// Basic block translation: straight runs of instructions up to the next branch are lowered once into
+// micro-ops with every register already resolved to an offset, and blocks point at their successors
+// so a loop goes from block to block without a lookup. Arithmetic only records its inputs, the flags
+// are worked out when something reads them. Still plain interpretation, nothing native is generated.
+
+#define BLOCK_MAX_INSTRUCTIONS 32
+#define BLOCK_MAX_UOPS_PER_INSTRUCTION 4
+
+#define BLOCK_MAP_BITS 16
+#define BLOCK_MAP_SIZE (1u << BLOCK_MAP_BITS)
+#define BLOCK_MAP_MASK (BLOCK_MAP_SIZE - 1)
+
+// all of it is thrown away at once when one of these fills up or a translated byte is written
+#define MAX_BLOCKS (1u << 14)
+#define MAX_BLOCK_UOPS (MAX_BLOCKS * 8)
+#define MAX_BLOCK_GENERIC (MAX_BLOCKS * 4)
+
+// what micro-ops address by byte offset, the cpu registers then a temporary and a constant zero
+struct block_registers {
+  struct cpu cpu;
+  u16 temp;
+  u16 zero;
+};
+
+#define BLOCK_TEMP ((u8)offsetof(struct block_registers, temp))
+#define BLOCK_ZERO ((u8)offsetof(struct block_registers, zero))
+
+enum uop_kind {
+  Uop_Ea,          // address = segment:(base + index + imm)
+  Uop_Load,        // temp = [address]
+  Uop_Store,       // [address] = temp, leaves the block if that was code
+  Uop_Alu,         // dst = dst op src (or imm), flags recorded lazily
+  Uop_IncDec,      // dst = dst +/- 1
+  Uop_Generic,     // execute_instruction with the flags brought up to date
+  Uop_Jump,        // ip = imm, taken successor
+  Uop_Branch,      // jcc and the loops, ip = imm or next_ip
+  Uop_Exit,        // ip = next_ip, fall through successor
+  Uop_ExitDynamic, // ip was set by the instruction before, look the next block up
+};
+
+struct uop {
+  u8 kind;     // enum uop_kind
+  u8 op;       // enum op_type for alu, inc/dec and branches
+  u8 wide;
+  u8 dst;      // byte offset into block_registers
+  u8 src;      // byte offset into block_registers, unless has_imm
+  u8 has_imm;
+  u8 base;     // Uop_Ea registers, BLOCK_ZERO when not used
+  u8 index;
+  u8 segment;
+  u8 retired;  // instructions of the block finished once this uop is
+  u16 imm;     // immediate, displacement or branch target
+  u16 next_ip; // ip of the instruction after this one
+  u16 generic; // index into block_engine.generic for Uop_Generic
+};
+
+struct block {
+  u32 address;  // physical address of the first instruction
+  u16 ip;
+  u16 uop_count;
+  u32 first_uop;
+  struct block* next[2]; // fall through and taken successors, filled in the first time they're used
+};
+
+enum lazy_kind {
+  Lazy_None, // cpu.flags is up to date
+  Lazy_Add,
+  Lazy_Sub,
+  Lazy_Logic,
+  Lazy_Inc,
+  Lazy_Dec,
+};
+
+// the last flag setting operation, enough to work out any of its flags later
+struct lazy_flags {
+  u8 kind;   // enum lazy_kind
+  u8 wide;
+  u8 carry;  // carry in for adc/sbb, carry kept by inc/dec
+  u16 a;
+  u16 b;
+  u32 result;
+};
+
+struct block_engine {
+  struct block* map[BLOCK_MAP_SIZE]; // direct mapped on the physical address
+  struct block blocks[MAX_BLOCKS];
+  struct uop uops[MAX_BLOCK_UOPS];
+  struct instruction generic[MAX_BLOCK_GENERIC];
+  u32 block_count;
+  u32 uop_count;
+  u32 generic_count;
+
+  // every byte an instruction in the blocks was decoded from, attached to the address space while they
+  // run. the decode cache can't stand in for it, entries 64 KB apart evict each other and the blocks
+  // outlive what it still holds
+  u64 translated[TRANSLATED_WORDS];
+
+  u32 generation; // decode cache generation the blocks were built in, a bump means memory was replaced
+  u64 translations;
+  u64 flushes;
+};
+
+static struct block_engine* create_block_engine(void);
+static void flush_blocks(struct block_engine* engine);
+static u64 run_blocks(struct block_engine* engine, struct cpu* cpu, struct address_space* memory, u32 end, u64 limit, enum exec_result* result);
+
+
+struct block_engine* create_block_engine(void) {
+  struct block_engine* engine = (struct block_engine*)malloc(sizeof(struct block_engine));
+  if (!engine) {
+    perror("malloc for block engine failed\n");
+    return NULL;
+  }
+
+  flush_blocks(engine);
+  engine->generation = 0;
+  engine->translations = 0;
+  engine->flushes = 0;
+  return engine;
+}
+
+void flush_blocks(struct block_engine* engine) {
+  memset(engine->map, 0, sizeof(engine->map));
+  engine->block_count = 0;
+  engine->uop_count = 0;
+  engine->generic_count = 0;
+  memset(engine->translated, 0, sizeof(engine->translated));
+  ++engine->flushes;
+}
+
+///////////////////////////////////////////////////////////////
+/// Lazy flags
+static u8 lazy_carry(const struct lazy_flags* lazy, u16 flags) {
+  u16 mask = lazy->wide ? 0xffff : 0xff;
+  switch (lazy->kind) {
+    case Lazy_Add:   return lazy->result > mask;
+    case Lazy_Sub:   return (u32)lazy->a < (u32)lazy->b + lazy->carry;
+    case Lazy_Logic: return 0;
+    case Lazy_Inc:
+    case Lazy_Dec:   return lazy->carry;
+    default:         return (flags & Flag_CF) ? 1 : 0;
+  }
+}
+
+// the same flags add_sub and logic would have set
+static u16 lazy_eval(const struct lazy_flags* lazy, u16 flags) {
+  if (lazy->kind == Lazy_None) {
+    return flags;
+  }
+
+  const u16 arithmetic = Flag_CF | Flag_PF | Flag_AF | Flag_ZF | Flag_SF | Flag_OF;
+  const u16 mask = lazy->wide ? 0xffff : 0xff;
+  const u16 sign = lazy->wide ? 0x8000 : 0x80;
+  const u32 a = lazy->a;
+  const u32 b = lazy->b;
+  const u32 r = lazy->result;
+
+  u16 result = 0;
+  if ((r & mask) == 0)         result |= Flag_ZF;
+  if (r & sign)                result |= Flag_SF;
+  if (parity_even((u8)r))      result |= Flag_PF;
+  if (lazy_carry(lazy, flags)) result |= Flag_CF;
+
+  switch (lazy->kind) {
+    case Lazy_Add:
+    case Lazy_Inc:
+      if (~(a ^ b) & (a ^ r) & sign) result |= Flag_OF;
+      if ((a ^ b ^ r) & 0x10)        result |= Flag_AF;
+      break;
+    case Lazy_Sub:
+    case Lazy_Dec:
+      if ((a ^ b) & (a ^ r) & sign)  result |= Flag_OF;
+      if ((a ^ b ^ r) & 0x10)        result |= Flag_AF;
+      break;
+    default:
+      break;
+  }
+
+  return (u16)((flags & ~arithmetic) | result);
+}
+
+///////////////////////////////////////////////////////////////
+/// Translation
+static bool is_alu_op(u8 op) {
+  return op == Op_mov || op == Op_add || op == Op_adc || op == Op_sub || op == Op_sbb || op == Op_cmp ||
+         op == Op_and || op == Op_or || op == Op_xor || op == Op_test;
+}
+
+static bool is_branch_op(u8 op) {
+  return (op >= Op_jo && op <= Op_jg) || op == Op_loop || op == Op_loopz || op == Op_loopnz || op == Op_jcxz;
+}
+
+// anything that may move ip somewhere the block can't know, or stop the program
+static bool is_control_op(u8 op) {
+  return op == Op_call || op == Op_jmp || op == Op_ret || op == Op_retf || op == Op_int || op == Op_int3 ||
+         op == Op_into || op == Op_iret || op == Op_hlt || op == Op_None;
+}
+
+static u8 block_register_offset(u8 reg) {
+  if (reg >= Reg_ax) {
+    return (u8)(offsetof(struct block_registers, cpu.regs) + (reg - Reg_ax) * sizeof(u16));
+  }
+  // byte registers are the low or high half of their word, the host has to be little endian
+  return (u8)(offsetof(struct block_registers, cpu.regs) + (reg & 0b11) * sizeof(u16) + (reg >> 2));
+}
+
+static struct uop* emit_uop(struct block_engine* engine, struct block* block, u8 kind, u16 next_ip, u8 retired) {
+  struct uop* uop = engine->uops + engine->uop_count++;
+  memset(uop, 0, sizeof(*uop));
+  uop->kind = kind;
+  uop->next_ip = next_ip;
+  uop->retired = retired;
+  ++block->uop_count;
+  return uop;
+}
+
+static void emit_ea(struct block_engine* engine, struct block* block, const struct instruction* inst, const struct operand* operand, u16 next_ip, u8 retired) {
+  static const u8 bases[] = {Reg_bx, Reg_bx, Reg_bp, Reg_bp, 0, 0, Reg_bp, Reg_bx, 0};
+  static const u8 indexes[] = {Reg_si, Reg_di, Reg_si, Reg_di, Reg_si, Reg_di, 0, 0, 0};
+  static const u8 has_base[] = {1, 1, 1, 1, 0, 0, 1, 1, 0};
+  static const u8 has_index[] = {1, 1, 1, 1, 1, 1, 0, 0, 0};
+  static const u8 stack[] = {0, 0, 1, 1, 0, 0, 1, 0, 0};
+
+  u8 ea = operand->reg;
+  u8 segment = (inst->flags & Inst_Segment) ? inst->segment : (stack[ea] ? Reg_ss : Reg_ds);
+
+  struct uop* uop = emit_uop(engine, block, Uop_Ea, next_ip, retired);
+  uop->base = has_base[ea] ? block_register_offset(bases[ea]) : BLOCK_ZERO;
+  uop->index = has_index[ea] ? block_register_offset(indexes[ea]) : BLOCK_ZERO;
+  uop->segment = block_register_offset(segment);
+  uop->imm = (u16)operand->value;
+}
+
+static void lower_alu(struct block_engine* engine, struct block* block, const struct instruction* inst, u16 next_ip, u8 retired) {
+  const struct operand* a = inst->operands;
+  const struct operand* b = inst->operands + 1;
+  const u8 wide = (inst->flags & Inst_Wide) ? 1 : 0;
+  const bool writes = inst->op != Op_cmp && inst->op != Op_test;
+
+  u8 dst;
+  if (a->kind == Operand_Memory) {
+    emit_ea(engine, block, inst, a, next_ip, retired);
+    if (inst->op != Op_mov) {
+      emit_uop(engine, block, Uop_Load, next_ip, retired)->wide = wide;
+    }
+    dst = BLOCK_TEMP;
+  } else {
+    dst = block_register_offset(a->reg);
+  }
+
+  struct uop* alu = NULL;
+  if (b->kind == Operand_Memory) {
+    // at most one memory operand, so the address from the load is still there for a store
+    emit_ea(engine, block, inst, b, next_ip, retired);
+    emit_uop(engine, block, Uop_Load, next_ip, retired)->wide = wide;
+    alu = emit_uop(engine, block, Uop_Alu, next_ip, retired);
+    alu->src = BLOCK_TEMP;
+  } else if (b->kind == Operand_Register) {
+    alu = emit_uop(engine, block, Uop_Alu, next_ip, retired);
+    alu->src = block_register_offset(b->reg);
+  } else {
+    alu = emit_uop(engine, block, Uop_Alu, next_ip, retired);
+    alu->has_imm = 1;
+    alu->imm = (u16)b->value;
+  }
+
+  alu->op = inst->op;
+  alu->wide = wide;
+  alu->dst = dst;
+
+  if (a->kind == Operand_Memory && writes) {
+    emit_uop(engine, block, Uop_Store, next_ip, retired)->wide = wide;
+  }
+}
+
+// returns true when the instruction has to be the last in its block
+static bool lower_instruction(struct block_engine* engine, struct block* block, const struct instruction* inst, u16 ip, u16 next_ip, u8 retired) {
+  const struct operand* a = inst->operands;
+  const struct operand* b = inst->operands + 1;
+  const u8 wide = (inst->flags & Inst_Wide) ? 1 : 0;
+
+  // a new cs means every later ip in the block belongs to another segment, those stay generic and end it
+  const bool writes_cs = a->kind == Operand_Register && a->reg == Reg_cs;
+  const bool plain_operands = a->kind != Operand_Relative && b->kind != Operand_Relative &&
+                              (a->kind == Operand_Register || a->kind == Operand_Memory) &&
+                              !(a->kind == Operand_Memory && b->kind == Operand_Memory);
+
+  if (is_alu_op(inst->op) && plain_operands && b->kind != Operand_None && !writes_cs) {
+    lower_alu(engine, block, inst, next_ip, retired);
+    return false;
+  }
+
+  if ((inst->op == Op_inc || inst->op == Op_dec) && (a->kind == Operand_Register || a->kind == Operand_Memory)) {
+    u8 dst = BLOCK_TEMP;
+    if (a->kind == Operand_Memory) {
+      emit_ea(engine, block, inst, a, next_ip, retired);
+      emit_uop(engine, block, Uop_Load, next_ip, retired)->wide = wide;
+    } else {
+      dst = block_register_offset(a->reg);
+    }
+
+    struct uop* uop = emit_uop(engine, block, Uop_IncDec, next_ip, retired);
+    uop->op = inst->op;
+    uop->wide = wide;
+    uop->dst = dst;
+
+    if (a->kind == Operand_Memory) {
+      emit_uop(engine, block, Uop_Store, next_ip, retired)->wide = wide;
+    }
+    return false;
+  }
+
+  if (inst->op == Op_jmp && a->kind == Operand_Relative) {
+    emit_uop(engine, block, Uop_Jump, next_ip, retired)->imm = (u16)(next_ip + a->value);
+    return true;
+  }
+
+  if (is_branch_op(inst->op) && a->kind == Operand_Relative) {
+    struct uop* uop = emit_uop(engine, block, Uop_Branch, next_ip, retired);
+    uop->op = inst->op;
+    uop->imm = (u16)(next_ip + a->value);
+    return true;
+  }
+
+  struct uop* uop = emit_uop(engine, block, Uop_Generic, next_ip, retired);
+  uop->generic = (u16)engine->generic_count;
+  uop->imm = ip;
+  engine->generic[engine->generic_count++] = *inst;
+
+  if (is_control_op(inst->op) || writes_cs) {
+    emit_uop(engine, block, Uop_ExitDynamic, next_ip, retired);
+    return true;
+  }
+  return false;
+}
+
+static void mark_translated(struct block_engine* engine, u16 cs, u16 ip, u32 size) {
+  for (u32 i = 0; i < size; ++i) {
+    u32 address = physical_address(cs, (u16)(ip + i));
+    engine->translated[address / 64] |= 1ull << (address % 64);
+  }
+}
+
+static struct block* translate_block(struct block_engine* engine, struct address_space* memory, u16 cs, u16 ip, u32 end) {
+  const u32 worst_uops = BLOCK_MAX_INSTRUCTIONS * BLOCK_MAX_UOPS_PER_INSTRUCTION + 1;
+  if (engine->block_count == MAX_BLOCKS || engine->uop_count + worst_uops > MAX_BLOCK_UOPS ||
+      engine->generic_count + BLOCK_MAX_INSTRUCTIONS > MAX_BLOCK_GENERIC) {
+    flush_blocks(engine);
+  }
+
+  struct block* block = engine->blocks + engine->block_count;
+  block->address = physical_address(cs, ip);
+  block->ip = ip;
+  block->uop_count = 0;
+  block->first_uop = engine->uop_count;
+  block->next[0] = NULL;
+  block->next[1] = NULL;
+
+  u16 cursor = ip;
+  for (u8 n = 1; n <= BLOCK_MAX_INSTRUCTIONS; ++n) {
+    const struct instruction* inst = fetch_instruction(memory->cache, memory->bytes, physical_address(cs, cursor));
+    if (!inst) {
+      if (n == 1) {
+        engine->uop_count = block->first_uop;
+        return NULL;
+      }
+      emit_uop(engine, block, Uop_Exit, cursor, (u8)(n - 1));
+      break;
+    }
+    mark_translated(engine, cs, cursor, inst->size);
+
+    u16 next_ip = (u16)(cursor + inst->size);
+    if (lower_instruction(engine, block, inst, cursor, next_ip, n)) {
+      break;
+    }
+
+    // stop where the program ends, where ip wraps and at the size limit
+    if (next_ip >= end || next_ip < cursor || n == BLOCK_MAX_INSTRUCTIONS) {
+      emit_uop(engine, block, Uop_Exit, next_ip, n);
+      break;
+    }
+    cursor = next_ip;
+  }
+
+  ++engine->block_count;
+  ++engine->translations;
+  engine->map[block->address & BLOCK_MAP_MASK] = block;
+  return block;
+}
+
+static struct block* find_block(struct block_engine* engine, struct address_space* memory, u16 cs, u16 ip, u32 end) {
+  u32 address = physical_address(cs, ip);
+  struct block* block = engine->map[address & BLOCK_MAP_MASK];
+  if (block && block->address == address && block->ip == ip) {
+    return block;
+  }
+  return translate_block(engine, memory, cs, ip, end);
+}
+
+///////////////////////////////////////////////////////////////
+/// Execution
+#define REG_LOAD(offset, wide) ((wide) ? *(u16*)(regs + (offset)) : regs[offset])
+#define REG_STORE(offset, wide, value) \
+  do { if (wide) *(u16*)(regs + (offset)) = (u16)(value); else regs[offset] = (u8)(value); } while (0)
+
+// same contract as run_switch, the results have to match it exactly. a write to any translated byte
+// leaves the block after that instruction and flushes them all. writes between calls aren't seen,
+// whoever changes memory then flushes the blocks (a new decode cache generation does it too).
+// a block could run past the limit, the last few instructions before it go through run_switch
+u64 run_blocks(struct block_engine* engine, struct cpu* cpu, struct address_space* memory, u32 end, u64 limit, enum exec_result* result) {
+  struct block_registers file;
+  file.cpu = *cpu;
+  file.temp = 0;
+  file.zero = 0;
+
+  u8* regs = (u8*)&file;
+  struct lazy_flags lazy;
+  memset(&lazy, 0, sizeof(lazy));
+
+  u64 count = 0;
+  u32 address = 0;
+  bool stop = false;
+  struct block* block = NULL;
+  *result = Exec_Continue;
+
+  if (engine->generation != memory->cache->generation) {
+    flush_blocks(engine);
+    engine->generation = memory->cache->generation;
+  }
+  memory->translated = engine->translated;
+  u32 translated_writes = memory->translated_writes;
+
+  while (!stop && file.cpu.ip < end && limit - count >= BLOCK_MAX_INSTRUCTIONS) {
+    if (!block) {
+      block = find_block(engine, memory, file.cpu.regs[Reg_cs - Reg_ax], file.cpu.ip, end);
+      if (!block) {
+        break;
+      }
+    }
+
+    int successor = -1; // which next[] to follow, -1 to look the block up
+    const struct uop* uop = engine->uops + block->first_uop;
+    for (;; ++uop) {
+      switch (uop->kind) {
+        case Uop_Ea: {
+          u16 offset = (u16)(*(u16*)(regs + uop->base) + *(u16*)(regs + uop->index) + uop->imm);
+          address = far_pointer(*(u16*)(regs + uop->segment), offset);
+          continue;
+        }
+
+        case Uop_Load:
+          file.temp = read_memory(memory, address, uop->wide);
+          continue;
+
+        case Uop_Store:
+          write_memory(memory, address, file.temp, uop->wide);
+          if (translated_writes != memory->translated_writes) {
+            // the block may have just rewritten itself, finish this instruction and start over
+            file.cpu.ip = uop->next_ip;
+            count += uop->retired;
+            goto code_written;
+          }
+          continue;
+
+        case Uop_Alu: {
+          const u16 mask = uop->wide ? 0xffff : 0xff;
+          const u16 a = (u16)(REG_LOAD(uop->dst, uop->wide) & mask);
+          const u16 b = (u16)((uop->has_imm ? uop->imm : REG_LOAD(uop->src, uop->wide)) & mask);
+
+          u32 value = 0;
+          switch (uop->op) {
+            case Op_mov:
+              REG_STORE(uop->dst, uop->wide, b);
+              continue;
+            case Op_adc:
+            case Op_add:
+              lazy.carry = uop->op == Op_adc ? lazy_carry(&lazy, file.cpu.flags) : 0;
+              value = (u32)a + b + lazy.carry;
+              lazy.kind = Lazy_Add;
+              break;
+            case Op_sbb:
+            case Op_sub:
+            case Op_cmp:
+              lazy.carry = uop->op == Op_sbb ? lazy_carry(&lazy, file.cpu.flags) : 0;
+              value = (u32)a - b - lazy.carry;
+              lazy.kind = Lazy_Sub;
+              break;
+            case Op_and:
+            case Op_test: value = a & b; lazy.kind = Lazy_Logic; break;
+            case Op_or:   value = a | b; lazy.kind = Lazy_Logic; break;
+            case Op_xor:  value = a ^ b; lazy.kind = Lazy_Logic; break;
+          }
+
+          lazy.wide = uop->wide;
+          lazy.a = a;
+          lazy.b = b;
+          lazy.result = value;
+          if (uop->op != Op_cmp && uop->op != Op_test) {
+            REG_STORE(uop->dst, uop->wide, value);
+          }
+          continue;
+        }
+
+        case Uop_IncDec: {
+          const u16 mask = uop->wide ? 0xffff : 0xff;
+          const u16 a = (u16)(REG_LOAD(uop->dst, uop->wide) & mask);
+          lazy.carry = lazy_carry(&lazy, file.cpu.flags);
+          lazy.kind = uop->op == Op_inc ? Lazy_Inc : Lazy_Dec;
+          lazy.wide = uop->wide;
+          lazy.a = a;
+          lazy.b = 1;
+          lazy.result = uop->op == Op_inc ? (u32)a + 1 : (u32)a - 1;
+          REG_STORE(uop->dst, uop->wide, lazy.result);
+          continue;
+        }
+
+        case Uop_Generic: {
+          file.cpu.flags = lazy_eval(&lazy, file.cpu.flags);
+          lazy.kind = Lazy_None;
+          file.cpu.ip = uop->imm;
+
+          *result = execute_instruction(&file.cpu, memory, engine->generic + uop->generic);
+          if (*result == Exec_Unsupported) {
+            count += uop->retired - 1;
+            stop = true;
+            goto block_done;
+          }
+          if (*result == Exec_Halt) {
+            count += uop->retired;
+            stop = true;
+            goto block_done;
+          }
+          if (translated_writes != memory->translated_writes) {
+            count += uop->retired;
+            goto code_written;
+          }
+          continue;
+        }
+
+        case Uop_Jump:
+          file.cpu.ip = uop->imm;
+          count += uop->retired;
+          successor = 1;
+          goto block_done;
+
+        case Uop_Branch: {
+          file.cpu.flags = lazy_eval(&lazy, file.cpu.flags);
+          lazy.kind = Lazy_None;
+          bool taken = jump_taken(&file.cpu, uop->op);
+          file.cpu.ip = taken ? uop->imm : uop->next_ip;
+          count += uop->retired;
+          successor = taken ? 1 : 0;
+          goto block_done;
+        }
+
+        case Uop_Exit:
+          file.cpu.ip = uop->next_ip;
+          count += uop->retired;
+          successor = 0;
+          goto block_done;
+
+        case Uop_ExitDynamic:
+          count += uop->retired;
+          goto block_done;
+      }
+    }
+
+code_written:
+    flush_blocks(engine);
+    engine->generation = memory->cache->generation;
+    translated_writes = memory->translated_writes;
+    block = NULL;
+    continue;
+
+block_done:
+    if (successor < 0 || stop || file.cpu.ip >= end) {
+      block = NULL;
+      continue;
+    }
+
+    struct block* next = block->next[successor];
+    if (!next) {
+      u64 flushes = engine->flushes;
+      next = find_block(engine, memory, file.cpu.regs[Reg_cs - Reg_ax], file.cpu.ip, end);
+      if (next && flushes == engine->flushes) {
+        block->next[successor] = next;
+      }
+    }
+    block = next;
+    if (!block) {
+      break;
+    }
+  }
+
+  file.cpu.flags = lazy_eval(&lazy, file.cpu.flags);
+  *cpu = file.cpu;
+
+  if (!stop && limit - count < BLOCK_MAX_INSTRUCTIONS) {
+    count += run_switch(cpu, memory, end, limit - count, result);
+  }
+
+  // the map comes off with this call, what run_switch wrote over the blocks flushes them now
+  if (translated_writes != memory->translated_writes) {
+    flush_blocks(engine);
+  }
+  memory->translated = NULL;
+  return count;
+}
+
+#undef REG_LOAD
+#undef REG_STORE
+
+#endif // BLOCK_H_
@@ -0,0 +1,346 @@
+#ifndef CLOCKS_H_
+#define CLOCKS_H_
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+
+#include "types.h"
+#include "opcodes.h"
+#include "instruction.h"
+#include "format.h"
+#include "sim.h"
+
+// 8086 clock estimates from the timing tables in the Intel manual: base clocks per form, the effective
+// address calculation on top and 4 clocks for every word moved to or from an odd address.
+// branches need to know if they were taken and string ops how often they repeated, so an estimate is
+// made from the cpu before and after the instruction ran
+
+struct clock_estimate {
+  u32 base;    // rep string ops pay per repetition
+  u8 ea;       // effective address calculation
+  u8 penalty;  // odd address word transfers
+};
+
+// dynamic basic blocks, everything from a jump target up to the next control transfer.
+// keyed on ip alone, the simulator never leaves the first code segment
+struct block_clocks {
+  u16 start;
+  u16 end;      // ip of the last instruction
+  u64 runs;
+  u64 instructions;
+  u64 clocks;
+};
+
+struct clock_profile {
+  struct block_clocks* blocks; // indexed by start ip, runs == 0 is unused
+  u64 total;
+  u64 instructions;
+  u16 current;                 // start of the block being run
+  u16 last;                    // ip of the instruction profiled last
+  u64 current_instructions;
+  u64 current_clocks;
+  bool in_block;
+};
+
+static struct clock_estimate estimate_clocks(const struct cpu* before, const struct cpu* after, const struct instruction* inst);
+static void format_clocks(struct output_buffer* out, struct clock_estimate clocks, u64 total);
+static bool init_clock_profile(struct clock_profile* profile);
+static void free_clock_profile(struct clock_profile* profile);
+static void profile_clocks(struct clock_profile* profile, const struct cpu* before, const struct cpu* after, const struct instruction* inst, struct clock_estimate clocks);
+static void finish_clock_profile(struct clock_profile* profile);
+static void format_clock_profile(struct output_buffer* out, const struct clock_profile* profile);
+
+
+static u32 clock_total(struct clock_estimate clocks) {
+  return (u32)(clocks.base + clocks.ea + clocks.penalty);
+}
+
+///////////////////////////////////////////////////////////////
+/// Estimation
+static u8 ea_clocks(const struct instruction* inst, const struct operand* operand) {
+  // [bp] only exists with a displacement, mod 00 r/m 110 is the direct address
+  bool disp = operand->value != 0 || operand->reg == Ea_bp;
+  u8 clocks = 0;
+  switch (operand->reg) {
+    case Ea_Direct: clocks = 6; break;
+    case Ea_bx_si:
+    case Ea_bp_di:  clocks = disp ? 11 : 7; break;
+    case Ea_bx_di:
+    case Ea_bp_si:  clocks = disp ? 12 : 8; break;
+    default:        clocks = disp ? 9 : 5; break;
+  }
+  return (u8)(clocks + ((inst->flags & Inst_Segment) ? 2 : 0));
+}
+
+// word transfers the form makes through its memory operand
+static u8 memory_transfers(const struct instruction* inst) {
+  switch (inst->op) {
+    case Op_mov: case Op_cmp: case Op_test: case Op_push: case Op_pop:
+    case Op_mul: case Op_imul: case Op_div: case Op_idiv:
+    case Op_call: case Op_jmp:
+      return 1;
+    case Op_lds: case Op_les:
+      return 2;
+    default:
+      return inst->operands[0].kind == Operand_Memory ? 2 : 1; // read, modify and write back
+  }
+}
+
+static bool is_accumulator(const struct operand* operand) {
+  return operand->kind == Operand_Register && (operand->reg == Reg_al || operand->reg == Reg_ax);
+}
+
+// base clocks for one of the two operand alu forms, ordered reg,reg / reg,mem / mem,reg / reg,imm / mem,imm / acc,imm
+static u16 alu_clocks(const struct operand* a, const struct operand* b, const u16 forms[6]) {
+  if (a->kind == Operand_Memory) {
+    return b->kind == Operand_Immediate ? forms[4] : forms[2];
+  }
+  if (b->kind == Operand_Memory) {
+    return forms[1];
+  }
+  if (b->kind == Operand_Immediate) {
+    return is_accumulator(a) ? forms[5] : forms[3];
+  }
+  return forms[0];
+}
+
+// mov al/ax to or from a direct address has its own 3 byte encoding, 10 clocks with no address calculation
+static bool is_accumulator_move(const struct instruction* inst) {
+  const struct operand* a = inst->operands;
+  const struct operand* b = inst->operands + 1;
+  return inst->op == Op_mov && inst->size == 3 &&
+         ((a->kind == Operand_Memory && a->reg == Ea_Direct && is_accumulator(b)) ||
+          (b->kind == Operand_Memory && b->reg == Ea_Direct && is_accumulator(a)));
+}
+
+static u32 base_clocks(const struct cpu* before, const struct cpu* after, const struct instruction* inst) {
+  static const u16 mov_forms[6] = {2, 8, 9, 4, 10, 4};
+  static const u16 arith_forms[6] = {3, 9, 16, 4, 17, 4};
+  static const u16 cmp_forms[6] = {3, 9, 9, 4, 10, 4};
+  static const u16 test_forms[6] = {3, 9, 9, 5, 11, 4};
+
+  const struct operand* a = inst->operands;
+  const struct operand* b = inst->operands + 1;
+  const bool wide = inst->flags & Inst_Wide;
+  const bool memory = a->kind == Operand_Memory || b->kind == Operand_Memory;
+  const bool taken = after->ip != (u16)(before->ip + inst->size);
+  const u16 cx_before = before->regs[Reg_cx - Reg_ax];
+  const u16 cx_after = after->regs[Reg_cx - Reg_ax];
+
+  switch (inst->op) {
+    case Op_mov:
+      return is_accumulator_move(inst) ? 10 : alu_clocks(a, b, mov_forms);
+
+    case Op_add: case Op_adc: case Op_sub: case Op_sbb:
+    case Op_and: case Op_or: case Op_xor:
+      return alu_clocks(a, b, arith_forms);
+    case Op_cmp:  return alu_clocks(a, b, cmp_forms);
+    case Op_test: return alu_clocks(a, b, test_forms);
+
+    case Op_inc: case Op_dec:
+      return memory ? 15 : (wide ? 2 : 3);
+    case Op_neg: case Op_not:
+      return memory ? 16 : 3;
+    case Op_xchg:
+      if (memory) return 17;
+      return (is_accumulator(a) || is_accumulator(b)) && wide ? 3 : 4;
+
+    case Op_push:  return memory ? 16 : (a->reg >= Reg_es ? 10 : 11);
+    case Op_pop:   return memory ? 17 : 8;
+    case Op_pushf: return 10;
+    case Op_popf:  return 8;
+    case Op_lea:   return 2;
+    case Op_lds: case Op_les: return 16;
+    case Op_lahf: case Op_sahf: return 4;
+    case Op_cbw:   return 2;
+    case Op_cwd:   return 5;
+    case Op_xlat:  return 11;
+    case Op_in:    return b->kind == Operand_Immediate ? 10 : 8;
+    case Op_out:   return a->kind == Operand_Immediate ? 10 : 8;
+
+    case Op_shl: case Op_shr: case Op_sar: case Op_rol: case Op_ror: case Op_rcl: case Op_rcr:
+      if (b->kind == Operand_Register) {
+        return (u16)((memory ? 20 : 8) + 4 * (before->regs[Reg_cx - Reg_ax] & 0xff));
+      }
+      return memory ? 15 : 2;
+
+    case Op_mul:  return memory ? (wide ? 124 : 76) : (wide ? 118 : 70);
+    case Op_imul: return memory ? (wide ? 134 : 86) : (wide ? 128 : 80);
+    case Op_div:  return memory ? (wide ? 150 : 86) : (wide ? 144 : 80);
+    case Op_idiv: return memory ? (wide ? 171 : 107) : (wide ? 165 : 101);
+    case Op_aaa: case Op_aas: return 4;
+    case Op_daa: case Op_das: return 4;
+    case Op_aam:  return 83;
+    case Op_aad:  return 60;
+
+    case Op_movs: case Op_cmps: case Op_scas: case Op_lods: case Op_stos: {
+      static const u16 single[] = {18, 22, 15, 12, 11};
+      static const u16 repeated[] = {17, 22, 15, 13, 10};
+      u8 index = (u8)(inst->op - Op_movs);
+      if (!(inst->flags & (Inst_Rep | Inst_Repne))) {
+        return single[index];
+      }
+      return 9 + repeated[index] * (u32)(u16)(cx_before - cx_after);
+    }
+
+    case Op_call:
+      if (inst->flags & Inst_Far) return memory ? 37 : 28;
+      return a->kind == Operand_Relative ? 19 : (memory ? 21 : 16);
+    case Op_jmp:
+      if (inst->flags & Inst_Far) return memory ? 24 : 15;
+      return a->kind == Operand_Relative || a->kind == Operand_Immediate ? 15 : (memory ? 18 : 11);
+    case Op_ret:  return a->kind == Operand_Immediate ? 12 : 8;
+    case Op_retf: return a->kind == Operand_Immediate ? 17 : 18;
+    case Op_int:  return 51;
+    case Op_int3: return 52;
+    case Op_into: return taken ? 53 : 4;
+    case Op_iret: return 24;
+
+    case Op_loop:   return taken ? 17 : 5;
+    case Op_loopz:  return taken ? 18 : 6;
+    case Op_loopnz: return taken ? 19 : 5;
+    case Op_jcxz:   return taken ? 18 : 6;
+
+    case Op_clc: case Op_cmc: case Op_stc: case Op_cld: case Op_std: case Op_cli: case Op_sti:
+      return 2;
+    case Op_hlt:  return 2;
+    case Op_wait: return 3;
+    case Op_nop:  return 3;
+    case Op_esc:  return memory ? 8 : 2;
+
+    default:
+      if (inst->op >= Op_jo && inst->op <= Op_jg) {
+        return taken ? 16 : 4;
+      }
+      return 0;
+  }
+}
+
+struct clock_estimate estimate_clocks(const struct cpu* before, const struct cpu* after, const struct instruction* inst) {
+  struct clock_estimate clocks = {base_clocks(before, after, inst), 0, 0};
+
+  for (int i = 0; i < 2; ++i) {
+    const struct operand* operand = inst->operands + i;
+    if (operand->kind != Operand_Memory) {
+      continue;
+    }
+
+    clocks.ea = is_accumulator_move(inst) ? 0 : ea_clocks(inst, operand);
+    if ((inst->flags & Inst_Wide) && (memory_address(before, inst, operand) & 1)) {
+      clocks.penalty = (u8)(4 * memory_transfers(inst));
+    }
+  }
+
+  return clocks;
+}
+
+///////////////////////////////////////////////////////////////
+/// Output
+// "Clocks: +13 = 17 (8 + 5ea)", with "+ 4p" when the transfer was odd
+void format_clocks(struct output_buffer* out, struct clock_estimate clocks, u64 total) {
+  append_string(out, "Clocks: +");
+  append_unsigned(out, clock_total(clocks));
+  append_string(out, " = ");
+  append_unsigned(out, total);
+
+  if (clocks.ea || clocks.penalty) {
+    append_string(out, " (");
+    append_unsigned(out, clocks.base);
+    if (clocks.ea) {
+      append_string(out, " + ");
+      append_unsigned(out, clocks.ea);
+      append_string(out, "ea");
+    }
+    if (clocks.penalty) {
+      append_string(out, " + ");
+      append_unsigned(out, clocks.penalty);
+      append_string(out, "p");
+    }
+    append_char(out, ')');
+  }
+}
+
+///////////////////////////////////////////////////////////////
+/// Profile
+bool init_clock_profile(struct clock_profile* profile) {
+  memset(profile, 0, sizeof(*profile));
+  profile->blocks = (struct block_clocks*)calloc(1u << 16, sizeof(struct block_clocks));
+  if (!profile->blocks) {
+    perror("calloc for clock profile failed\n");
+    return false;
+  }
+  return true;
+}
+
+void free_clock_profile(struct clock_profile* profile) {
+  free(profile->blocks);
+  profile->blocks = NULL;
+}
+
+static bool ends_block(const struct cpu* before, const struct cpu* after, const struct instruction* inst) {
+  u8 op = inst->op;
+  return after->ip != (u16)(before->ip + inst->size) || (op >= Op_call && op <= Op_iret) || op == Op_hlt;
+}
+
+void profile_clocks(struct clock_profile* profile, const struct cpu* before, const struct cpu* after, const struct instruction* inst, struct clock_estimate clocks) {
+  if (!profile->in_block) {
+    profile->current = before->ip;
+    profile->current_instructions = 0;
+    profile->current_clocks = 0;
+    profile->in_block = true;
+  }
+
+  u32 total = clock_total(clocks);
+  profile->last = before->ip;
+  profile->total += total;
+  ++profile->instructions;
+  profile->current_clocks += total;
+  ++profile->current_instructions;
+
+  if (ends_block(before, after, inst)) {
+    finish_clock_profile(profile);
+  }
+}
+
+// closes the block in progress, the program can also stop by running off its end
+void finish_clock_profile(struct clock_profile* profile) {
+  if (!profile->in_block) {
+    return;
+  }
+
+  struct block_clocks* block = profile->blocks + profile->current;
+  block->start = profile->current;
+  block->end = profile->last;
+  ++block->runs;
+  block->instructions += profile->current_instructions;
+  block->clocks += profile->current_clocks;
+  profile->in_block = false;
+}
+
+void format_clock_profile(struct output_buffer* out, const struct clock_profile* profile) {
+  char line[MAX_LINE_LENGTH * 2];
+
+  reserve_output(out, sizeof(line) * 2);
+  append_string(out, "\nClocks per basic block:\n");
+  snprintf(line, sizeof(line), "%8s %8s %10s %14s %14s %7s\n", "start", "end", "runs", "instructions", "clocks", "share");
+  append_string(out, line);
+
+  for (u32 ip = 0; ip < (1u << 16); ++ip) {
+    const struct block_clocks* block = profile->blocks + ip;
+    if (!block->runs) {
+      continue;
+    }
+
+    reserve_output(out, sizeof(line));
+    snprintf(line, sizeof(line), "  0x%04x   0x%04x %10lu %14lu %14lu %6.2f%%\n", block->start, block->end, block->runs,
+             block->instructions, block->clocks, profile->total ? 100.0 * (f64)block->clocks / (f64)profile->total : 0.0);
+    append_string(out, line);
+  }
+
+  reserve_output(out, sizeof(line));
+  snprintf(line, sizeof(line), "Total: %lu clocks over %lu instructions\n", profile->total, profile->instructions);
+  append_string(out, line);
+}
+
+#endif // CLOCKS_H_
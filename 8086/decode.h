@@ -0,0 +1,316 @@
+#ifndef DECODE_H_
+#define DECODE_H_
+
+#include "string.h"
+
+#include "types.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "instruction.h"
+
+// byte 1 format
+#define MASK_D      0b00000010 // 1 bit
+#define MASK_W      0b00000001 // 1 bit
+
+// byte 2 format
+#define MASK_MOD    0b11000000 // 2 bits
+#define MASK_REG    0b00111000 // 3 bits
+#define MASK_RM     0b00000111 // 3 bits
+
+// the encoded fields of one instruction, only alive while it is being decoded
+struct encoded_fields {
+  u8 w, d, s;
+  u8 mod, reg, rm;
+  u8 size;
+  i16 disp;
+  u16 data;   // immediate, port, address or relative displacement
+  u16 data2;  // segment of a far pointer
+};
+
+static bool decode_instruction(struct memory* m, struct instruction* inst);
+static MAYBE_UNUSED size_t decode_instructions(struct memory* m, struct instruction* output, size_t capacity);
+
+
+static bool fetch_byte(struct memory* m, struct encoded_fields* fields, u8* output) {
+  size_t read_size = read_byte(m, output);
+  fields->size += read_size;
+  return read_size == 1;
+}
+
+static bool fetch_word(struct memory* m, struct encoded_fields* fields, u16* output) {
+  size_t read_size = read_word(m, output);
+  fields->size += read_size;
+  return read_size == 2;
+}
+
+static bool fetch_data(struct memory* m, struct encoded_fields* fields, bool wide, bool sign_extend) {
+  if (wide && !sign_extend) {
+    return fetch_word(m, fields, &fields->data);
+  }
+
+  u8 byte;
+  if (!fetch_byte(m, fields, &byte)) {
+    return false;
+  }
+  fields->data = sign_extend ? (u16)(i16)(i8)byte : byte;
+  return true;
+}
+
+static void set_operand(struct operand* operand, u8 kind, u8 reg, i16 value) {
+  operand->kind = kind;
+  operand->reg = reg;
+  operand->value = value;
+}
+
+static void set_register(struct operand* operand, u8 w, u8 reg) {
+  set_operand(operand, Operand_Register, (u8)(reg + (w << 3)), 0);
+}
+
+static void set_rm(struct operand* operand, const struct encoded_fields* fields) {
+  if (fields->mod == 0b11) {
+    set_register(operand, fields->w, fields->rm);
+  } else if (fields->mod == 0b00 && fields->rm == 0b110) {
+    set_operand(operand, Operand_Memory, Ea_Direct, fields->disp);
+  } else {
+    set_operand(operand, Operand_Memory, fields->rm, fields->disp);
+  }
+}
+
+// immediates keep their sign so byte and word operations can share them
+static void set_immediate(struct operand* operand, const struct encoded_fields* fields) {
+  set_operand(operand, Operand_Immediate, 0, fields->w ? (i16)fields->data : (i8)fields->data);
+}
+
+static void set_unsigned(struct operand* operand, u16 value) {
+  set_operand(operand, Operand_Immediate, 0, (i16)value);
+}
+
+// puts the pair in encoding order, or swapped when d says the second one is the destination
+static void set_direction(struct instruction* inst, u8 d) {
+  if (d) {
+    struct operand swap = inst->operands[0];
+    inst->operands[0] = inst->operands[1];
+    inst->operands[1] = swap;
+  }
+}
+
+static void build_operands(struct instruction* inst, struct opcode_entry entry, u8 opcode, const struct encoded_fields* fields) {
+  struct operand* a = inst->operands;
+  struct operand* b = inst->operands + 1;
+
+  switch (entry.form) {
+    case Form_None: break;
+    case Form_RM_Reg:
+      set_rm(a, fields);
+      set_register(b, fields->w, fields->reg);
+      set_direction(inst, fields->d);
+      break;
+    case Form_RM:
+      set_rm(a, fields);
+      break;
+    case Form_RM_Imm:
+      set_rm(a, fields);
+      set_immediate(b, fields);
+      break;
+    case Form_RM_Shift:
+      set_rm(a, fields);
+      if (fields->d) {
+        set_operand(b, Operand_Register, Reg_cl, 0);
+      } else {
+        set_operand(b, Operand_Immediate, 0, 1);
+      }
+      break;
+    case Form_RM_Seg:
+      set_rm(a, fields);
+      set_operand(b, Operand_Register, (u8)(Reg_es + (fields->reg & 0b11)), 0);
+      set_direction(inst, fields->d);
+      break;
+    case Form_Reg_Mem:
+      set_register(a, 1, fields->reg);
+      set_rm(b, fields);
+      break;
+    case Form_Acc_Imm:
+      set_register(a, fields->w, 0);
+      set_immediate(b, fields);
+      break;
+    case Form_Acc_Mem:
+      // the d bit points the other way round from mod r/m forms
+      set_register(a, fields->w, 0);
+      set_operand(b, Operand_Memory, Ea_Direct, (i16)fields->data);
+      set_direction(inst, fields->d);
+      break;
+    case Form_Acc_Reg:
+      set_register(a, 1, 0);
+      set_register(b, 1, fields->reg);
+      break;
+    case Form_Reg:
+      set_register(a, 1, fields->reg);
+      break;
+    case Form_Reg_Imm:
+      set_register(a, fields->w, fields->reg);
+      set_immediate(b, fields);
+      break;
+    case Form_Seg:
+      set_operand(a, Operand_Register, (u8)(Reg_es + fields->reg), 0);
+      break;
+    case Form_Acc_Port:
+      set_register(a, fields->w, 0);
+      set_unsigned(b, fields->data);
+      set_direction(inst, entry.op == Op_out);
+      break;
+    case Form_Acc_DX:
+      set_register(a, fields->w, 0);
+      set_operand(b, Operand_Register, Reg_dx, 0);
+      set_direction(inst, entry.op == Op_out);
+      break;
+    case Form_Rel8:
+    case Form_Rel16:
+      set_operand(a, Operand_Relative, 0, (i16)fields->data);
+      break;
+    case Form_Far:
+      set_unsigned(a, fields->data2);
+      set_unsigned(b, fields->data);
+      break;
+    case Form_Imm8:
+    case Form_Imm16:
+      set_unsigned(a, fields->data);
+      break;
+    case Form_Esc:
+      set_unsigned(a, (u16)(((opcode & 0b111) << 3) | fields->reg));
+      set_rm(b, fields);
+      break;
+  }
+}
+
+// one lookup in opcode_table (and opcode_ext_table for groups) says how to read the rest,
+// bytes come from the image at the cursor and running off its end fails the instruction
+bool decode_instruction(struct memory* m, struct instruction* inst) {
+  memset(inst, 0, sizeof(*inst));
+  inst->address = (u32)m->position;
+
+  struct encoded_fields fields;
+  memset(&fields, 0, sizeof(fields));
+
+  u8 byte;
+  struct opcode_entry entry;
+  for (;;) {
+    if (!fetch_byte(m, &fields, &byte)) {
+      return false;
+    }
+
+    entry = opcode_table[byte];
+    if (!(entry.flags & Flag_Prefix)) {
+      break;
+    }
+    if (fields.size > MAX_PREFIXES) {
+      // the run so far is the instruction, the byte starts the next one
+      --m->position;
+      --fields.size;
+      entry = (struct opcode_entry){Op_None, Form_None, 0};
+      break;
+    }
+
+    switch (entry.op) {
+      case Op_lock:  inst->flags |= Inst_Lock; break;
+      case Op_rep:   inst->flags |= Inst_Rep; break;
+      case Op_repne: inst->flags |= Inst_Repne; break;
+      default:
+        inst->flags |= Inst_Segment;
+        inst->segment = (u8)(Reg_es + ((byte >> 3) & 0b11));
+        break;
+    }
+  }
+
+  if (entry.flags & Flag_W)    fields.w = byte & MASK_W;
+  if (entry.flags & Flag_W3)   fields.w = (byte >> 3) & 1;
+  if (entry.flags & Flag_Wide) fields.w = 1;
+  if (entry.flags & Flag_D)    fields.d = (byte & MASK_D) >> 1;
+  if (entry.flags & Flag_S)    fields.s = (byte & MASK_D) >> 1;
+
+  if (form_has_modrm(entry.form)) {
+    u8 modrm;
+    if (!fetch_byte(m, &fields, &modrm)) {
+      return false;
+    }
+
+    fields.mod = (modrm & MASK_MOD) >> 6;
+    fields.reg = (modrm & MASK_REG) >> 3;
+    fields.rm = modrm & MASK_RM;
+
+    if (entry.flags & Flag_Group) {
+      struct opcode_entry ext = opcode_ext_table[entry.op][fields.reg];
+      entry.op = ext.op;
+      entry.form = ext.form;
+      entry.flags = (entry.flags & ~Flag_Group) | ext.flags;
+    }
+
+    if (fields.mod == 0b01) { // 8 bit displacement
+      u8 disp;
+      if (!fetch_byte(m, &fields, &disp)) {
+        return false;
+      }
+      fields.disp = (i8)disp;
+    } else if (fields.mod == 0b10 || (fields.mod == 0b00 && fields.rm == 0b110)) { // 16 bit displacement
+      u16 disp;
+      if (!fetch_word(m, &fields, &disp)) {
+        return false;
+      }
+      fields.disp = (i16)disp;
+    }
+  }
+
+  switch (entry.form) {
+    case Form_Reg:
+    case Form_Reg_Imm:
+    case Form_Acc_Reg: fields.reg = byte & 0b111; break;
+    case Form_Seg:     fields.reg = (byte >> 3) & 0b11; break;
+    default: break;
+  }
+
+  bool ok = true;
+  switch (entry.form) {
+    case Form_RM_Imm:   ok = fetch_data(m, &fields, fields.w, fields.s); break;
+    case Form_Acc_Imm:
+    case Form_Reg_Imm:  ok = fetch_data(m, &fields, fields.w, false); break;
+    case Form_Acc_Mem:
+    case Form_Rel16:
+    case Form_Imm16:    ok = fetch_data(m, &fields, true, false); break;
+    case Form_Rel8:     ok = fetch_data(m, &fields, false, true); break;
+    case Form_Acc_Port:
+    case Form_Imm8:     ok = fetch_data(m, &fields, false, false); break;
+    case Form_Far:      ok = fetch_data(m, &fields, true, false) && fetch_word(m, &fields, &fields.data2); break;
+    default: break;
+  }
+
+  inst->op = entry.op;
+  inst->size = fields.size;
+  if (fields.w)                      inst->flags |= Inst_Wide;
+  if (entry.flags & Flag_Far)        inst->flags |= Inst_Far;
+  if (entry.form == Form_Rel8)       inst->flags |= Inst_Short;
+
+  if (entry.op == Op_None) {
+    memcpy(inst->bytes, m->data + inst->address, inst->size);
+  } else {
+    build_operands(inst, entry, byte, &fields);
+  }
+
+  return ok;
+}
+
+// linear sweep from the cursor until the image ends or output is full, returns how many were decoded.
+// an instruction cut short by the end of the image is not counted and the cursor stays at its start
+size_t decode_instructions(struct memory* m, struct instruction* output, size_t capacity) {
+  size_t count = 0;
+  while (count < capacity && m->position < m->size) {
+    size_t start = m->position;
+    if (!decode_instruction(m, output + count)) {
+      m->position = start;
+      break;
+    }
+    ++count;
+  }
+
+  return count;
+}
+
+#endif // DECODE_H_
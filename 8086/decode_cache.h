@@ -0,0 +1,114 @@
+#ifndef DECODE_CACHE_H_
+#define DECODE_CACHE_H_
+
+#include "stdlib.h"
+#include "string.h"
+
+#include "types.h"
+#include "memory.h"
+#include "decode.h"
+#include "instruction.h"
+
+// direct mapped on the physical address of the first byte, instruction.address is the tag
+#define DECODE_CACHE_BITS 16
+#define DECODE_CACHE_SIZE (1u << DECODE_CACHE_BITS)
+#define DECODE_CACHE_MASK (DECODE_CACHE_SIZE - 1)
+
+// a write can only hit instructions starting this far back: every prefix the decoder takes, then opcode,
+// modrm, a 16 bit displacement and a 16 bit immediate. anything longer isn't cached
+#define DECODE_CACHE_MAX_LENGTH (MAX_PREFIXES + 6)
+
+// pages that ever had an instruction cached, writes elsewhere skip the lookups
+#define CODE_PAGE_BITS 8
+#define CODE_PAGE_COUNT (MEMORY_SIZE >> CODE_PAGE_BITS)
+
+struct decode_cache {
+  struct instruction entries[DECODE_CACHE_SIZE]; // size 0 is an empty slot
+  u64 code_pages[CODE_PAGE_COUNT / 64];
+  struct instruction uncached; // decoded but too long to keep
+
+  u64 hits;
+  u64 misses;
+  u64 invalidations;
+  u32 generation; // bumped by every invalidation, for anything built on top of the entries
+};
+
+static struct decode_cache* create_decode_cache(void);
+static const struct instruction* fetch_instruction(struct decode_cache* cache, const u8* memory, u32 address);
+static void invalidate_code(struct decode_cache* cache, u32 address);
+static MAYBE_UNUSED void flush_decode_cache(struct decode_cache* cache);
+
+
+struct decode_cache* create_decode_cache(void) {
+  struct decode_cache* cache = (struct decode_cache*)calloc(1, sizeof(struct decode_cache));
+  if (!cache) {
+    perror("calloc for decode cache failed\n");
+  }
+  return cache;
+}
+
+static void mark_code_page(struct decode_cache* cache, u32 address) {
+  u32 page = (address & MEMORY_MASK) >> CODE_PAGE_BITS;
+  cache->code_pages[page / 64] |= 1ull << (page % 64);
+}
+
+static bool is_code_page(const struct decode_cache* cache, u32 address) {
+  u32 page = (address & MEMORY_MASK) >> CODE_PAGE_BITS;
+  return cache->code_pages[page / 64] & (1ull << (page % 64));
+}
+
+// NULL when the bytes at address run off the end of memory
+const struct instruction* fetch_instruction(struct decode_cache* cache, const u8* memory, u32 address) {
+  struct instruction* entry = cache->entries + (address & DECODE_CACHE_MASK);
+  if (entry->size && entry->address == address) {
+    ++cache->hits;
+    return entry;
+  }
+
+  ++cache->misses;
+
+  struct memory code = {(u8*)memory, MEMORY_SIZE, address};
+  if (!decode_instruction(&code, entry)) {
+    entry->size = 0;
+    return NULL;
+  }
+
+  if (entry->size > DECODE_CACHE_MAX_LENGTH) {
+    cache->uncached = *entry;
+    entry->size = 0;
+    return &cache->uncached;
+  }
+
+  mark_code_page(cache, address);
+  mark_code_page(cache, address + entry->size - 1);
+
+  return entry;
+}
+
+// drops every cached instruction that covers the written byte
+void invalidate_code(struct decode_cache* cache, u32 address) {
+  if (!is_code_page(cache, address) && !is_code_page(cache, address - (DECODE_CACHE_MAX_LENGTH - 1))) {
+    return;
+  }
+
+  for (u32 back = 0; back < DECODE_CACHE_MAX_LENGTH; ++back) {
+    u32 start = (address - back) & MEMORY_MASK;
+    struct instruction* entry = cache->entries + (start & DECODE_CACHE_MASK);
+    if (entry->size > back && entry->address == start) {
+      entry->size = 0;
+      ++cache->invalidations;
+      ++cache->generation;
+    }
+  }
+}
+
+// for when memory changed under the cache wholesale (a snapshot restore), the counters stay
+void flush_decode_cache(struct decode_cache* cache) {
+  for (u32 i = 0; i < DECODE_CACHE_SIZE; ++i) {
+    cache->entries[i].size = 0;
+  }
+  memset(cache->code_pages, 0, sizeof(cache->code_pages));
+  ++cache->generation;
+}
+
+#endif // DECODE_CACHE_H_
@@ -1,21 +1,26 @@
+// clock_gettime for the simulator timing, strict -std=c17 hides it otherwise
+#define _POSIX_C_SOURCE 200809L
+
 #include "stdlib.h"
 #include "stdio.h"
 #include "string.h"
+#include "dirent.h"
+#include "sys/stat.h"
 
 #include "types.h"
 #include "memory.h"
-#include "decode_data.h"
-
-
-// byte 1 format
-#define MASK_D      0b00000010 // 1 bit
-#define MASK_W      0b00000001 // 1 bit
+#include "stream.h"
+#include "parallel.h"
+#include "decode.h"
+#include "format.h"
+#include "sim.h"
+#include "threaded.h"
+#include "block.h"
+#include "clocks.h"
+#include "snapshot.h"
+#include "pool.h"
+#include "../harvesine/timers.h"
 
-// byte 2 format
-#define MASK_MOD    0b11000000 // 2 bits
-#define MASK_REG    0b00111000 // 3 bits
-#define MASK_RM     0b00000111 // 3 bits
-                               //
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
 #define BYTE_TO_BINARY(byte)  \
   ((byte) & 0x80 ? '1' : '0'), \
@@ -27,218 +32,682 @@
   ((byte) & 0x02 ? '1' : '0'), \
   ((byte) & 0x01 ? '1' : '0') 
 
-// REG (register) field encoding when MOD = 11
-char registers[2][8][2] = {
-  {"al", "cl", "dl", "bl", "ah", "ch", "dh", "bh"},
-  {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"}
-};
+// instructions decoded before they're formatted, the window is walked in steps of this many
+#define DECODE_BATCH_SIZE 4096
+
+// streams the input through a fixed window, memory use doesn't grow with the file. false when the
+// input ends inside an instruction
+static bool disassemble(const char* file_name, struct output_buffer* out) {
+  struct input_stream stream;
+  if (!open_stream(&stream, file_name)) {
+    return false;
+  }
+
+  struct instruction* batch = (struct instruction*)malloc(DECODE_BATCH_SIZE * sizeof(struct instruction));
+  if (!batch) {
+    perror("malloc for instructions failed\n");
+    close_stream(&stream);
+    return false;
+  }
+
+  if (!refill_stream(&stream)) {
+    printf("%s was empty, nothing to do\n", file_name);
+  }
+
+  append_string(out, "bits 16\n\n");
+  for (;;) {
+    struct memory* window = &stream.window;
+    size_t count = decode_instructions(window, batch, DECODE_BATCH_SIZE);
+    for (size_t i = 0; i < count; ++i) {
+      batch[i].address += (u32)stream.base;
+      format_instruction(out, batch + i);
+    }
+
+    // a short batch ran out of window, or into an instruction that goes on in the next read
+    if (count == DECODE_BATCH_SIZE) {
+      continue;
+    }
+    if (!refill_stream(&stream)) {
+      break;
+    }
+  }
+  flush_output(out);
+
+  bool complete = stream.window.position >= stream.window.size;
+  if (!complete) {
+    fprintf(stderr, "ERROR: instruction at %lu in %s is cut short\n", stream.base + stream.window.position, file_name);
+  }
+
+  free(batch);
+  close_stream(&stream);
+  return complete;
+}
 
-char* effective_address[] = {
-  "bx+si",
-  "bx+di",
-  "bp+si",
-  "bp+di",
-  "si",
-  "di",
-  "bp", // when MOD = 00 this will be direct address
-  "bx"
+struct sim_options {
+  bool trace;    // a line per instruction with what it changed
+  bool stats;    // decode cache and throughput numbers on stderr
+  bool threaded; // threaded dispatch instead of the switch, only without the trace
+  bool blocks;   // translated basic blocks instead of the switch, only without the trace
+  bool clocks;   // estimated 8086 clocks per instruction, per basic block and in total
+  const char* memory_trace; // file every data access is logged to, see address_space.h
+  u64 snapshot_every;       // instructions between snapshots, 0 for none
+  const char* save_snapshots;
+  const char* load_snapshots; // start from the last snapshot in here instead of the beginning
+  u64 stop_at;              // instruction count to stop at, 0 to run to the end
 };
 
-size_t read_byte(FILE* input, u8* buffer) {
-  return fread(buffer, sizeof(u8), 1, input);
+static bool create_memory(struct address_space* memory, const char* trace_file) {
+  memory->bytes = (u8*)calloc(MEMORY_SIZE, 1);
+  memory->cache = create_decode_cache();
+  memory->trace = trace_file ? open_trace(trace_file) : NULL;
+  memory->dirty_pages = NULL;
+  memory->translated = NULL;
+  memory->translated_writes = 0;
+  if (!memory->bytes || !memory->cache || (trace_file && !memory->trace)) {
+    perror("calloc for simulated memory failed\n");
+    return false;
+  }
+  return true;
 }
 
-size_t read_word(FILE* input, u16* buffer) {
-  return fread(buffer, sizeof(u16), 1, input);
+static void release_memory(struct address_space* memory) {
+  free(memory->bytes);
+  free(memory->cache);
+  if (memory->trace && !close_trace(memory->trace)) {
+    perror("writing memory trace failed\n");
+  }
 }
 
-size_t read_signed(FILE* input, size_t buffer_size, i16* buffer) {
-  size_t read_size = fread(buffer, buffer_size, 1, input);
-  // if it is a negative 8 bit number we need to manually make
-  // it negative 16 bit number
-  if ((*buffer >> 7) == 0b000000001) {
-    *buffer |= 0b1111111100000000;
+struct sim_result {
+  u64 instructions;
+  bool ok;      // false on an instruction the simulator can't run, or when something the run needed
+                // couldn't be loaded or allocated
+  bool cut_off; // stop_at ended a program that was still going
+};
+
+// the image is loaded at 0000:0000 and runs until ip leaves it, hlt or stop_at. memory comes in zeroed
+// with an empty decode cache
+static struct sim_result simulate(struct address_space* memory, struct memory* m, const char* file_name, struct output_buffer* out, struct sim_options options) {
+  struct sim_result run = {0, true, false};
+
+  size_t program_size = m->size < MEMORY_SIZE ? m->size : MEMORY_SIZE;
+  memcpy(memory->bytes, m->data, program_size);
+
+  struct cpu cpu;
+  memset(&cpu, 0, sizeof(cpu));
+  u64 instruction_count = 0;
+  bool stopped = false; // hlt, or an instruction the simulator can't run
+
+  // snapshots replace the start, the program still has to be loaded for the pages they never stored
+  struct snapshot_log snapshots;
+  init_snapshot_log(&snapshots);
+  const bool snapshotting = options.snapshot_every || options.save_snapshots || options.load_snapshots;
+  if (snapshotting) {
+    memory->dirty_pages = snapshots.dirty;
+  }
+  if (options.load_snapshots && !load_snapshot_log(&snapshots, options.load_snapshots)) {
+    memory->dirty_pages = NULL;
+    run.ok = false;
+    return run;
+  }
+
+  append_string(out, "--- ");
+  append_string(out, file_name);
+  append_string(out, " execution ---\n");
+
+  u32 resumed = find_snapshot(&snapshots, options.stop_at ? options.stop_at : ~0ull);
+  if (resumed != SNAPSHOT_NONE) {
+    instruction_count = restore_snapshot(&snapshots, memory, &cpu, resumed);
+    append_string(out, "--- resumed at instruction ");
+    append_unsigned(out, instruction_count);
+    append_string(out, " ---\n");
+  } else if (options.snapshot_every) {
+    take_snapshot(&snapshots, memory, &cpu, 0);
+  }
+
+  u64 block_translations = 0;
+  u64 start = read_os_timer();
+
+  // the clock estimate needs every instruction's before and after, so it steps like the trace does,
+  // and so do snapshots. the engines stop at a count on their own
+  struct clock_profile profile;
+  const bool step = options.trace || options.clocks || options.snapshot_every;
+  const u64 limit = !options.stop_at ? ~0ull : options.stop_at > instruction_count ? options.stop_at - instruction_count : 0;
+  if (options.clocks && !init_clock_profile(&profile)) {
+    free_snapshot_log(&snapshots);
+    memory->dirty_pages = NULL;
+    run.ok = false;
+    return run;
+  }
+
+  if (!step) {
+    enum exec_result result = Exec_Continue;
+    if (options.threaded) {
+      struct threaded_engine* engine = create_threaded_engine();
+      if (engine) {
+        instruction_count += run_threaded(engine, &cpu, memory, (u32)program_size, limit, &result);
+      } else {
+        run.ok = false;
+      }
+      free(engine);
+    } else if (options.blocks) {
+      struct block_engine* engine = create_block_engine();
+      if (engine) {
+        instruction_count += run_blocks(engine, &cpu, memory, (u32)program_size, limit, &result);
+        block_translations = engine->translations;
+      } else {
+        run.ok = false;
+      }
+      free(engine);
+    } else {
+      instruction_count += run_switch(&cpu, memory, (u32)program_size, limit, &result);
+    }
+    stopped = result != Exec_Continue;
+
+    if (result == Exec_Unsupported) {
+      fprintf(stderr, "ERROR: instruction at ip 0x%x is not supported by the simulator\n", cpu.ip);
+      run.ok = false;
+    }
   }
-  return read_size;
+
+  while (step && cpu.ip < program_size && (!options.stop_at || instruction_count < options.stop_at)) {
+    const struct instruction* inst = fetch_instruction(memory->cache, memory->bytes, physical_address(segment_register(&cpu, Reg_cs), cpu.ip));
+    if (!inst) {
+      break;
+    }
+
+    struct cpu before = cpu;
+    enum exec_result result = execute_instruction(&cpu, memory, inst);
+    stopped = result != Exec_Continue;
+    if (result == Exec_Unsupported) {
+      flush_output(out);
+      fprintf(stderr, "ERROR: %s at 0x%x is not supported by the simulator\n", op_mnemonics[inst->op], inst->address);
+      run.ok = false;
+      break;
+    }
+
+    ++instruction_count;
+    if (options.snapshot_every && instruction_count % options.snapshot_every == 0 &&
+        !take_snapshot(&snapshots, memory, &cpu, instruction_count)) {
+      break;
+    }
+
+    struct clock_estimate clocks = {0, 0, 0};
+    if (options.clocks) {
+      clocks = estimate_clocks(&before, &cpu, inst);
+      profile_clocks(&profile, &before, &cpu, inst, clocks);
+    }
+
+    if (options.trace) {
+      // the instruction's line goes on with everything it changed
+      reserve_output(out, MAX_LINE_LENGTH * 5);
+      format_instruction(out, inst);
+      --out->used;
+      append_string(out, " ; ");
+      if (options.clocks) {
+        format_clocks(out, clocks, profile.total);
+        append_string(out, " | ");
+      }
+      format_changes(out, &before, &cpu);
+      append_char(out, '\n');
+    }
+
+    if (result == Exec_Halt) {
+      break;
+    }
+  }
+
+  u64 elapsed = read_os_timer() - start;
+  run.cut_off = options.stop_at && instruction_count >= options.stop_at && !stopped && cpu.ip < program_size;
+
+  reserve_output(out, MAX_LINE_LENGTH * Reg_Count);
+  format_final_state(out, &cpu);
+
+  if (options.clocks) {
+    finish_clock_profile(&profile);
+    format_clock_profile(out, &profile);
+    free_clock_profile(&profile);
+  }
+  flush_output(out);
+
+  if (options.stats) {
+    struct decode_cache* cache = memory->cache;
+    f64 seconds = (f64)elapsed / (f64)read_os_timer_freq();
+    u64 lookups = cache->hits + cache->misses;
+    fprintf(stderr, "\n%-20s %lu\n", "Instructions:", instruction_count);
+    fprintf(stderr, "%-20s %lu hits, %lu misses, %.2f%% hit rate\n", "Decode cache:", cache->hits, cache->misses,
+            lookups ? 100.0 * (f64)cache->hits / (f64)lookups : 0.0);
+    fprintf(stderr, "%-20s %lu\n", "Invalidations:", cache->invalidations);
+    if (options.blocks) {
+      fprintf(stderr, "%-20s %lu translated\n", "Blocks:", block_translations);
+    }
+    fprintf(stderr, "%-20s %.4f s, %.2f M instructions/s\n", "Time:", seconds,
+            seconds > 0.0 ? (f64)instruction_count / seconds * 1e-6 : 0.0);
+  }
+
+  if (snapshotting && options.stats) {
+    fprintf(stderr, "%-20s %u, %lu pages stored (%lu KB), %lu pages restored\n", "Snapshots:", snapshots.count,
+            snapshots.stored_pages, snapshots.stored_pages * DIRTY_PAGE_SIZE / 1024, snapshots.restored_pages);
+  }
+  if (options.save_snapshots) {
+    save_snapshot_log(&snapshots, options.save_snapshots);
+  }
+  free_snapshot_log(&snapshots);
+  memory->dirty_pages = NULL;
+
+  if (memory->trace) {
+    struct access_trace* trace = memory->trace;
+    fprintf(stderr, "%-20s %lu reads, %lu writes, %lu odd words to %s\n", "Memory trace:",
+            trace->reads, trace->writes, trace->odd_words, options.memory_trace);
+  }
+
+  run.instructions = instruction_count;
+  return run;
 }
 
-void decode_instruction() {
-  //
+///////////////////////////////////////////////////////////////
+/// Batch
+// a directory, or a manifest with a path per line, spread over a work stealing pool. every file gets a
+// line of results and its text goes to out_dir/<file name>.txt, or nowhere without an out_dir. files
+// from different directories sharing a name get their job number in it, out_dir/<file name>.<job>.txt.
+// with exec a program still running after stop_at, BATCH_INSTRUCTION_LIMIT unless set, fails
+#define BATCH_INSTRUCTION_LIMIT 100000000ull
+
+struct batch_result {
+  u64 bytes;
+  u64 instructions;
+  u64 time; // os timer ticks
+  bool ok;
+  bool shared_name; // another file in the batch has the same name
+};
+
+struct batch {
+  char** files;
+  u32 count;
+  const char* out_dir;
+  bool exec;
+  struct sim_options options;
+  struct batch_result* results;
+};
+
+// what a worker keeps between files, so a batch of small binaries doesn't allocate per file
+struct batch_worker {
+  const struct batch* batch;
+  u8* image;            // grows to the biggest file so far
+  size_t image_capacity;
+  struct instruction* instructions;
+  struct output_buffer out;
+  struct address_space memory; // only with exec
+};
+
+static int compare_paths(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
 }
 
-int main(int argc,  char* argv[argc + 1]) {
-  if (argc < 2) {
-    return EXIT_FAILURE;
+struct batch_name {
+  const char* name; // past the last slash
+  u32 job;
+};
+
+static int compare_batch_names(const void* a, const void* b) {
+  return strcmp(((const struct batch_name*)a)->name, ((const struct batch_name*)b)->name);
+}
+
+// sorted by file name, equal names end up next to each other
+static bool mark_shared_names(struct batch* batch) {
+  struct batch_name* names = (struct batch_name*)malloc((batch->count + 1) * sizeof(struct batch_name));
+  if (!names) {
+    perror("malloc for batch names failed\n");
+    return false;
   }
+  for (u32 job = 0; job < batch->count; ++job) {
+    const char* slash = strrchr(batch->files[job], '/');
+    names[job].name = slash ? slash + 1 : batch->files[job];
+    names[job].job = job;
+  }
+  qsort(names, batch->count, sizeof(struct batch_name), compare_batch_names);
 
-  struct decodeData decode_data;
-  bool r = dd_init_with_file(&decode_data, argv[1]);
-  dd_deinit(&decode_data);
+  for (u32 i = 1; i < batch->count; ++i) {
+    if (strcmp(names[i - 1].name, names[i].name) == 0) {
+      batch->results[names[i - 1].job].shared_name = true;
+      batch->results[names[i].job].shared_name = true;
+    }
+  }
+  free(names);
+  return true;
+}
 
+static bool add_batch_file(struct batch* batch, u32* capacity, const char* path) {
+  if (batch->count == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : 256;
+    char** grown = (char**)realloc(batch->files, *capacity * sizeof(char*));
+    if (!grown) {
+      perror("realloc for batch files failed\n");
+      return false;
+    }
+    batch->files = grown;
+  }
 
-  FILE* input = fopen(argv[1], "rb");
-  // if (!input) {
-  //   perror("fopen for input file failed\n");
-  //   return EXIT_FAILURE;
-  // }
+  batch->files[batch->count] = strdup(path);
+  return batch->files[batch->count++] != NULL;
+}
 
-  printf("bits 16\n\n");
+// directories are listed in name order, dot files left out. manifest lines that are empty or start with # are skipped
+static bool list_batch(struct batch* batch, const char* path) {
+  struct stat info;
+  if (stat(path, &info) != 0) {
+    perror("stat for batch failed\n");
+    return false;
+  }
 
-  // fseek(input, 0L, SEEK_END);
-  // size_t input_size = ftell(input);
-  // rewind(input);
-  // 
-  // if (input_size < 1) {
-  //   printf("%s was empty, nothing to do\n", argv[1]);
-  //   fclose(input);
-  //   return EXIT_SUCCESS;
-  // }
-  // 
-  // u8* content = (u8*)malloc(input_size * sizeof(u8*));
-  // fread(content, input_size, 1, input);
+  u32 capacity = 0;
+  char line[4096];
+  bool ok = true;
+  if (S_ISDIR(info.st_mode)) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+      perror("opendir for batch failed\n");
+      return false;
+    }
 
-  struct memory m;
-  bool result = init_from_file(&m, argv[1]);
-
-  // fclose(input);
-
-  return EXIT_SUCCESS;
-
-  // loop for the buffer inside input loop
-  u8 buffer;
-  while (read_byte(input, &buffer)) {
-
-    if (buffer >> 2 == 0b100010) { // register/memory to/from register
-      u8 w = buffer & MASK_W;
-      u8 d = (buffer & MASK_D) >> 1;
-
-      read_byte(input, &buffer);
-
-      u8 mod = (buffer & MASK_MOD) >> 6;
-      u8 reg = (buffer & MASK_REG) >> 3;
-      u8 rm = buffer & MASK_RM;
-
-      switch (mod) {
-        case 0b00: {
-          if (rm == 0b110) {
-            i16 data;
-            read_signed(input, sizeof(i16), &data);
-            printf("mov %c%c, [%d]\n", registers[w][reg][0],
-                                       registers[w][reg][1],
-                                       data);
-          } else {
-            if (d) {
-              printf("mov %c%c, [%s]\n", registers[w][reg][0],
-                                         registers[w][reg][1],
-                                         effective_address[rm]);
-            } else {
-              printf("mov [%s], %c%c\n", effective_address[rm],
-                                         registers[w][reg][0],
-                                         registers[w][reg][1]);
-            }
-          }
-          break;
-        }
-        case 0b01: {
-          i16 disp = 0;
-          read_signed(input, sizeof(i8), &disp);
-          if (d) {
-            printf("mov %c%c, [%s%-d]\n", registers[w][reg][0],
-                                          registers[w][reg][1],
-                                          effective_address[rm],
-                                          disp);
-          } else {
-            printf("mov [%s%-d], %c%c\n", effective_address[rm],
-                                          disp,
-                                          registers[w][reg][0],
-                                          registers[w][reg][1]);
-          }
-          break;
-        }
-        case 0b10: {
-          i16 disp = 0;
-          read_signed(input, sizeof(i16), &disp);
-
-          if (d) {
-            printf("mov %c%c, [%s%-d]\n", registers[w][reg][0],
-                                          registers[w][reg][1],
-                                          effective_address[rm],
-                                          disp);
-          } else {
-              printf("mov [%s%-d], %c%c\n", effective_address[rm],
-                                            disp,
-                                            registers[w][reg][0],
-                                            registers[w][reg][1]);
-          }
-          break;
-        }
-        case 0b11: {
-          printf("mov %c%c, %c%c\n", registers[w][rm][0],
-                                     registers[w][rm][1],
-                                     registers[w][reg][0],
-                                     registers[w][reg][1]);
-          break;
-        }
-      }
-    } else if (buffer >> 1 == 0b1100011) { // immediate to register/memory
-      u8 w = buffer & MASK_W;
-
-      read_byte(input, &buffer);
-
-      u8 mod = (buffer & MASK_MOD) >> 6;
-      u8 rm = buffer & MASK_RM;
-
-      i16 disp = 0;
-      if (mod == 0b11) { // register mode
-        //
-      } else { // memory mode
-        if (mod == 0b01) { // 8 bit displacement;
-          read_signed(input, sizeof(i8), &disp);
-        } else if (mod == 0b10 || (mod == 0b00 && rm == 0b110)) { // 16 bit displacement
-          read_signed(input, sizeof(i16), &disp);
-        }
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir))) {
+      snprintf(line, sizeof(line), "%s/%s", path, entry->d_name);
+      if (entry->d_name[0] != '.' && stat(line, &info) == 0 && S_ISREG(info.st_mode)) {
+        ok = add_batch_file(batch, &capacity, line);
       }
+    }
+    closedir(dir);
+    qsort(batch->files, batch->count, sizeof(char*), compare_paths);
+  } else {
+    FILE* manifest = fopen(path, "r");
+    if (!manifest) {
+      perror("fopen for batch manifest failed\n");
+      return false;
+    }
 
-      if (w == 0) {
-        u8 data;
-        read_byte(input, &data);
-        printf("mov [%s + %d], byte %d\n", effective_address[rm], disp, data);
-      } else {
-        u16 data;
-        read_word(input, &data);
-        printf("mov [%s + %d], word %d\n", effective_address[rm], disp, data);
+    while (ok && fgets(line, sizeof(line), manifest)) {
+      line[strcspn(line, "\r\n")] = 0;
+      if (line[0] && line[0] != '#') {
+        ok = add_batch_file(batch, &capacity, line);
       }
+    }
+    fclose(manifest);
+  }
+
+  return ok;
+}
 
-    } else if (buffer >> 4 == 0b1011) { // immediate to register
-      u8 reg = buffer & 0b111;
-      u8 w = buffer >> 3 & 1;
+static bool load_batch_file(struct batch_worker* worker, const char* path, struct memory* m) {
+  FILE* input = fopen(path, "rb");
+  if (!input) {
+    perror("fopen for input file failed\n");
+    return false;
+  }
 
-      if (w == 1) {
-        u16 data;
-        read_word(input, &data);
-        printf("mov %c%c, %d\n", registers[w][reg][0], registers[w][reg][1], data);
-      } else {
-        u8 data;
-          read_byte(input, &data);
-        printf("mov %c%c, %d\n", registers[w][reg][0], registers[w][reg][1], data);
-      }
-    } else if (buffer >> 2 == 0b101000) {  // memory/accumulator to accumulator/memory
-      u8 d = (buffer & MASK_D) >> 1;
-      i16 data;
-      read_signed(input, sizeof(i16), &data);
-      if (d == 0) { // memory to accumulator
-        printf("mov ax, [%d]\n", data);
-      } else { // accumulator to memory
-        printf("mov [%d], ax\n", data);
+  fseek(input, 0L, SEEK_END);
+  long size = ftell(input);
+  rewind(input);
+
+  bool ok = size >= 0;
+  if (ok && (size_t)size > worker->image_capacity) {
+    u8* grown = (u8*)realloc(worker->image, (size_t)size);
+    ok = grown != NULL;
+    if (ok) {
+      worker->image = grown;
+      worker->image_capacity = (size_t)size;
+    }
+  }
+  ok = ok && (size == 0 || fread(worker->image, (size_t)size, 1, input) == 1);
+  fclose(input);
+
+  if (!ok) {
+    perror("reading input file failed\n");
+    return false;
+  }
+
+  m->data = worker->image;
+  m->size = (size_t)size;
+  m->position = 0;
+  return true;
+}
+
+// the whole image is already in memory, same output as disassemble. false when the image ends
+// inside an instruction
+static bool disassemble_image(struct batch_worker* worker, struct memory* m, const char* file_name, u64* count) {
+  *count = 0;
+  append_string(&worker->out, "bits 16\n\n");
+  for (;;) {
+    size_t decoded = decode_instructions(m, worker->instructions, DECODE_BATCH_SIZE);
+    for (size_t i = 0; i < decoded; ++i) {
+      format_instruction(&worker->out, worker->instructions + i);
+    }
+    *count += decoded;
+    if (decoded < DECODE_BATCH_SIZE) {
+      break;
+    }
+  }
+
+  if (m->position < m->size) {
+    fprintf(stderr, "ERROR: instruction at %zu in %s is cut short\n", m->position, file_name);
+    return false;
+  }
+  return true;
+}
+
+static void batch_job(void* context, u32 job) {
+  struct batch_worker* worker = (struct batch_worker*)context;
+  const struct batch* batch = worker->batch;
+  const char* path = batch->files[job];
+  struct batch_result* result = batch->results + job;
+
+  u64 start = read_os_timer();
+
+  FILE* output = NULL;
+  if (batch->out_dir) {
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    char output_path[4096];
+    if (result->shared_name) {
+      snprintf(output_path, sizeof(output_path), "%s/%s.%u.txt", batch->out_dir, name, job);
+    } else {
+      snprintf(output_path, sizeof(output_path), "%s/%s.txt", batch->out_dir, name);
+    }
+    output = fopen(output_path, "wb");
+    if (!output) {
+      perror("fopen for batch output failed\n");
+      return;
+    }
+  }
+  worker->out.file = output;
+
+  struct memory m;
+  result->ok = load_batch_file(worker, path, &m);
+  if (result->ok) {
+    result->bytes = m.size;
+    if (batch->exec) {
+      memset(worker->memory.bytes, 0, MEMORY_SIZE);
+      memset(worker->memory.cache, 0, sizeof(struct decode_cache));
+      struct sim_result run = simulate(&worker->memory, &m, path, &worker->out, batch->options);
+      result->instructions = run.instructions;
+      result->ok = run.ok;
+      if (run.cut_off) {
+        fprintf(stderr, "ERROR: %s still runs after %lu instructions\n", path, run.instructions);
+        result->ok = false;
       }
     } else {
-      printf("%d\n", buffer);
+      result->ok = disassemble_image(worker, &m, path, &result->instructions);
     }
+  }
 
+  flush_output(&worker->out);
+  if (output) {
+    result->ok &= fclose(output) == 0;
   }
+  result->time = read_os_timer() - start;
+}
 
-  fclose(input);
+static bool run_batch(const char* path, const char* out_dir, int threads, bool exec, struct sim_options options) {
+  struct batch batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.out_dir = out_dir;
+  batch.exec = exec;
+  batch.options = options;
+
+  // per file numbers come out as one table, a file's own stats and trace files would trample each other
+  batch.options.stats = false;
+  batch.options.memory_trace = NULL;
+  batch.options.snapshot_every = 0;
+  batch.options.save_snapshots = NULL;
+  batch.options.load_snapshots = NULL;
+  // one program that never stops would hold the whole batch
+  if (exec && !batch.options.stop_at) {
+    batch.options.stop_at = BATCH_INSTRUCTION_LIMIT;
+  }
+
+  if (threads < 1) {
+    threads = 1;
+  }
+  if (threads > MAX_POOL_WORKERS) {
+    threads = MAX_POOL_WORKERS;
+  }
+
+  bool ok = list_batch(&batch, path);
+  batch.results = (struct batch_result*)calloc(batch.count + 1, sizeof(struct batch_result));
+  struct batch_worker* workers = (struct batch_worker*)calloc((size_t)threads, sizeof(struct batch_worker));
+  ok = ok && batch.results && workers && mark_shared_names(&batch);
+  for (int i = 0; ok && i < threads; ++i) {
+    struct batch_worker* worker = workers + i;
+    worker->batch = &batch;
+    worker->instructions = (struct instruction*)malloc(DECODE_BATCH_SIZE * sizeof(struct instruction));
+    ok = worker->instructions && init_output(&worker->out, NULL, OUTPUT_BUFFER_SIZE);
+    ok = ok && (!exec || create_memory(&worker->memory, NULL));
+  }
+
+  u64 steals = 0;
+  u64 start = read_os_timer();
+  if (ok) {
+    steals = run_pool(batch.count, threads, batch_job, workers, sizeof(struct batch_worker));
+  }
+  u64 elapsed = read_os_timer() - start;
+
+  u64 bytes = 0;
+  u64 instructions = 0;
+  u32 failed = 0;
+  const f64 freq = (f64)read_os_timer_freq();
+  for (u32 i = 0; ok && i < batch.count; ++i) {
+    struct batch_result* result = batch.results + i;
+    printf("%-40s %10lu bytes %10lu instructions %10.3f ms %s\n", batch.files[i], result->bytes,
+           result->instructions, (f64)result->time / freq * 1e3, result->ok ? "ok" : "FAILED");
+    bytes += result->bytes;
+    instructions += result->instructions;
+    failed += !result->ok;
+  }
+
+  if (ok) {
+    f64 seconds = (f64)elapsed / freq;
+    printf("\n%-20s %u files, %u failed, %d workers, %lu jobs stolen\n", "Batch:", batch.count, failed, threads, steals);
+    printf("%-20s %lu bytes, %lu instructions in %.4f s\n", "Total:", bytes, instructions, seconds);
+    printf("%-20s %.2f MB/s, %.2f M instructions/s, %.1f files/s\n", "Throughput:",
+           seconds > 0.0 ? (f64)bytes / seconds / (1024.0 * 1024.0) : 0.0,
+           seconds > 0.0 ? (f64)instructions / seconds * 1e-6 : 0.0,
+           seconds > 0.0 ? (f64)batch.count / seconds : 0.0);
+  }
+
+  for (int i = 0; workers && i < threads; ++i) {
+    free(workers[i].image);
+    free(workers[i].instructions);
+    free(workers[i].out.data);
+    if (exec) {
+      release_memory(&workers[i].memory);
+    }
+  }
+  for (u32 i = 0; i < batch.count; ++i) {
+    free(batch.files[i]);
+  }
+  free(batch.files);
+  free(batch.results);
+  free(workers);
 
-  return EXIT_SUCCESS;
+  return ok && failed == 0;
 }
 
+int main(int argc,  char* argv[argc + 1]) {
+  bool exec = false;
+  struct sim_options options = {true, false, false, false, false, NULL, 0, NULL, NULL, 0};
+  int threads = 1;
+  char* file_name = NULL;
+  const char* batch = NULL;
+  const char* out_dir = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--exec") == 0) {
+      exec = true;
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      options.trace = false;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      options.stats = true;
+    } else if (strcmp(argv[i], "--threaded") == 0) {
+      options.threaded = true;
+    } else if (strcmp(argv[i], "--blocks") == 0) {
+      options.blocks = true;
+    } else if (strcmp(argv[i], "--clocks") == 0) {
+      options.clocks = true;
+    } else if (strcmp(argv[i], "--trace-memory") == 0 && i + 1 < argc) {
+      options.memory_trace = argv[++i];
+    } else if (strcmp(argv[i], "--snapshot-every") == 0 && i + 1 < argc) {
+      options.snapshot_every = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--save-snapshots") == 0 && i + 1 < argc) {
+      options.save_snapshots = argv[++i];
+    } else if (strcmp(argv[i], "--load-snapshots") == 0 && i + 1 < argc) {
+      options.load_snapshots = argv[++i];
+    } else if (strcmp(argv[i], "--stop-at") == 0 && i + 1 < argc) {
+      options.stop_at = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batch = argv[++i];
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      out_dir = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else {
+      file_name = argv[i];
+    }
+  }
+
+  if (batch) {
+    return run_batch(batch, out_dir, threads, exec, options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (!file_name) {
+    fprintf(stderr, "Usage: %s [--batch directory or manifest [--out directory]] [--threads n | --exec [--quiet [--threaded | --blocks]] [--clocks] [--stats] [--trace-memory file]\n"
+                    "         [--snapshot-every n] [--save-snapshots file] [--load-snapshots file] [--stop-at n]] [8086 binary, or - to disassemble stdin]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  struct output_buffer out;
+  if (!init_output(&out, stdout, OUTPUT_BUFFER_SIZE)) {
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  if (exec || (threads > 1 && strcmp(file_name, "-") != 0)) {
+    // the simulator wants the whole program in its address space anyway, the threads want all of it to split up
+    struct memory m;
+    ok = init_from_file(&m, file_name);
+    struct address_space memory;
+    if (ok && exec) {
+      ok = create_memory(&memory, options.memory_trace);
+      if (ok) {
+        ok = simulate(&memory, &m, file_name, &out, options).ok;
+      }
+      release_memory(&memory);
+    } else if (ok) {
+      ok = disassemble_parallel(&m, file_name, &out, threads);
+    }
+    free_memory(&m);
+  } else {
+    ok = disassemble(file_name, &out);
+  }
+
+  free_output(&out);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,500 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+
+#include "types.h"
+#include "memory.h"
+#include "decode.h"
+#include "encode.h"
+#include "generate.h"
+#include "format.h"
+
+#include "../harvesine/repetition_tester.hpp"
+
+// round trips every input through decode, encode and decode again and checks the text is unchanged,
+// checks it against the .asm it was assembled from when there is one, then measures decoded
+// instructions per second under the repetition tester
+//
+// usage: decoder_bench [--check] [8086 binary ...], without any every binary in listings/. random
+// instruction streams are always checked, and benchmarked unless --check says only to check
+
+#define RANDOM_STREAM_SIZE (1u << 20)
+#define RANDOM_STREAM_SEEDS 4
+#define MAX_LISTING_FILES 256
+
+// set by the build to the source tree's listings, relative to the working directory otherwise
+#ifndef LISTINGS_DIR
+#define LISTINGS_DIR "listings"
+#endif
+
+struct stream {
+  const char* name;
+  u8* bytes;
+  size_t size;
+};
+
+struct decoded {
+  struct instruction* instructions;
+  size_t count;
+  size_t consumed; // bytes up to where decoding stopped
+};
+
+struct BenchStream {
+  const stream* input;
+  decoded* output;
+  output_buffer text;
+  u64 instructions;
+};
+
+static decoded decode_all(const u8* bytes, size_t size) {
+  decoded result = {};
+  result.instructions = (struct instruction*)malloc((size + 1) * sizeof(struct instruction));
+  if (result.instructions) {
+    struct memory m = {(u8*)bytes, size, 0};
+    result.count = decode_instructions(&m, result.instructions, size);
+    result.consumed = m.position;
+  }
+  return result;
+}
+
+// formatted into memory, the buffer is sized so it never has to flush
+static output_buffer format_all(const decoded* input) {
+  output_buffer text = {};
+  if (init_output(&text, nullptr, (input->count + 1) * MAX_LINE_LENGTH)) {
+    for (size_t i = 0; i < input->count; ++i) {
+      format_instruction(&text, input->instructions + i);
+    }
+  }
+  return text;
+}
+
+///////////////////////////////////////////////////////////////
+/// Round trip
+static bool round_trip(const stream* input) {
+  decoded original = decode_all(input->bytes, input->size);
+  u8* encoded = (u8*)malloc(original.count * MAX_ENCODED_LENGTH + 1);
+  if (!original.instructions || !encoded) {
+    fprintf(stderr, "ERROR: out of memory for %s\n", input->name);
+    return false;
+  }
+
+  bool ok = true;
+  size_t encoded_size = 0;
+  u64 same_bytes = 0;
+  for (size_t i = 0; i < original.count && ok; ++i) {
+    const struct instruction* inst = original.instructions + i;
+    u8 size = encode_instruction(inst, encoded + encoded_size);
+    if (!size) {
+      fprintf(stderr, "ERROR: %s instruction at %u does not encode\n", input->name, inst->address);
+      ok = false;
+      break;
+    }
+
+    if (size == inst->size && memcmp(encoded + encoded_size, input->bytes + inst->address, size) == 0) {
+      ++same_bytes;
+    }
+    encoded_size += size;
+  }
+
+  decoded again = decode_all(encoded, encoded_size);
+  if (ok && (again.count != original.count || again.consumed != encoded_size)) {
+    fprintf(stderr, "ERROR: %s re-encoded to %zu instructions instead of %zu\n", input->name, again.count, original.count);
+    ok = false;
+  }
+
+  if (ok) {
+    output_buffer before = format_all(&original);
+    output_buffer after = format_all(&again);
+    if (before.used != after.used || memcmp(before.data, after.data, before.used) != 0) {
+      fprintf(stderr, "ERROR: %s disassembles differently after re-encoding\n", input->name);
+      ok = false;
+    }
+    free(before.data);
+    free(after.data);
+  }
+
+  printf("%-32s %10zu instructions %8.2f%% same bytes  %s\n", input->name, original.count,
+         original.count ? 100.0 * (f64)same_bytes / (f64)original.count : 100.0, ok ? "ok" : "FAILED");
+  if (original.consumed < input->size) {
+    printf("%-32s %10zu trailing bytes cut short\n", "", input->size - original.consumed);
+  }
+
+  free(again.instructions);
+  free(original.instructions);
+  free(encoded);
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////
+/// Listing
+// both sides are brought to one spelling before they are compared: no comments, labels, whitespace or
+// case, [bp + 0] as [bp], a size on the immediate moved in front of the memory operand and nasm's other
+// names for the same jump. jump targets compare as the number of the instruction they land on
+struct listing_line {
+  char text[2 * MAX_LINE_LENGTH]; // mnemonic, a space and the operands
+  size_t operands;                // where the operands start in text
+};
+
+struct listing_label {
+  char name[MAX_LINE_LENGTH];
+  size_t line; // the instruction after it
+};
+
+static const char* const mnemonic_aliases[][2] = {
+  {"jz", "je"},     {"jnz", "jne"},  {"jc", "jb"},   {"jnae", "jb"},     {"jnc", "jnb"},
+  {"jae", "jnb"},   {"jna", "jbe"},  {"jnbe", "ja"}, {"jpe", "jp"},      {"jpo", "jnp"},
+  {"jnge", "jl"},   {"jge", "jnl"},  {"jng", "jle"}, {"jnle", "jg"},     {"loope", "loopz"},
+  {"loopne", "loopnz"}, {"sal", "shl"}, {"repe", "rep"}, {"repz", "rep"}, {"repnz", "repne"},
+};
+
+// one line of nasm source, false when there's no instruction on it. a label in front is handed back
+static bool normalize_line(const char* line, size_t length, listing_line* output, char* label) {
+  char text[2 * MAX_LINE_LENGTH];
+  size_t used = 0;
+  for (size_t i = 0; i < length && line[i] != ';' && used < sizeof(text) - 1; ++i) {
+    text[used++] = (char)tolower((u8)line[i]);
+  }
+  text[used] = '\0';
+
+  char* at = text;
+  while (isspace((u8)*at)) ++at;
+  char* word = at;
+  while (*at && !isspace((u8)*at)) ++at;
+
+  label[0] = '\0';
+  if (at > word && at[-1] == ':') {
+    snprintf(label, MAX_LINE_LENGTH, "%.*s", (int)(at - word - 1), word);
+    while (isspace((u8)*at)) ++at;
+    word = at;
+    while (*at && !isspace((u8)*at)) ++at;
+  }
+  if (at == word || (strncmp(word, "bits", 4) == 0 && at - word == 4)) {
+    return false;
+  }
+
+  char mnemonic[MAX_LINE_LENGTH];
+  snprintf(mnemonic, sizeof(mnemonic), "%.*s", (int)(at - word), word);
+  for (u32 i = 0; i < sizeof(mnemonic_aliases) / sizeof(mnemonic_aliases[0]); ++i) {
+    if (strcmp(mnemonic, mnemonic_aliases[i][0]) == 0) {
+      snprintf(mnemonic, sizeof(mnemonic), "%s", mnemonic_aliases[i][1]);
+    }
+  }
+
+  char operands[2 * MAX_LINE_LENGTH];
+  size_t count = 0;
+  for (; *at; ++at) {
+    if (!isspace((u8)*at)) {
+      operands[count++] = *at;
+    }
+    // [bp+0] is how nasm is told to use a displacement [bp] has anyway
+    if (count >= 3 && memcmp(operands + count - 3, "+0]", 3) == 0) {
+      count -= 2;
+      operands[count - 1] = ']';
+    }
+  }
+  operands[count] = '\0';
+
+  // [..],byte 7 the way the formatter puts it, byte [..],7
+  char* size = strstr(operands, "],byte");
+  size = size ? size : strstr(operands, "],word");
+  if (operands[0] == '[' && size) {
+    char moved[2 * MAX_LINE_LENGTH];
+    snprintf(moved, sizeof(moved), "%.4s%.*s%s", size + 2, (int)(size + 2 - operands), operands, size + 6);
+    strcpy(operands, moved);
+  }
+
+  int written = snprintf(output->text, sizeof(output->text), "%s %s", mnemonic, operands);
+  output->operands = strlen(mnemonic) + 1;
+  return written > 0;
+}
+
+// reads name.asm into lines, labels are resolved to the number of the line they stand in front of
+static listing_line* read_listing(const char* name, size_t* count) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.asm", name);
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return nullptr;
+  }
+  fclose(file);
+
+  struct memory source;
+  if (!init_from_file(&source, path)) {
+    return nullptr;
+  }
+
+  // every line could be an instruction or a label
+  size_t capacity = 1;
+  for (size_t i = 0; i < source.size; ++i) {
+    capacity += source.data[i] == '\n';
+  }
+  listing_line* lines = (listing_line*)malloc(capacity * sizeof(listing_line));
+  listing_label* labels = (listing_label*)malloc(capacity * sizeof(listing_label));
+  size_t label_count = 0;
+  *count = 0;
+  if (!lines || !labels) {
+    fprintf(stderr, "ERROR: out of memory for %s\n", path);
+  }
+
+  for (size_t begin = 0; lines && labels && begin < source.size;) {
+    const u8* newline = (const u8*)memchr(source.data + begin, '\n', source.size - begin);
+    size_t end = newline ? (size_t)(newline - source.data) : source.size;
+
+    char label[MAX_LINE_LENGTH];
+    bool instruction = normalize_line((const char*)source.data + begin, end - begin, lines + *count, label);
+    if (label[0]) {
+      snprintf(labels[label_count].name, MAX_LINE_LENGTH, "%s", label);
+      labels[label_count++].line = *count;
+    }
+    *count += instruction;
+    begin = end + 1;
+  }
+
+  for (size_t i = 0; lines && labels && i < *count; ++i) {
+    listing_line* line = lines + i;
+    const char* target = line->text + line->operands;
+    if (strncmp(target, "short", 5) == 0) {
+      target += 5;
+    }
+    for (size_t j = 0; j < label_count; ++j) {
+      if (strcmp(target, labels[j].name) == 0) {
+        snprintf(line->text + line->operands, sizeof(line->text) - line->operands, "@%zu", labels[j].line);
+        break;
+      }
+    }
+  }
+
+  free(labels);
+  free_memory(&source);
+  return lines;
+}
+
+// the instruction starting at address, -1 for none
+static long find_instruction(const decoded* input, u32 address) {
+  size_t low = 0;
+  size_t high = input->count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (input->instructions[middle].address < address) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low < input->count && input->instructions[low].address == address ? (long)low : -1;
+}
+
+// the disassembly has to say what the listing the binary was assembled from says, binaries without
+// one pass
+static bool matches_listing(const stream* input) {
+  size_t expected_count = 0;
+  listing_line* expected = read_listing(input->name, &expected_count);
+  if (!expected) {
+    return true;
+  }
+
+  decoded original = decode_all(input->bytes, input->size);
+  output_buffer text = format_all(&original);
+  bool ok = original.instructions && text.data && original.count == expected_count;
+  if (original.instructions && text.data && !ok) {
+    fprintf(stderr, "ERROR: %s decodes to %zu instructions, its listing has %zu\n", input->name, original.count, expected_count);
+  }
+
+  char label[MAX_LINE_LENGTH];
+  const char* line = text.data;
+  for (size_t i = 0; ok && i < original.count; ++i) {
+    const char* newline = (const char*)memchr(line, '\n', text.used - (size_t)(line - text.data));
+    size_t length = newline ? (size_t)(newline - line) : text.used - (size_t)(line - text.data);
+
+    listing_line decoded_line;
+    normalize_line(line, length, &decoded_line, label);
+    const struct instruction* inst = original.instructions + i;
+    if (inst->op != Op_None && inst->operands[0].kind == Operand_Relative) {
+      u32 target = inst->address + inst->size + (u32)(i32)inst->operands[0].value;
+      snprintf(decoded_line.text + decoded_line.operands, sizeof(decoded_line.text) - decoded_line.operands,
+               "@%ld", find_instruction(&original, target));
+    }
+
+    if (strcmp(decoded_line.text, expected[i].text) != 0) {
+      fprintf(stderr, "ERROR: %s instruction %zu reads \"%s\", the listing has \"%s\"\n", input->name, i,
+              decoded_line.text, expected[i].text);
+      ok = false;
+    }
+    line += length + 1;
+  }
+
+  printf("%-32s %10zu instructions match the listing  %s\n", input->name, expected_count, ok ? "ok" : "FAILED");
+
+  free(text.data);
+  free(original.instructions);
+  free(expected);
+  return ok;
+}
+
+// every file in the directory but the .asm sources, sorted
+static int compare_names(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static u32 list_listings(const char* directory, char** names, u32 capacity) {
+  DIR* dir = opendir(directory);
+  if (!dir) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", directory);
+    return 0;
+  }
+
+  u32 count = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr && count < capacity) {
+    size_t length = strlen(entry->d_name);
+    if (entry->d_name[0] == '.' || (length > 4 && strcmp(entry->d_name + length - 4, ".asm") == 0)) {
+      continue;
+    }
+    size_t size = strlen(directory) + length + 2;
+    names[count] = (char*)malloc(size);
+    if (names[count]) {
+      snprintf(names[count++], size, "%s/%s", directory, entry->d_name);
+    }
+  }
+  closedir(dir);
+
+  qsort(names, count, sizeof(char*), compare_names);
+  return count;
+}
+
+// weighted mix from generate.h
+static stream random_stream(u32 seed, size_t size, char* name, size_t name_size) {
+  stream result = {name, (u8*)malloc(size), 0};
+  snprintf(name, name_size, "random seed %u", seed);
+  if (result.bytes) {
+    struct generator gen;
+    init_generator(&gen, seed, false);
+    result.size = generate_stream(&gen, result.bytes, size);
+  }
+  return result;
+}
+
+///////////////////////////////////////////////////////////////
+/// Bench functions
+static void bench_decode(RepTester *tester, void *context) {
+  BenchStream* bench = (BenchStream*)context;
+  while (is_testing(tester)) {
+    struct memory m = {bench->input->bytes, bench->input->size, 0};
+
+    begin_time(tester);
+    size_t count = decode_instructions(&m, bench->output->instructions, bench->input->size);
+    end_time(tester);
+
+    count_bytes(tester, bench->input->size);
+    if (count != bench->instructions) {
+      error(tester, "decoded instruction count mismatch");
+    }
+  }
+}
+
+static void bench_decode_format(RepTester *tester, void *context) {
+  BenchStream* bench = (BenchStream*)context;
+  while (is_testing(tester)) {
+    struct memory m = {bench->input->bytes, bench->input->size, 0};
+    bench->text.used = 0;
+
+    begin_time(tester);
+    size_t count = decode_instructions(&m, bench->output->instructions, bench->input->size);
+    for (size_t i = 0; i < count; ++i) {
+      format_instruction(&bench->text, bench->output->instructions + i);
+    }
+    end_time(tester);
+
+    count_bytes(tester, bench->input->size);
+    if (count != bench->instructions) {
+      error(tester, "decoded instruction count mismatch");
+    }
+  }
+}
+
+static void print_instruction_rate(RepRunner* runner, u64 instructions) {
+  for (u32 i = 0; i < runner->variant_count; ++i) {
+    RepTester* tester = &runner->variants[i].tester;
+    f64 seconds = seconds_from_cpu_time((f64)tester->results.min_time, runner->cpu_timer_freq);
+    printf("%-20s %10.2f M instructions/s\n", runner->variants[i].name, seconds > 0.0 ? (f64)instructions / seconds * 1e-6 : 0.0);
+  }
+}
+
+// the decoder timed alone and with the formatter, on one of the random streams
+static void run_bench(const stream* input) {
+  decoded reference = decode_all(input->bytes, input->size);
+  BenchStream bench = {input, &reference, format_all(&reference), reference.count};
+
+  u64 cpu_freq = read_cpu_timer_freq();
+  printf("\n%-20s %-4.2f MHz\n", "CPU Frequency:", cpu_freq * 1e-6f);
+  printf("%-20s %zu bytes, %lu instructions\n", "Stream:", input->size, bench.instructions);
+
+  RepRunner runner;
+  init_runner(&runner, cpu_freq);
+  add_variant(&runner, "decode", bench_decode, &bench, input->size);
+  add_variant(&runner, "decode + format", bench_decode_format, &bench, input->size);
+  printf("\n--- decoder ---\n");
+  run_interleaved(&runner);
+  print_ranked_summary(&runner);
+  print_instruction_rate(&runner, bench.instructions);
+
+  free(bench.text.data);
+  free(reference.instructions);
+}
+
+int main(int argc, char **argv) {
+  bool ok = true;
+  bool check_only = false;
+
+  char* files[MAX_LISTING_FILES];
+  u32 file_count = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--check") == 0) {
+      check_only = true;
+    } else if (file_count < MAX_LISTING_FILES) {
+      files[file_count++] = argv[i];
+    }
+  }
+
+  // the listing names are allocated, the ones from the command line aren't
+  const bool listed = file_count == 0;
+  if (listed) {
+    file_count = list_listings(LISTINGS_DIR, files, MAX_LISTING_FILES);
+    ok = file_count > 0;
+  }
+
+  printf("--- round trip ---\n");
+  for (u32 i = 0; i < file_count; ++i) {
+    struct memory image;
+    if (!init_from_file(&image, files[i])) {
+      ok = false;
+      continue;
+    }
+
+    stream input = {files[i], image.data, image.size};
+    ok &= round_trip(&input);
+    ok &= matches_listing(&input);
+    free_memory(&image);
+  }
+  for (u32 i = 0; listed && i < file_count; ++i) {
+    free(files[i]);
+  }
+
+  char names[RANDOM_STREAM_SEEDS][32];
+  stream streams[RANDOM_STREAM_SEEDS];
+  for (u32 seed = 0; seed < RANDOM_STREAM_SEEDS; ++seed) {
+    streams[seed] = random_stream(seed + 1, RANDOM_STREAM_SIZE, names[seed], sizeof(names[seed]));
+    ok &= round_trip(streams + seed);
+  }
+
+  if (!check_only) {
+    run_bench(streams);
+  }
+
+  for (u32 seed = 0; seed < RANDOM_STREAM_SEEDS; ++seed) {
+    free(streams[seed].bytes);
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,258 @@
+#ifndef ENCODE_H_
+#define ENCODE_H_
+
+#include "string.h"
+#include "stdbool.h"
+
+#include "types.h"
+#include "opcodes.h"
+#include "instruction.h"
+#include "memory.h"
+#include "decode.h"
+
+// the decode tables run backwards: every opcode (and group entry) that decodes to the op is a
+// candidate, the operands are laid out the way its form reads them and the bytes are decoded again
+// to check they mean the same instruction. the shortest candidate wins, the first one on a tie, so
+// the same instruction always comes out as the same bytes. relative jumps keep their target, counted
+// from the first byte, so dropping a redundant prefix doesn't move where they go
+#define MAX_ENCODED_LENGTH 16 // four prefixes and the longest instruction fit
+#define MAX_ENCODE_CANDIDATES 64
+
+struct encode_candidate {
+  u8 opcode;
+  u8 ext;    // reg field for group entries
+};
+
+struct encode_table {
+  struct encode_candidate candidates[Op_Count][MAX_ENCODE_CANDIDATES];
+  u8 counts[Op_Count];
+  bool ready;
+};
+
+static bool same_instruction(const struct instruction* a, const struct instruction* b);
+static u8 encode_instruction(const struct instruction* inst, u8 output[MAX_ENCODED_LENGTH]);
+
+
+static struct encode_table encode_candidates;
+
+static void add_candidate(u8 op, u8 opcode, u8 ext) {
+  if (encode_candidates.counts[op] < MAX_ENCODE_CANDIDATES) {
+    struct encode_candidate* candidate = encode_candidates.candidates[op] + encode_candidates.counts[op]++;
+    candidate->opcode = opcode;
+    candidate->ext = ext;
+  }
+}
+
+// op to opcodes, built the first time anything is encoded
+static void build_encode_table(void) {
+  memset(&encode_candidates, 0, sizeof(encode_candidates));
+  for (u32 opcode = 0; opcode < 256; ++opcode) {
+    struct opcode_entry entry = opcode_table[opcode];
+    if (entry.flags & Flag_Prefix) {
+      continue;
+    }
+
+    if (entry.flags & Flag_Group) {
+      for (u8 ext = 0; ext < 8; ++ext) {
+        add_candidate(opcode_ext_table[entry.op][ext].op, (u8)opcode, ext);
+      }
+    } else {
+      add_candidate(entry.op, (u8)opcode, 0);
+    }
+  }
+  encode_candidates.ready = true;
+}
+
+// everything the formatter prints, address and size aside
+bool same_instruction(const struct instruction* a, const struct instruction* b) {
+  if (a->op != b->op || a->flags != b->flags) {
+    return false;
+  }
+  if (a->op == Op_None) {
+    return a->size == b->size && memcmp(a->bytes, b->bytes, a->size) == 0;
+  }
+  if ((a->flags & Inst_Segment) && a->segment != b->segment) {
+    return false;
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    const struct operand* x = a->operands + i;
+    const struct operand* y = b->operands + i;
+    if (x->kind != y->kind) {
+      return false;
+    }
+    if ((x->kind == Operand_Register || x->kind == Operand_Memory) && x->reg != y->reg) {
+      return false;
+    }
+    if (x->kind != Operand_Register && x->kind != Operand_None && x->value != y->value) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static u8 emit_byte(u8* output, u8 size, u8 byte) {
+  output[size] = byte;
+  return (u8)(size + 1);
+}
+
+static u8 emit_word(u8* output, u8 size, u16 word) {
+  output[size] = (u8)word;
+  output[size + 1] = (u8)(word >> 8);
+  return (u8)(size + 2);
+}
+
+// mod and r/m for an operand, with the displacement that goes after the mod r/m byte
+static u8 emit_modrm(u8* output, u8 size, const struct operand* rm, u8 reg) {
+  if (!rm || rm->kind == Operand_Register) {
+    size = emit_byte(output, size, (u8)(0b11000000 | (reg << 3) | (rm ? rm->reg & 0b111 : 0)));
+    return size;
+  }
+
+  if (rm->reg == Ea_Direct) {
+    size = emit_byte(output, size, (u8)(0b00000110 | (reg << 3)));
+    return emit_word(output, size, (u16)rm->value);
+  }
+
+  // [bp] has no mod 00 form, that one is the direct address
+  if (rm->value == 0 && rm->reg != Ea_bp) {
+    return emit_byte(output, size, (u8)((reg << 3) | rm->reg));
+  }
+  if (rm->value >= -128 && rm->value <= 127) {
+    size = emit_byte(output, size, (u8)(0b01000000 | (reg << 3) | rm->reg));
+    return emit_byte(output, size, (u8)rm->value);
+  }
+  size = emit_byte(output, size, (u8)(0b10000000 | (reg << 3) | rm->reg));
+  return emit_word(output, size, (u16)rm->value);
+}
+
+// lays inst out the way the candidate's form reads it, 0 when the form can't hold the operands
+static u8 encode_candidate(const struct instruction* inst, struct encode_candidate candidate, u8* output) {
+  struct opcode_entry entry = opcode_table[candidate.opcode];
+  const u8 main_form = entry.form;
+  const u8 byte = candidate.opcode;
+
+  if (entry.flags & Flag_Group) {
+    struct opcode_entry ext = opcode_ext_table[entry.op][candidate.ext];
+    entry.op = ext.op;
+    entry.form = ext.form;
+    entry.flags = (u8)((entry.flags & ~Flag_Group) | ext.flags);
+  }
+
+  u8 d = (entry.flags & Flag_D) ? (byte & MASK_D) >> 1 : 0;
+  u8 w = 0;
+  if (entry.flags & Flag_W)    w = byte & MASK_W;
+  if (entry.flags & Flag_W3)   w = (byte >> 3) & 1;
+  if (entry.flags & Flag_Wide) w = 1;
+  u8 s = (entry.flags & Flag_S) ? (byte & MASK_D) >> 1 : 0;
+
+  // operands back in encoding order
+  const struct operand* a = inst->operands;
+  const struct operand* b = inst->operands + 1;
+  bool swapped = false;
+  switch (entry.form) {
+    case Form_RM_Reg:
+    case Form_RM_Seg:
+    case Form_Acc_Mem:  swapped = d; break;
+    case Form_Acc_Port:
+    case Form_Acc_DX:   swapped = entry.op == Op_out; break;
+    default: break;
+  }
+  if (swapped) {
+    const struct operand* swap = a;
+    a = b;
+    b = swap;
+  }
+
+  u8 size = 0;
+  if (inst->flags & Inst_Lock)    size = emit_byte(output, size, 0xf0);
+  if (inst->flags & Inst_Repne)   size = emit_byte(output, size, 0xf2);
+  if (inst->flags & Inst_Rep)     size = emit_byte(output, size, 0xf3);
+  if (inst->flags & Inst_Segment) size = emit_byte(output, size, (u8)(0x26 | ((inst->segment - Reg_es) << 3)));
+  size = emit_byte(output, size, byte);
+
+  if (form_has_modrm(main_form)) {
+    const struct operand* rm = NULL;
+    u8 reg = candidate.ext;
+    switch (entry.form) {
+      case Form_RM_Reg:   rm = a; reg = b->reg & 0b111; break;
+      case Form_RM_Seg:   rm = a; reg = (u8)(b->reg - Reg_es); break;
+      case Form_Reg_Mem:  rm = b; reg = a->reg & 0b111; break;
+      case Form_Esc:      rm = b; reg = (u8)(a->value & 0b111); break;
+      case Form_RM:
+      case Form_RM_Imm:
+      case Form_RM_Shift: rm = a; break;
+      default: break; // Op_None in a group hole
+    }
+    if (rm && rm->kind != Operand_Register && rm->kind != Operand_Memory) {
+      return 0;
+    }
+    size = emit_modrm(output, size, rm, reg);
+  }
+
+  switch (entry.form) {
+    case Form_RM_Imm:
+      size = (w && !s) ? emit_word(output, size, (u16)b->value) : emit_byte(output, size, (u8)b->value);
+      break;
+    case Form_Acc_Imm:
+    case Form_Reg_Imm:
+      size = w ? emit_word(output, size, (u16)b->value) : emit_byte(output, size, (u8)b->value);
+      break;
+    case Form_Acc_Mem:  size = emit_word(output, size, (u16)b->value); break;
+    case Form_Acc_Port: size = emit_byte(output, size, (u8)b->value); break;
+    case Form_Rel8:     size = emit_byte(output, size, (u8)a->value); break;
+    case Form_Rel16:    size = emit_word(output, size, (u16)a->value); break;
+    case Form_Imm8:     size = emit_byte(output, size, (u8)a->value); break;
+    case Form_Imm16:    size = emit_word(output, size, (u16)a->value); break;
+    case Form_Far:
+      size = emit_word(output, size, (u16)b->value);
+      size = emit_word(output, size, (u16)a->value);
+      break;
+    default: break;
+  }
+
+  return size;
+}
+
+// returns the length, 0 when no encoding decodes back to inst. a size of 0 on inst takes
+// relative displacements as they are
+u8 encode_instruction(const struct instruction* inst, u8 output[MAX_ENCODED_LENGTH]) {
+  // nothing to pick from, the bytes are all there is
+  if (inst->op == Op_None) {
+    memcpy(output, inst->bytes, inst->size);
+    return inst->size;
+  }
+
+  if (!encode_candidates.ready) {
+    build_encode_table();
+  }
+
+  u8 best = 0;
+  u8 bytes[MAX_ENCODED_LENGTH];
+  for (u8 i = 0; i < encode_candidates.counts[inst->op]; ++i) {
+    struct encode_candidate candidate = encode_candidates.candidates[inst->op][i];
+    u8 size = encode_candidate(inst, candidate, bytes);
+    if (!size || (best && size >= best)) {
+      continue;
+    }
+
+    // the length doesn't depend on the displacement, so it can be fixed up after the first try
+    struct instruction want = *inst;
+    if (want.operands[0].kind == Operand_Relative && inst->size && size != inst->size) {
+      want.operands[0].value = (i16)(inst->operands[0].value + inst->size - size);
+      encode_candidate(&want, candidate, bytes);
+    }
+
+    struct instruction check;
+    struct memory code = {bytes, size, 0};
+    if (decode_instruction(&code, &check) && check.size == size && same_instruction(&want, &check)) {
+      memcpy(output, bytes, size);
+      best = size;
+    }
+  }
+
+  return best;
+}
+
+#endif // ENCODE_H_
@@ -0,0 +1,253 @@
+#ifndef FORMAT_H_
+#define FORMAT_H_
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdbool.h"
+
+#include "types.h"
+#include "opcodes.h"
+#include "instruction.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define MAX_LINE_LENGTH 64 // longest is something like "lock rep mov word [es:bp+si-32768], -32768"
+
+// text piles up here and goes out in one fwrite whenever a line might not fit
+struct output_buffer {
+  FILE* file;
+  char* data;
+  size_t size;
+  size_t used;
+};
+
+static MAYBE_UNUSED bool init_output(struct output_buffer* out, FILE* file, size_t size);
+static void flush_output(struct output_buffer* out);
+static void reserve_output(struct output_buffer* out, size_t size);
+static MAYBE_UNUSED void free_output(struct output_buffer* out);
+static void append_string(struct output_buffer* out, const char* text);
+static MAYBE_UNUSED void format_instruction(struct output_buffer* out, const struct instruction* inst);
+
+
+bool init_output(struct output_buffer* out, FILE* file, size_t size) {
+  out->file = file;
+  out->size = size;
+  out->used = 0;
+  out->data = (char*)malloc(size);
+  if (!out->data) {
+    perror("malloc for output buffer failed\n");
+    return false;
+  }
+
+  return true;
+}
+
+// no file throws the text away, for runs that only want the timing
+void flush_output(struct output_buffer* out) {
+  if (out->used) {
+    if (out->file) {
+      fwrite(out->data, 1, out->used, out->file);
+    }
+    out->used = 0;
+  }
+}
+
+// flushes unless size more bytes still fit
+void reserve_output(struct output_buffer* out, size_t size) {
+  if (out->used + size > out->size) {
+    flush_output(out);
+  }
+}
+
+void free_output(struct output_buffer* out) {
+  flush_output(out);
+  free(out->data);
+  out->data = NULL;
+}
+
+static void append_char(struct output_buffer* out, char ch) {
+  out->data[out->used++] = ch;
+}
+
+void append_string(struct output_buffer* out, const char* text) {
+  while (*text) {
+    out->data[out->used++] = *text++;
+  }
+}
+
+static void append_unsigned(struct output_buffer* out, u64 value) {
+  char digits[20];
+  int count = 0;
+  do {
+    digits[count++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value);
+
+  while (count) {
+    out->data[out->used++] = digits[--count];
+  }
+}
+
+static void append_signed(struct output_buffer* out, i32 value, bool with_plus) {
+  if (value < 0) {
+    append_char(out, '-');
+    append_unsigned(out, (u32)-value);
+  } else {
+    if (with_plus) {
+      append_char(out, '+');
+    }
+    append_unsigned(out, (u32)value);
+  }
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static void append_hex_byte(struct output_buffer* out, u8 value) {
+  append_string(out, "0x");
+  append_char(out, hex_digits[value >> 4]);
+  append_char(out, hex_digits[value & 0xf]);
+}
+
+// like "0x%0*x" with min_digits
+static MAYBE_UNUSED void append_hex(struct output_buffer* out, u32 value, int min_digits) {
+  char digits[8];
+  int count = 0;
+  do {
+    digits[count++] = hex_digits[value & 0xf];
+    value >>= 4;
+  } while (value || count < min_digits);
+
+  append_string(out, "0x");
+  while (count) {
+    out->data[out->used++] = digits[--count];
+  }
+}
+
+///////////////////////////////////////////////////////////////
+/// NASM syntax
+static bool op_is_shift(u8 op) {
+  return op >= Op_shl && op <= Op_rcr;
+}
+
+static bool op_is_string(u8 op) {
+  return op >= Op_movs && op <= Op_stos;
+}
+
+// ports, interrupt numbers, stack adjustments and the like read better without a sign
+static bool op_has_unsigned_immediate(u8 op) {
+  return op == Op_in || op == Op_out || op == Op_int || op == Op_ret || op == Op_retf ||
+         op == Op_aam || op == Op_aad || op == Op_esc;
+}
+
+static void format_memory(struct output_buffer* out, const struct instruction* inst, const struct operand* operand, bool with_size) {
+  if (inst->flags & Inst_Far) {
+    append_string(out, "far ");
+  } else if (with_size) {
+    append_string(out, (inst->flags & Inst_Wide) ? "word " : "byte ");
+  }
+
+  append_char(out, '[');
+  if (inst->flags & Inst_Segment) {
+    append_string(out, registers[inst->segment]);
+    append_char(out, ':');
+  }
+
+  if (operand->reg == Ea_Direct) {
+    append_unsigned(out, (u16)operand->value);
+  } else {
+    append_string(out, effective_address[operand->reg]);
+    if (operand->value) {
+      append_signed(out, operand->value, true);
+    }
+  }
+  append_char(out, ']');
+}
+
+static void format_operand(struct output_buffer* out, const struct instruction* inst, const struct operand* operand, const struct operand* other) {
+  switch (operand->kind) {
+    case Operand_Register:
+      if (inst->flags & Inst_Far) { // not encodable with a register, but the bytes say so
+        append_string(out, "far ");
+      }
+      append_string(out, registers[operand->reg]);
+      break;
+    case Operand_Memory: {
+      // a register on the other side gives the size away, except a shift count in cl.
+      // near call/jmp through memory is always a word and esc has no size at all
+      bool implied = (other->kind == Operand_Register && !op_is_shift(inst->op)) ||
+                     inst->op == Op_call || inst->op == Op_jmp || inst->op == Op_esc;
+      format_memory(out, inst, operand, !implied);
+      break;
+    }
+    case Operand_Immediate:
+      if (op_has_unsigned_immediate(inst->op)) {
+        append_unsigned(out, (u16)operand->value);
+      } else {
+        append_signed(out, operand->value, false);
+      }
+      break;
+    case Operand_Relative:
+      // nasm's $ is the start of this instruction, the displacement counts from its end
+      if (inst->op == Op_jmp && (inst->flags & Inst_Short)) {
+        append_string(out, "short ");
+      }
+      append_char(out, '$');
+      append_signed(out, operand->value + inst->size, true);
+      break;
+  }
+}
+
+void format_instruction(struct output_buffer* out, const struct instruction* inst) {
+  reserve_output(out, MAX_LINE_LENGTH);
+
+  const struct operand* a = inst->operands;
+  const struct operand* b = inst->operands + 1;
+
+  // every byte it took, nasm gives back the same ones
+  if (inst->op == Op_None) {
+    append_string(out, "db ");
+    for (u8 i = 0; i < inst->size; ++i) {
+      if (i) {
+        append_string(out, ", ");
+      }
+      append_hex_byte(out, inst->bytes[i]);
+    }
+    append_char(out, '\n');
+    return;
+  }
+
+  if (inst->flags & Inst_Lock)  append_string(out, "lock ");
+  if (inst->flags & Inst_Rep)   append_string(out, "rep ");
+  if (inst->flags & Inst_Repne) append_string(out, "repne ");
+
+  // a segment override without a memory operand applies to the string source
+  if ((inst->flags & Inst_Segment) && a->kind != Operand_Memory && b->kind != Operand_Memory) {
+    append_string(out, registers[inst->segment]);
+    append_char(out, ' ');
+  }
+
+  append_string(out, op_mnemonics[inst->op]);
+  if (op_is_string(inst->op)) {
+    append_char(out, (inst->flags & Inst_Wide) ? 'w' : 'b');
+  }
+
+  if ((inst->flags & Inst_Far) && a->kind == Operand_Immediate) {
+    append_char(out, ' ');
+    append_unsigned(out, (u16)a->value);
+    append_char(out, ':');
+    append_unsigned(out, (u16)b->value);
+  } else if ((inst->op == Op_aam || inst->op == Op_aad) && a->value == 10) {
+    // aam and aad carry their base, nasm only spells it out when it isn't 10
+  } else if (a->kind != Operand_None) {
+    append_char(out, ' ');
+    format_operand(out, inst, a, b);
+    if (b->kind != Operand_None) {
+      append_string(out, ", ");
+      format_operand(out, inst, b, a);
+    }
+  }
+
+  append_char(out, '\n');
+}
+
+#endif // FORMAT_H_
@@ -0,0 +1,74 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+
+#include "types.h"
+#include "generate.h"
+
+// writes a random but valid 8086 instruction stream, the same seed always gives the same bytes
+//
+// usage: generate [--seed n] [--uniform] size output, - writes to stdout
+
+#define GENERATE_CHUNK_SIZE (1u << 20)
+
+int main(int argc, char** argv) {
+  u64 seed = 1;
+  bool uniform = false;
+  const char* size_text = NULL;
+  const char* file_name = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--uniform") == 0) {
+      uniform = true;
+    } else if (!size_text) {
+      size_text = argv[i];
+    } else {
+      file_name = argv[i];
+    }
+  }
+
+  if (!size_text || !file_name) {
+    fprintf(stderr, "Usage: %s [--seed n] [--uniform] [size in bytes] [output file, or - for stdout]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  FILE* output = strcmp(file_name, "-") == 0 ? stdout : fopen(file_name, "wb");
+  if (!output) {
+    perror("fopen for output file failed\n");
+    return EXIT_FAILURE;
+  }
+
+  u8* chunk = (u8*)malloc(GENERATE_CHUNK_SIZE);
+  if (!chunk) {
+    perror("malloc for output chunk failed\n");
+    return EXIT_FAILURE;
+  }
+
+  struct generator gen;
+  init_generator(&gen, seed, uniform);
+
+  // the stream ends on an instruction boundary, a little short of size when the last one doesn't fit
+  u64 size = strtoull(size_text, NULL, 0);
+  u64 written = 0;
+  bool ok = true;
+  while (ok && written < size) {
+    u64 left = size - written;
+    size_t used = generate_stream(&gen, chunk, left < GENERATE_CHUNK_SIZE ? (size_t)left : GENERATE_CHUNK_SIZE);
+    if (!used) {
+      break;
+    }
+    ok = fwrite(chunk, 1, used, output) == used;
+    written += used;
+  }
+
+  if (!ok) {
+    perror("writing output file failed\n");
+  }
+
+  free(chunk);
+  if (output != stdout) {
+    fclose(output);
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
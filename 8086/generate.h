@@ -0,0 +1,151 @@
+#ifndef GENERATE_H_
+#define GENERATE_H_
+
+#include "string.h"
+#include "stdbool.h"
+
+#include "types.h"
+#include "opcodes.h"
+#include "instruction.h"
+#include "memory.h"
+#include "decode.h"
+#include "encode.h"
+
+// random instruction streams for throughput tests and fuzzing the decoder.
+// an op is drawn by weight, then one of the opcodes that encode it, and its mod r/m and data bytes
+// are filled in at random. that's decoded into an instruction, prefixes are added to it and it goes
+// out through encode_instruction, so every stream is valid and encoded the canonical way.
+// jump displacements are random too, the streams are for decoding and not for running
+struct generator {
+  u64 state;
+  u32 weights[Op_Count]; // 0 leaves the op out
+  u32 total;
+};
+
+// roughly what compiled 16 bit code looks like, every other op gets 1
+static const struct {
+  u8 op;
+  u32 weight;
+} default_mix[] = {
+  {Op_mov, 300}, {Op_push, 60}, {Op_pop, 60}, {Op_add, 50}, {Op_sub, 30}, {Op_cmp, 50},
+  {Op_and, 15}, {Op_or, 15}, {Op_xor, 20}, {Op_test, 20}, {Op_inc, 25}, {Op_dec, 25},
+  {Op_lea, 20}, {Op_call, 40}, {Op_jmp, 25}, {Op_ret, 15}, {Op_je, 20}, {Op_jne, 20},
+  {Op_jb, 5}, {Op_jnb, 5}, {Op_jl, 5}, {Op_jg, 5}, {Op_jle, 5}, {Op_jnl, 5},
+  {Op_shl, 8}, {Op_shr, 8}, {Op_sar, 4}, {Op_movs, 5}, {Op_stos, 5}, {Op_lods, 5},
+  {Op_cmps, 3}, {Op_scas, 3}, {Op_xchg, 5}, {Op_loop, 5}, {Op_les, 4}, {Op_int, 4},
+};
+
+static void init_generator(struct generator* gen, u64 seed, bool uniform);
+static u8 generate_instruction(struct generator* gen, u8 output[MAX_ENCODED_LENGTH]);
+static size_t generate_stream(struct generator* gen, u8* output, size_t size);
+
+
+static u64 next_random(struct generator* gen) {
+  // splitmix64, a seed of 0 is as good as any other
+  u64 z = (gen->state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static u32 random_below(struct generator* gen, u32 n) {
+  return (u32)(next_random(gen) % n);
+}
+
+// uniform gives every encodable op the same weight
+void init_generator(struct generator* gen, u64 seed, bool uniform) {
+  memset(gen, 0, sizeof(*gen));
+  gen->state = seed;
+
+  if (!encode_candidates.ready) {
+    build_encode_table();
+  }
+  for (u32 op = Op_None + 1; op < Op_Count; ++op) {
+    gen->weights[op] = encode_candidates.counts[op] ? 1 : 0;
+  }
+  if (!uniform) {
+    for (size_t i = 0; i < sizeof(default_mix) / sizeof(default_mix[0]); ++i) {
+      gen->weights[default_mix[i].op] = default_mix[i].weight;
+    }
+  }
+
+  for (u32 op = 0; op < Op_Count; ++op) {
+    gen->total += gen->weights[op];
+  }
+}
+
+static u8 pick_op(struct generator* gen) {
+  u32 pick = random_below(gen, gen->total);
+  for (u8 op = 0; op < Op_Count; ++op) {
+    if (pick < gen->weights[op]) {
+      return op;
+    }
+    pick -= gen->weights[op];
+  }
+  return Op_nop;
+}
+
+static bool is_string_op(u8 op) {
+  return op == Op_movs || op == Op_cmps || op == Op_scas || op == Op_lods || op == Op_stos;
+}
+
+u8 generate_instruction(struct generator* gen, u8 output[MAX_ENCODED_LENGTH]) {
+  for (;;) {
+    u8 op = pick_op(gen);
+    struct encode_candidate candidate = encode_candidates.candidates[op][random_below(gen, encode_candidates.counts[op])];
+    struct opcode_entry entry = opcode_table[candidate.opcode];
+
+    u8 bytes[8];
+    u64 data = next_random(gen);
+    bytes[0] = candidate.opcode;
+    for (int i = 1; i < 8; ++i) {
+      bytes[i] = (u8)(data >> (i * 8));
+    }
+    if (form_has_modrm(entry.form)) {
+      // registers half the time, the other three mods share the rest
+      u8 mod = (data & 1) ? 3 : (u8)((data >> 1) % 3);
+      u8 reg = (entry.flags & Flag_Group) ? candidate.ext : (u8)((bytes[1] >> 3) & 0b111);
+      bytes[1] = (u8)((mod << 6) | (reg << 3) | (bytes[1] & 0b111));
+    }
+
+    struct instruction inst;
+    struct memory code = {bytes, sizeof(bytes), 0};
+    if (!decode_instruction(&code, &inst) || inst.op != op) {
+      continue;
+    }
+
+    bool memory = inst.operands[0].kind == Operand_Memory || inst.operands[1].kind == Operand_Memory;
+    u32 roll = random_below(gen, 16);
+    if ((memory || is_string_op(op)) && roll == 0) {
+      inst.flags |= Inst_Segment;
+      inst.segment = (u8)(Reg_es + random_below(gen, 4));
+    }
+    if (is_string_op(op) && roll >= 8) {
+      inst.flags |= (roll & 1) ? Inst_Rep : Inst_Repne;
+    }
+
+    inst.size = 0; // keep the random displacement as it is
+    u8 size = encode_instruction(&inst, output);
+    if (size) {
+      return size;
+    }
+  }
+}
+
+// fills output with whole instructions, returns how much of it that took. at most
+// MAX_ENCODED_LENGTH - 1 bytes at the end are left over
+size_t generate_stream(struct generator* gen, u8* output, size_t size) {
+  u8 bytes[MAX_ENCODED_LENGTH];
+  size_t used = 0;
+  for (;;) {
+    u8 length = generate_instruction(gen, bytes);
+    if (used + length > size) {
+      break;
+    }
+    memcpy(output + used, bytes, length);
+    used += length;
+  }
+  return used;
+}
+
+#endif // GENERATE_H_
@@ -0,0 +1,87 @@
+#ifndef INSTRUCTION_H_
+#define INSTRUCTION_H_
+
+#include "types.h"
+
+// one numbering for every register, the decoder turns (w, reg) into reg + (w << 3)
+enum register_index {
+  Reg_al, Reg_cl, Reg_dl, Reg_bl, Reg_ah, Reg_ch, Reg_dh, Reg_bh,
+  Reg_ax, Reg_cx, Reg_dx, Reg_bx, Reg_sp, Reg_bp, Reg_si, Reg_di,
+  Reg_es, Reg_cs, Reg_ss, Reg_ds,
+  Reg_Count
+};
+
+static const char registers[Reg_Count][3] = {
+  "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh",
+  "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+  "es", "cs", "ss", "ds",
+};
+
+// r/m field when MOD != 11, plus the direct address that takes bp's place when MOD = 00
+enum effective_address_index {
+  Ea_bx_si,
+  Ea_bx_di,
+  Ea_bp_si,
+  Ea_bp_di,
+  Ea_si,
+  Ea_di,
+  Ea_bp,
+  Ea_bx,
+  Ea_Direct,
+};
+
+static MAYBE_UNUSED const char* effective_address[] = {
+  "bx+si",
+  "bx+di",
+  "bp+si",
+  "bp+di",
+  "si",
+  "di",
+  "bp",
+  "bx",
+  "",
+};
+
+enum operand_kind {
+  Operand_None,
+  Operand_Register,
+  Operand_Memory,
+  Operand_Immediate,
+  Operand_Relative, // displacement from the end of the instruction
+};
+
+struct operand {
+  u8 kind;    // enum operand_kind
+  u8 reg;     // enum register_index, or enum effective_address_index for memory
+  i16 value;  // immediate, displacement or direct address
+};
+
+enum instruction_flags {
+  Inst_Wide    = 1 << 0, // 16 bit operation
+  Inst_Lock    = 1 << 1,
+  Inst_Rep     = 1 << 2,
+  Inst_Repne   = 1 << 3,
+  Inst_Segment = 1 << 4, // segment is an override
+  Inst_Far     = 1 << 5, // intersegment call/jmp
+  Inst_Short   = 1 << 6, // 8 bit jump displacement
+};
+
+// a longer run of prefixes is cut, the first MAX_PREFIXES of it decode as a db on their own. with
+// the opcode, mod r/m and a displacement that keeps an undefined instruction inside bytes[]
+#define MAX_PREFIXES 4
+#define MAX_UNDEFINED_LENGTH (MAX_PREFIXES + 4)
+
+// 16 bytes, decoded once and shared by the formatter, the simulator and whatever else reads code
+struct instruction {
+  u32 address;  // offset of the first byte, prefixes included
+  u8 op;        // enum op_type
+  u8 size;      // encoded length, prefixes included
+  u8 flags;     // enum instruction_flags
+  u8 segment;   // enum register_index of the override
+  union {
+    struct operand operands[2];      // destination first
+    u8 bytes[MAX_UNDEFINED_LENGTH]; // Op_None, everything it was decoded from
+  };
+};
+
+#endif // INSTRUCTION_H_
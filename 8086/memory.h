@@ -2,22 +2,33 @@
 #define MEMORY_H_
 
 #include "stdio.h"
+#include "stdlib.h"
 #include "stdbool.h"
 
 #include "types.h"
 
+// the 8086 address space, 20 bit physical addresses
+#define MEMORY_SIZE (1u << 20)
+#define MEMORY_MASK (MEMORY_SIZE - 1)
+
+// whole file image with a read cursor, every read is bounds checked
 struct memory {
   u8* data;
   size_t size;
   size_t position;
 };
 
-static bool init_from_file(struct memory* m, char* file_name);
-static size_t read_byte_(struct memory* m, u8* output);
-static size_t read_word_(struct memory* m, u16* output);
+static MAYBE_UNUSED bool init_from_file(struct memory* m, char* file_name);
+static MAYBE_UNUSED void free_memory(struct memory* m);
+static size_t read_byte(struct memory* m, u8* output);
+static size_t read_word(struct memory* m, u16* output);
 
 
 bool init_from_file(struct memory* m, char* file_name) {
+  m->data = NULL;
+  m->size = 0;
+  m->position = 0;
+
   FILE* input = fopen(file_name, "rb");
   if (!input) {
     perror("fopen for input file failed\n");
@@ -31,27 +42,49 @@ bool init_from_file(struct memory* m, char* file_name) {
   if (m->size < 1) {
     printf("%s was empty, nothing to do\n", file_name);
     fclose(input);
-    return false;
+    return true;
   }
 
-  m->data = (u8*)malloc(m->size * sizeof(u8*));
-  fread(m->data, m->size, 1, input);
+  m->data = (u8*)malloc(m->size * sizeof(u8));
+  if (!m->data || fread(m->data, m->size, 1, input) != 1) {
+    perror("reading input file failed\n");
+    free(m->data);
+    m->data = NULL;
+    m->size = 0;
+    fclose(input);
+    return false;
+  }
 
   fclose(input);
 
   return true;
 }
 
-size_t read_byte_(struct memory* m, u8* output) {
-  // &output = m->data[m->position];
-  // return 0;
-  // return read(output, sizeof(u8), 1, m->data);
-  return 0;
+void free_memory(struct memory* m) {
+  free(m->data);
+  m->data = NULL;
+  m->size = 0;
+  m->position = 0;
 }
 
-size_t read_word_(struct memory* m, u16* output) {
-  return 0;
+size_t read_byte(struct memory* m, u8* output) {
+  if (m->position >= m->size) {
+    return 0;
+  }
+
+  *output = m->data[m->position++];
+  return 1;
 }
 
-#endif // #define MEMORY_H_
+// little endian, like everything on the 8086
+size_t read_word(struct memory* m, u16* output) {
+  if (m->size - m->position < 2 || m->position >= m->size) {
+    return 0;
+  }
 
+  *output = (u16)(m->data[m->position] | (m->data[m->position + 1] << 8));
+  m->position += 2;
+  return 2;
+}
+
+#endif // #define MEMORY_H_
@@ -1,3 +1,10 @@
+#ifndef OPCODES_H_
+#define OPCODES_H_
+
+#include "stdbool.h"
+
+#include "types.h"
+
 // https://www.tutorialspoint.com/microprocessor/microprocessor_8086_addressing_modes.htm
 enum AddressingMode {
   Immedate,
@@ -10,3 +17,284 @@ enum AddressingMode {
   BasedIndexedWithDisplacement,
 };
 
+// every mnemonic the 8086 knows, the enum and the name table are both generated from here
+#define OP_LIST(X) \
+  X(Op_None,   "db")     \
+  X(Op_mov,    "mov")    \
+  X(Op_push,   "push")   \
+  X(Op_pop,    "pop")    \
+  X(Op_xchg,   "xchg")   \
+  X(Op_in,     "in")     \
+  X(Op_out,    "out")    \
+  X(Op_xlat,   "xlat")   \
+  X(Op_lea,    "lea")    \
+  X(Op_lds,    "lds")    \
+  X(Op_les,    "les")    \
+  X(Op_lahf,   "lahf")   \
+  X(Op_sahf,   "sahf")   \
+  X(Op_pushf,  "pushf")  \
+  X(Op_popf,   "popf")   \
+  X(Op_add,    "add")    \
+  X(Op_adc,    "adc")    \
+  X(Op_inc,    "inc")    \
+  X(Op_aaa,    "aaa")    \
+  X(Op_daa,    "daa")    \
+  X(Op_sub,    "sub")    \
+  X(Op_sbb,    "sbb")    \
+  X(Op_dec,    "dec")    \
+  X(Op_neg,    "neg")    \
+  X(Op_cmp,    "cmp")    \
+  X(Op_aas,    "aas")    \
+  X(Op_das,    "das")    \
+  X(Op_mul,    "mul")    \
+  X(Op_imul,   "imul")   \
+  X(Op_aam,    "aam")    \
+  X(Op_div,    "div")    \
+  X(Op_idiv,   "idiv")   \
+  X(Op_aad,    "aad")    \
+  X(Op_cbw,    "cbw")    \
+  X(Op_cwd,    "cwd")    \
+  X(Op_not,    "not")    \
+  X(Op_shl,    "shl")    \
+  X(Op_shr,    "shr")    \
+  X(Op_sar,    "sar")    \
+  X(Op_rol,    "rol")    \
+  X(Op_ror,    "ror")    \
+  X(Op_rcl,    "rcl")    \
+  X(Op_rcr,    "rcr")    \
+  X(Op_and,    "and")    \
+  X(Op_test,   "test")   \
+  X(Op_or,     "or")     \
+  X(Op_xor,    "xor")    \
+  X(Op_movs,   "movs")   \
+  X(Op_cmps,   "cmps")   \
+  X(Op_scas,   "scas")   \
+  X(Op_lods,   "lods")   \
+  X(Op_stos,   "stos")   \
+  X(Op_call,   "call")   \
+  X(Op_jmp,    "jmp")    \
+  X(Op_ret,    "ret")    \
+  X(Op_retf,   "retf")   \
+  X(Op_jo,     "jo")     \
+  X(Op_jno,    "jno")    \
+  X(Op_jb,     "jb")     \
+  X(Op_jnb,    "jnb")    \
+  X(Op_je,     "je")     \
+  X(Op_jne,    "jne")    \
+  X(Op_jbe,    "jbe")    \
+  X(Op_ja,     "ja")     \
+  X(Op_js,     "js")     \
+  X(Op_jns,    "jns")    \
+  X(Op_jp,     "jp")     \
+  X(Op_jnp,    "jnp")    \
+  X(Op_jl,     "jl")     \
+  X(Op_jnl,    "jnl")    \
+  X(Op_jle,    "jle")    \
+  X(Op_jg,     "jg")     \
+  X(Op_loopnz, "loopnz") \
+  X(Op_loopz,  "loopz")  \
+  X(Op_loop,   "loop")   \
+  X(Op_jcxz,   "jcxz")   \
+  X(Op_int,    "int")    \
+  X(Op_int3,   "int3")   \
+  X(Op_into,   "into")   \
+  X(Op_iret,   "iret")   \
+  X(Op_clc,    "clc")    \
+  X(Op_cmc,    "cmc")    \
+  X(Op_stc,    "stc")    \
+  X(Op_cld,    "cld")    \
+  X(Op_std,    "std")    \
+  X(Op_cli,    "cli")    \
+  X(Op_sti,    "sti")    \
+  X(Op_hlt,    "hlt")    \
+  X(Op_wait,   "wait")   \
+  X(Op_esc,    "esc")    \
+  X(Op_nop,    "nop")    \
+  X(Op_lock,   "lock")   \
+  X(Op_rep,    "rep")    \
+  X(Op_repne,  "repne")  \
+  X(Op_segment, "")
+
+#define OP_ENUM(Name, Mnemonic) Name,
+#define OP_MNEMONIC(Name, Mnemonic) Mnemonic,
+
+enum op_type {
+  OP_LIST(OP_ENUM)
+  Op_Count
+};
+
+static MAYBE_UNUSED const char* op_mnemonics[] = {
+  OP_LIST(OP_MNEMONIC)
+};
+
+// how the operands of an opcode are encoded
+enum operand_form {
+  Form_None,      // nothing, or only implied operands (cbw, movsb, hlt)
+  Form_RM_Reg,    // mod reg r/m, d says if reg is the destination
+  Form_RM,        // mod r/m, reg is an opcode extension
+  Form_RM_Imm,    // mod r/m, immediate sized by w (or sign extended byte with s)
+  Form_RM_Shift,  // mod r/m, count is 1 or cl (bit 1, read as d)
+  Form_RM_Seg,    // mod sr r/m, d says if sr is the destination
+  Form_Reg_Mem,   // lea/lds/les reg, mod r/m
+  Form_Acc_Imm,   // al/ax, immediate
+  Form_Acc_Mem,   // al/ax, [address], d says if memory is the destination
+  Form_Acc_Reg,   // xchg ax, reg in the low 3 bits
+  Form_Reg,       // reg in the low 3 bits
+  Form_Reg_Imm,   // reg in the low 3 bits, immediate
+  Form_Seg,       // segment register in bits 3-4
+  Form_Acc_Port,  // in/out with an 8 bit port
+  Form_Acc_DX,    // in/out with the port in dx
+  Form_Rel8,      // 8 bit ip relative displacement
+  Form_Rel16,     // 16 bit ip relative displacement
+  Form_Far,       // offset and segment immediates
+  Form_Imm8,
+  Form_Imm16,
+  Form_Esc,       // 8087 escape, opcode bits and mod r/m
+};
+
+enum opcode_flags {
+  Flag_W      = 1 << 0, // w is bit 0
+  Flag_W3     = 1 << 1, // w is bit 3
+  Flag_Wide   = 1 << 2, // always 16 bit
+  Flag_D      = 1 << 3, // d is bit 1
+  Flag_S      = 1 << 4, // s is bit 1, byte immediate sign extended to a word
+  Flag_Group  = 1 << 5, // op is an opcode_groups index, reg picks the entry
+  Flag_Prefix = 1 << 6,
+  Flag_Far    = 1 << 7, // intersegment call/jmp
+};
+
+enum opcode_groups {
+  Group_Imm,    // 80-83
+  Group_Shift,  // d0-d3
+  Group_F6,     // f6-f7
+  Group_FE,
+  Group_FF,
+  Group_Count
+};
+
+struct opcode_entry {
+  u8 op;     // enum op_type, or enum opcode_groups with Flag_Group
+  u8 form;   // enum operand_form
+  u8 flags;  // enum opcode_flags
+};
+
+// rows that repeat across the table
+#define ___ {Op_None, Form_None, 0}
+
+#define ALU_ROW(op, e6, e7) \
+  {op, Form_RM_Reg, Flag_D | Flag_W}, {op, Form_RM_Reg, Flag_D | Flag_W}, \
+  {op, Form_RM_Reg, Flag_D | Flag_W}, {op, Form_RM_Reg, Flag_D | Flag_W}, \
+  {op, Form_Acc_Imm, Flag_W}, {op, Form_Acc_Imm, Flag_W}, e6, e7
+
+#define REG_ROW(op, form, flags) \
+  {op, form, flags}, {op, form, flags}, {op, form, flags}, {op, form, flags}, \
+  {op, form, flags}, {op, form, flags}, {op, form, flags}, {op, form, flags}
+
+#define PAIR(op, form, flags) {op, form, flags}, {op, form, flags}
+
+#define SEG(op) {op, Form_Seg, Flag_Wide}
+#define SEG_PREFIX {Op_segment, Form_Seg, Flag_Prefix}
+#define ONE(op) {op, Form_None, 0}
+
+static const struct opcode_entry opcode_table[256] = {
+  /* 00 */ ALU_ROW(Op_add, SEG(Op_push), SEG(Op_pop)),
+  /* 08 */ ALU_ROW(Op_or,  SEG(Op_push), SEG(Op_pop)),
+  /* 10 */ ALU_ROW(Op_adc, SEG(Op_push), SEG(Op_pop)),
+  /* 18 */ ALU_ROW(Op_sbb, SEG(Op_push), SEG(Op_pop)),
+  /* 20 */ ALU_ROW(Op_and, SEG_PREFIX, ONE(Op_daa)),
+  /* 28 */ ALU_ROW(Op_sub, SEG_PREFIX, ONE(Op_das)),
+  /* 30 */ ALU_ROW(Op_xor, SEG_PREFIX, ONE(Op_aaa)),
+  /* 38 */ ALU_ROW(Op_cmp, SEG_PREFIX, ONE(Op_aas)),
+
+  /* 40 */ REG_ROW(Op_inc,  Form_Reg, Flag_Wide),
+  /* 48 */ REG_ROW(Op_dec,  Form_Reg, Flag_Wide),
+  /* 50 */ REG_ROW(Op_push, Form_Reg, Flag_Wide),
+  /* 58 */ REG_ROW(Op_pop,  Form_Reg, Flag_Wide),
+
+  /* 60 */ REG_ROW(Op_None, Form_None, 0),
+  /* 68 */ REG_ROW(Op_None, Form_None, 0),
+
+  /* 70 */ {Op_jo, Form_Rel8, 0}, {Op_jno, Form_Rel8, 0}, {Op_jb, Form_Rel8, 0}, {Op_jnb, Form_Rel8, 0},
+  /* 74 */ {Op_je, Form_Rel8, 0}, {Op_jne, Form_Rel8, 0}, {Op_jbe, Form_Rel8, 0}, {Op_ja, Form_Rel8, 0},
+  /* 78 */ {Op_js, Form_Rel8, 0}, {Op_jns, Form_Rel8, 0}, {Op_jp, Form_Rel8, 0}, {Op_jnp, Form_Rel8, 0},
+  /* 7c */ {Op_jl, Form_Rel8, 0}, {Op_jnl, Form_Rel8, 0}, {Op_jle, Form_Rel8, 0}, {Op_jg, Form_Rel8, 0},
+
+  /* 80 */ {Group_Imm, Form_RM_Imm, Flag_Group | Flag_W | Flag_S}, {Group_Imm, Form_RM_Imm, Flag_Group | Flag_W | Flag_S},
+  /* 82 */ {Group_Imm, Form_RM_Imm, Flag_Group | Flag_W | Flag_S}, {Group_Imm, Form_RM_Imm, Flag_Group | Flag_W | Flag_S},
+  /* 84 */ PAIR(Op_test, Form_RM_Reg, Flag_W),
+  /* 86 */ PAIR(Op_xchg, Form_RM_Reg, Flag_W),
+  /* 88 */ PAIR(Op_mov, Form_RM_Reg, Flag_D | Flag_W), PAIR(Op_mov, Form_RM_Reg, Flag_D | Flag_W),
+  /* 8c */ {Op_mov, Form_RM_Seg, Flag_D | Flag_Wide}, {Op_lea, Form_Reg_Mem, Flag_Wide},
+  /* 8e */ {Op_mov, Form_RM_Seg, Flag_D | Flag_Wide}, {Op_pop, Form_RM, Flag_Wide},
+
+  /* 90 */ ONE(Op_nop), {Op_xchg, Form_Acc_Reg, Flag_Wide}, {Op_xchg, Form_Acc_Reg, Flag_Wide}, {Op_xchg, Form_Acc_Reg, Flag_Wide},
+  /* 94 */ {Op_xchg, Form_Acc_Reg, Flag_Wide}, {Op_xchg, Form_Acc_Reg, Flag_Wide}, {Op_xchg, Form_Acc_Reg, Flag_Wide}, {Op_xchg, Form_Acc_Reg, Flag_Wide},
+  /* 98 */ ONE(Op_cbw), ONE(Op_cwd), {Op_call, Form_Far, Flag_Far}, ONE(Op_wait),
+  /* 9c */ ONE(Op_pushf), ONE(Op_popf), ONE(Op_sahf), ONE(Op_lahf),
+
+  /* a0 */ PAIR(Op_mov, Form_Acc_Mem, Flag_D | Flag_W), PAIR(Op_mov, Form_Acc_Mem, Flag_D | Flag_W),
+  /* a4 */ PAIR(Op_movs, Form_None, Flag_W), PAIR(Op_cmps, Form_None, Flag_W),
+  /* a8 */ PAIR(Op_test, Form_Acc_Imm, Flag_W), PAIR(Op_stos, Form_None, Flag_W),
+  /* ac */ PAIR(Op_lods, Form_None, Flag_W), PAIR(Op_scas, Form_None, Flag_W),
+
+  /* b0 */ REG_ROW(Op_mov, Form_Reg_Imm, Flag_W3),
+  /* b8 */ REG_ROW(Op_mov, Form_Reg_Imm, Flag_W3),
+
+  /* c0 */ ___, ___, {Op_ret, Form_Imm16, 0}, ONE(Op_ret),
+  /* c4 */ {Op_les, Form_Reg_Mem, Flag_Wide}, {Op_lds, Form_Reg_Mem, Flag_Wide}, PAIR(Op_mov, Form_RM_Imm, Flag_W),
+  /* c8 */ ___, ___, {Op_retf, Form_Imm16, 0}, ONE(Op_retf),
+  /* cc */ ONE(Op_int3), {Op_int, Form_Imm8, 0}, ONE(Op_into), ONE(Op_iret),
+
+  /* d0 */ PAIR(Group_Shift, Form_RM_Shift, Flag_Group | Flag_D | Flag_W), PAIR(Group_Shift, Form_RM_Shift, Flag_Group | Flag_D | Flag_W),
+  /* d4 */ {Op_aam, Form_Imm8, 0}, {Op_aad, Form_Imm8, 0}, ___, ONE(Op_xlat),
+  /* d8 */ REG_ROW(Op_esc, Form_Esc, 0),
+
+  /* e0 */ {Op_loopnz, Form_Rel8, 0}, {Op_loopz, Form_Rel8, 0}, {Op_loop, Form_Rel8, 0}, {Op_jcxz, Form_Rel8, 0},
+  /* e4 */ PAIR(Op_in, Form_Acc_Port, Flag_W), PAIR(Op_out, Form_Acc_Port, Flag_W),
+  /* e8 */ {Op_call, Form_Rel16, 0}, {Op_jmp, Form_Rel16, 0}, {Op_jmp, Form_Far, Flag_Far}, {Op_jmp, Form_Rel8, 0},
+  /* ec */ PAIR(Op_in, Form_Acc_DX, Flag_W), PAIR(Op_out, Form_Acc_DX, Flag_W),
+
+  /* f0 */ {Op_lock, Form_None, Flag_Prefix}, ___, {Op_repne, Form_None, Flag_Prefix}, {Op_rep, Form_None, Flag_Prefix},
+  /* f4 */ ONE(Op_hlt), ONE(Op_cmc), PAIR(Group_F6, Form_RM, Flag_Group | Flag_W),
+  /* f8 */ ONE(Op_clc), ONE(Op_stc), ONE(Op_cli), ONE(Op_sti),
+  /* fc */ ONE(Op_cld), ONE(Op_std), {Group_FE, Form_RM, Flag_Group | Flag_W}, {Group_FF, Form_RM, Flag_Group | Flag_W},
+};
+
+// entries picked by the reg field of mod r/m, their flags are added to the main entry's
+static const struct opcode_entry opcode_ext_table[Group_Count][8] = {
+  /* Group_Imm */ {
+    {Op_add, Form_RM_Imm, 0}, {Op_or,  Form_RM_Imm, 0}, {Op_adc, Form_RM_Imm, 0}, {Op_sbb, Form_RM_Imm, 0},
+    {Op_and, Form_RM_Imm, 0}, {Op_sub, Form_RM_Imm, 0}, {Op_xor, Form_RM_Imm, 0}, {Op_cmp, Form_RM_Imm, 0},
+  },
+  /* Group_Shift */ {
+    {Op_rol, Form_RM_Shift, 0}, {Op_ror, Form_RM_Shift, 0}, {Op_rcl, Form_RM_Shift, 0}, {Op_rcr, Form_RM_Shift, 0},
+    {Op_shl, Form_RM_Shift, 0}, {Op_shr, Form_RM_Shift, 0}, ___, {Op_sar, Form_RM_Shift, 0},
+  },
+  /* Group_F6 */ {
+    {Op_test, Form_RM_Imm, 0}, ___, {Op_not, Form_RM, 0}, {Op_neg, Form_RM, 0},
+    {Op_mul, Form_RM, 0}, {Op_imul, Form_RM, 0}, {Op_div, Form_RM, 0}, {Op_idiv, Form_RM, 0},
+  },
+  /* Group_FE */ {
+    {Op_inc, Form_RM, 0}, {Op_dec, Form_RM, 0}, ___, ___, ___, ___, ___, ___,
+  },
+  /* Group_FF */ {
+    {Op_inc, Form_RM, 0}, {Op_dec, Form_RM, 0}, {Op_call, Form_RM, 0}, {Op_call, Form_RM, Flag_Far},
+    {Op_jmp, Form_RM, 0}, {Op_jmp, Form_RM, Flag_Far}, {Op_push, Form_RM, 0}, ___,
+  },
+};
+
+#undef ___
+#undef ALU_ROW
+#undef REG_ROW
+#undef PAIR
+#undef SEG
+#undef SEG_PREFIX
+#undef ONE
+
+// forms that are followed by a mod r/m byte
+static bool form_has_modrm(u8 form) {
+  return form == Form_RM_Reg || form == Form_RM || form == Form_RM_Imm || form == Form_RM_Shift ||
+         form == Form_RM_Seg || form == Form_Reg_Mem || form == Form_Esc;
+}
+
+#endif // OPCODES_H_
@@ -0,0 +1,214 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "pthread.h"
+
+#include "types.h"
+#include "memory.h"
+#include "decode.h"
+#include "format.h"
+
+// parallel linear sweep, link with -pthread.
+// the image is cut into chunks and every thread decodes its chunk as if an instruction started on
+// its first byte. that guess is usually wrong for a few instructions, so chunks are then stitched in
+// order: the real stream coming out of the previous chunk is decoded on until it lands on an offset
+// the guess also started an instruction at, and from there the two are the same stream.
+// formatting goes back to the threads, each into its own buffer, written out in chunk order.
+// chunks are handed out a round at a time so memory stays bounded on big images. an image that ends
+// inside an instruction fails like the streaming disassembly does
+#define PARALLEL_CHUNK_SIZE (1u << 20)
+#define MAX_PARALLEL_THREADS 64
+
+struct disassembly_chunk {
+  const struct memory* image;
+  size_t start;
+  size_t end;
+
+  struct instruction* guess; // decoded from start until one reaches end
+  size_t guess_count;
+  size_t synced;             // first guess that is a real instruction
+
+  struct instruction* prefix; // real instructions before the guess synced up
+  size_t prefix_count;
+  size_t prefix_capacity;
+
+  struct output_buffer text;
+};
+
+static bool disassemble_parallel(const struct memory* image, const char* file_name, struct output_buffer* out, int threads);
+
+
+static void* decode_chunk(void* arg) {
+  struct disassembly_chunk* chunk = (struct disassembly_chunk*)arg;
+  struct memory code = {chunk->image->data, chunk->image->size, chunk->start};
+
+  chunk->guess_count = 0;
+  while (code.position < chunk->end) {
+    if (!decode_instruction(&code, chunk->guess + chunk->guess_count)) {
+      break; // cut short, only happens at the end of the image
+    }
+    ++chunk->guess_count;
+  }
+
+  return NULL;
+}
+
+static void* format_chunk(void* arg) {
+  struct disassembly_chunk* chunk = (struct disassembly_chunk*)arg;
+  for (size_t i = 0; i < chunk->prefix_count; ++i) {
+    format_instruction(&chunk->text, chunk->prefix + i);
+  }
+  for (size_t i = chunk->synced; i < chunk->guess_count; ++i) {
+    format_instruction(&chunk->text, chunk->guess + i);
+  }
+  return NULL;
+}
+
+static bool push_prefix(struct disassembly_chunk* chunk, const struct instruction* inst) {
+  if (chunk->prefix_count == chunk->prefix_capacity) {
+    size_t capacity = chunk->prefix_capacity ? chunk->prefix_capacity * 2 : 64;
+    struct instruction* grown = (struct instruction*)realloc(chunk->prefix, capacity * sizeof(struct instruction));
+    if (!grown) {
+      perror("realloc for instructions failed\n");
+      return false;
+    }
+    chunk->prefix = grown;
+    chunk->prefix_capacity = capacity;
+  }
+
+  chunk->prefix[chunk->prefix_count++] = *inst;
+  return true;
+}
+
+// real is where the previous chunk's real stream left off. returns where this one's does, or
+// sets *cut_short when the real stream runs into the end of the image
+static size_t stitch_chunk(struct disassembly_chunk* chunk, size_t real, bool* cut_short) {
+  chunk->prefix_count = 0;
+
+  // guesses are in address order, skip the ones the real stream already went past
+  size_t next = 0;
+  while (next < chunk->guess_count && chunk->guess[next].address < real) {
+    ++next;
+  }
+
+  struct memory code = {chunk->image->data, chunk->image->size, real};
+  while (code.position < chunk->end) {
+    if (next < chunk->guess_count && chunk->guess[next].address == code.position) {
+      chunk->synced = next;
+      const struct instruction* last = chunk->guess + chunk->guess_count - 1;
+      size_t resume = last->address + last->size;
+      *cut_short = resume < chunk->end; // the guess itself ran into the end of the image
+      return resume;
+    }
+
+    struct instruction inst;
+    if (!decode_instruction(&code, &inst)) {
+      code.position = inst.address;
+      *cut_short = true;
+      break;
+    }
+    if (!push_prefix(chunk, &inst)) {
+      *cut_short = true;
+      break;
+    }
+
+    while (next < chunk->guess_count && chunk->guess[next].address < code.position) {
+      ++next;
+    }
+  }
+
+  chunk->synced = chunk->guess_count;
+  return code.position;
+}
+
+static void run_threads(void* (*work)(void*), struct disassembly_chunk* chunks, int count) {
+  pthread_t handles[MAX_PARALLEL_THREADS];
+  bool started[MAX_PARALLEL_THREADS] = {false};
+  for (int i = 1; i < count; ++i) {
+    started[i] = pthread_create(handles + i, NULL, work, chunks + i) == 0;
+    if (!started[i]) {
+      work(chunks + i); // no thread, do it here
+    }
+  }
+
+  work(chunks);
+
+  for (int i = 1; i < count; ++i) {
+    if (started[i]) {
+      pthread_join(handles[i], NULL);
+    }
+  }
+}
+
+bool disassemble_parallel(const struct memory* image, const char* file_name, struct output_buffer* out, int threads) {
+  if (threads > MAX_PARALLEL_THREADS) {
+    threads = MAX_PARALLEL_THREADS;
+  }
+
+  struct disassembly_chunk chunks[MAX_PARALLEL_THREADS];
+  memset(chunks, 0, sizeof(chunks));
+
+  bool ok = true;
+  for (int i = 0; i < threads && ok; ++i) {
+    struct disassembly_chunk* chunk = chunks + i;
+    chunk->image = image;
+    // every instruction is at least a byte, and the last one may run over the end of the chunk.
+    // lines are at most MAX_LINE_LENGTH, so the text buffer never has to flush (the pages
+    // only get touched as far as they're used)
+    chunk->guess = (struct instruction*)malloc((PARALLEL_CHUNK_SIZE + 1) * sizeof(struct instruction));
+    ok = chunk->guess && init_output(&chunk->text, out->file, (size_t)(PARALLEL_CHUNK_SIZE + 1) * MAX_LINE_LENGTH);
+  }
+
+  append_string(out, "bits 16\n\n");
+
+  size_t real = 0;
+  bool cut_short = false;
+  for (size_t round = 0; ok && !cut_short && round < image->size; round += (size_t)threads * PARALLEL_CHUNK_SIZE) {
+    int count = 0;
+    for (; count < threads; ++count) {
+      size_t start = round + (size_t)count * PARALLEL_CHUNK_SIZE;
+      if (start >= image->size) {
+        break;
+      }
+      chunks[count].start = start;
+      chunks[count].end = start + PARALLEL_CHUNK_SIZE < image->size ? start + PARALLEL_CHUNK_SIZE : image->size;
+    }
+
+    run_threads(decode_chunk, chunks, count);
+
+    int stitched = 0;
+    while (stitched < count && !cut_short) {
+      real = stitch_chunk(chunks + stitched, real, &cut_short);
+      ++stitched;
+    }
+
+    run_threads(format_chunk, chunks, stitched);
+
+    flush_output(out);
+    for (int i = 0; i < stitched; ++i) {
+      flush_output(&chunks[i].text);
+    }
+  }
+
+  // the image ends inside an instruction
+  const bool complete = !cut_short || real >= image->size;
+  if (!complete) {
+    fprintf(stderr, "ERROR: instruction at %zu in %s is cut short\n", real, file_name);
+  }
+
+  for (int i = 0; i < threads; ++i) {
+    free(chunks[i].guess);
+    free(chunks[i].prefix);
+    free(chunks[i].text.data);
+  }
+
+  if (!ok) {
+    perror("malloc for parallel disassembly failed\n");
+  }
+  return ok && complete;
+}
+
+#endif // PARALLEL_H_
@@ -0,0 +1,127 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "stdbool.h"
+#include "pthread.h"
+
+#include "types.h"
+
+// work stealing over a fixed list of jobs, link with -pthread.
+// every worker starts with a contiguous share of the jobs in its own queue and takes them from the
+// back. one that runs dry steals from the front of the others, so a few slow jobs don't leave the
+// rest of the workers idle. nothing is added once it's running, so every queue empty means done
+#define MAX_POOL_WORKERS 64
+
+struct job_queue {
+  pthread_mutex_t lock;
+  u32 head; // next to steal
+  u32 tail; // one past the next for the owner
+};
+
+struct worker_pool {
+  struct job_queue queues[MAX_POOL_WORKERS];
+  int workers;
+  void (*work)(void* context, u32 job);
+  u8* contexts;        // one per worker
+  size_t context_size;
+  u64 steals;
+};
+
+struct pool_worker {
+  struct worker_pool* pool;
+  int index;
+};
+
+// runs work(contexts + i * context_size, job) for every job in [0, job_count), returns how many were stolen
+static u64 run_pool(u32 job_count, int workers, void (*work)(void* context, u32 job), void* contexts, size_t context_size);
+
+
+static bool pop_job(struct job_queue* queue, bool steal, u32* job) {
+  pthread_mutex_lock(&queue->lock);
+  bool found = queue->head < queue->tail;
+  if (found) {
+    *job = steal ? queue->head++ : --queue->tail;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return found;
+}
+
+static void* pool_thread(void* arg) {
+  struct pool_worker* worker = (struct pool_worker*)arg;
+  struct worker_pool* pool = worker->pool;
+  void* context = pool->contexts + (size_t)worker->index * pool->context_size;
+
+  u64 steals = 0;
+  for (;;) {
+    u32 job;
+    bool found = pop_job(pool->queues + worker->index, false, &job);
+    for (int i = 1; !found && i < pool->workers; ++i) {
+      found = pop_job(pool->queues + (worker->index + i) % pool->workers, true, &job);
+      steals += found;
+    }
+    if (!found) {
+      break;
+    }
+    pool->work(context, job);
+  }
+
+  __atomic_add_fetch(&pool->steals, steals, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+u64 run_pool(u32 job_count, int workers, void (*work)(void* context, u32 job), void* contexts, size_t context_size) {
+  if (workers < 1) {
+    workers = 1;
+  }
+  if (workers > MAX_POOL_WORKERS) {
+    workers = MAX_POOL_WORKERS;
+  }
+
+  struct worker_pool* pool = (struct worker_pool*)calloc(1, sizeof(struct worker_pool));
+  if (!pool) {
+    perror("calloc for worker pool failed\n");
+    return 0;
+  }
+  pool->workers = workers;
+  pool->work = work;
+  pool->contexts = (u8*)contexts;
+  pool->context_size = context_size;
+
+  for (int i = 0; i < workers; ++i) {
+    struct job_queue* queue = pool->queues + i;
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->head = (u32)((u64)job_count * i / workers);
+    queue->tail = (u32)((u64)job_count * (i + 1) / workers);
+  }
+
+  // worker 0 is this thread, a worker that can't get a thread just leaves its share to be stolen
+  pthread_t handles[MAX_POOL_WORKERS];
+  bool started[MAX_POOL_WORKERS] = {false};
+  struct pool_worker threads[MAX_POOL_WORKERS];
+  for (int i = 0; i < workers; ++i) {
+    threads[i].pool = pool;
+    threads[i].index = i;
+  }
+  for (int i = 1; i < workers; ++i) {
+    started[i] = pthread_create(handles + i, NULL, pool_thread, threads + i) == 0;
+  }
+
+  pool_thread(threads);
+
+  for (int i = 1; i < workers; ++i) {
+    if (started[i]) {
+      pthread_join(handles[i], NULL);
+    }
+  }
+  for (int i = 0; i < workers; ++i) {
+    pthread_mutex_destroy(&pool->queues[i].lock);
+  }
+
+  u64 steals = pool->steals;
+  free(pool);
+  return steals;
+}
+
+#endif // POOL_H_
@@ -0,0 +1,447 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include "stdio.h"
+#include "stdbool.h"
+
+#include "types.h"
+#include "opcodes.h"
+#include "memory.h"
+#include "instruction.h"
+#include "decode_cache.h"
+#include "address_space.h"
+#include "format.h"
+
+enum cpu_flags {
+  Flag_CF = 1 << 0,
+  Flag_PF = 1 << 2,
+  Flag_AF = 1 << 4,
+  Flag_ZF = 1 << 6,
+  Flag_SF = 1 << 7,
+  Flag_TF = 1 << 8,
+  Flag_IF = 1 << 9,
+  Flag_DF = 1 << 10,
+  Flag_OF = 1 << 11,
+};
+
+// "CPAZSTIDO", each letter is the flag at that bit
+static const char flag_names[16] = {'C', 0, 'P', 0, 'A', 0, 'Z', 'S', 'T', 'I', 'D', 'O', 0, 0, 0, 0};
+
+// word and segment registers in register_index order, byte registers are halves of the first four
+struct cpu {
+  u16 regs[Reg_Count - Reg_ax];
+  u16 ip;
+  u16 flags;
+};
+
+enum exec_result {
+  Exec_Continue,
+  Exec_Halt,
+  Exec_Unsupported,
+};
+
+static enum exec_result execute_instruction(struct cpu* cpu, struct address_space* memory, const struct instruction* inst);
+static u64 run_switch(struct cpu* cpu, struct address_space* memory, u32 end, u64 limit, enum exec_result* result);
+static MAYBE_UNUSED void format_changes(struct output_buffer* out, const struct cpu* before, const struct cpu* after);
+static MAYBE_UNUSED void format_final_state(struct output_buffer* out, const struct cpu* cpu);
+
+
+///////////////////////////////////////////////////////////////
+/// Registers and memory
+static u16 read_register(const struct cpu* cpu, u8 reg) {
+  if (reg >= Reg_ax) {
+    return cpu->regs[reg - Reg_ax];
+  }
+
+  u16 word = cpu->regs[reg & 0b11];
+  return (reg & 0b100) ? (word >> 8) : (word & 0xff);
+}
+
+static void write_register(struct cpu* cpu, u8 reg, u16 value) {
+  if (reg >= Reg_ax) {
+    cpu->regs[reg - Reg_ax] = value;
+    return;
+  }
+
+  u16* word = cpu->regs + (reg & 0b11);
+  if (reg & 0b100) {
+    *word = (u16)((*word & 0x00ff) | ((value & 0xff) << 8));
+  } else {
+    *word = (u16)((*word & 0xff00) | (value & 0xff));
+  }
+}
+
+static u16 segment_register(const struct cpu* cpu, u8 reg) {
+  return cpu->regs[reg - Reg_ax];
+}
+
+// bp based addresses default to the stack segment, everything else to the data segment.
+// returns a far pointer, read_memory and write_memory do the translation
+static u32 memory_address(const struct cpu* cpu, const struct instruction* inst, const struct operand* operand) {
+  u16 offset = (u16)operand->value;
+  u8 segment = Reg_ds;
+  switch (operand->reg) {
+    case Ea_bx_si: offset += read_register(cpu, Reg_bx) + read_register(cpu, Reg_si); break;
+    case Ea_bx_di: offset += read_register(cpu, Reg_bx) + read_register(cpu, Reg_di); break;
+    case Ea_bp_si: offset += read_register(cpu, Reg_bp) + read_register(cpu, Reg_si); segment = Reg_ss; break;
+    case Ea_bp_di: offset += read_register(cpu, Reg_bp) + read_register(cpu, Reg_di); segment = Reg_ss; break;
+    case Ea_si:    offset += read_register(cpu, Reg_si); break;
+    case Ea_di:    offset += read_register(cpu, Reg_di); break;
+    case Ea_bp:    offset += read_register(cpu, Reg_bp); segment = Reg_ss; break;
+    case Ea_bx:    offset += read_register(cpu, Reg_bx); break;
+    default: break;
+  }
+
+  if (inst->flags & Inst_Segment) {
+    segment = inst->segment;
+  }
+
+  return far_pointer(segment_register(cpu, segment), offset);
+}
+
+static u16 read_operand(const struct cpu* cpu, const struct address_space* memory, const struct instruction* inst, const struct operand* operand) {
+  switch (operand->kind) {
+    case Operand_Register:  return read_register(cpu, operand->reg);
+    case Operand_Memory:    return read_memory(memory, memory_address(cpu, inst, operand), inst->flags & Inst_Wide);
+    case Operand_Immediate: return (u16)operand->value;
+    default:                return 0;
+  }
+}
+
+static void write_operand(struct cpu* cpu, struct address_space* memory, const struct instruction* inst, const struct operand* operand, u16 value) {
+  if (operand->kind == Operand_Register) {
+    write_register(cpu, operand->reg, value);
+  } else if (operand->kind == Operand_Memory) {
+    write_memory(memory, memory_address(cpu, inst, operand), value, inst->flags & Inst_Wide);
+  }
+}
+
+static void push_word(struct cpu* cpu, struct address_space* memory, u16 value) {
+  cpu->regs[Reg_sp - Reg_ax] -= 2;
+  write_memory(memory, far_pointer(segment_register(cpu, Reg_ss), read_register(cpu, Reg_sp)), value, true);
+}
+
+static u16 pop_word(struct cpu* cpu, const struct address_space* memory) {
+  u16 value = read_memory(memory, far_pointer(segment_register(cpu, Reg_ss), read_register(cpu, Reg_sp)), true);
+  cpu->regs[Reg_sp - Reg_ax] += 2;
+  return value;
+}
+
+///////////////////////////////////////////////////////////////
+/// Arithmetic
+static bool parity_even(u8 value) {
+  value ^= value >> 4;
+  value ^= value >> 2;
+  value ^= value >> 1;
+  return !(value & 1);
+}
+
+static void set_flag(struct cpu* cpu, u16 flag, bool set) {
+  cpu->flags = set ? (cpu->flags | flag) : (cpu->flags & ~flag);
+}
+
+static void set_result_flags(struct cpu* cpu, u32 result, bool wide) {
+  u16 mask = wide ? 0xffff : 0xff;
+  u16 sign = wide ? 0x8000 : 0x80;
+  set_flag(cpu, Flag_ZF, (result & mask) == 0);
+  set_flag(cpu, Flag_SF, result & sign);
+  set_flag(cpu, Flag_PF, parity_even((u8)result));
+}
+
+// add, adc, sub, sbb and cmp, carry_in is already 0 for the ones that don't use it
+static u16 add_sub(struct cpu* cpu, u16 a, u16 b, u16 carry_in, bool subtract, bool wide, bool keep_carry) {
+  u16 mask = wide ? 0xffff : 0xff;
+  u16 sign = wide ? 0x8000 : 0x80;
+  a &= mask;
+  b &= mask;
+
+  u32 result;
+  bool overflow;
+  if (subtract) {
+    result = (u32)a - b - carry_in;
+    overflow = (a ^ b) & (a ^ result) & sign;
+    if (!keep_carry) set_flag(cpu, Flag_CF, (u32)a < (u32)b + carry_in);
+  } else {
+    result = (u32)a + b + carry_in;
+    overflow = ~(a ^ b) & (a ^ result) & sign;
+    if (!keep_carry) set_flag(cpu, Flag_CF, result > mask);
+  }
+
+  set_flag(cpu, Flag_OF, overflow);
+  set_flag(cpu, Flag_AF, (a ^ b ^ result) & 0x10);
+  set_result_flags(cpu, result, wide);
+
+  return (u16)(result & mask);
+}
+
+static u16 logic(struct cpu* cpu, u8 op, u16 a, u16 b, bool wide) {
+  u16 result = op == Op_and || op == Op_test ? (a & b) : op == Op_or ? (a | b) : (a ^ b);
+  set_flag(cpu, Flag_CF, false);
+  set_flag(cpu, Flag_OF, false);
+  set_flag(cpu, Flag_AF, false);
+  set_result_flags(cpu, result, wide);
+  return (u16)(result & (wide ? 0xffff : 0xff));
+}
+
+static bool jump_taken(struct cpu* cpu, u8 op) {
+  u16 f = cpu->flags;
+  bool cf = f & Flag_CF, zf = f & Flag_ZF, sf = f & Flag_SF, of = f & Flag_OF, pf = f & Flag_PF;
+
+  switch (op) {
+    case Op_jo:  return of;
+    case Op_jno: return !of;
+    case Op_jb:  return cf;
+    case Op_jnb: return !cf;
+    case Op_je:  return zf;
+    case Op_jne: return !zf;
+    case Op_jbe: return cf || zf;
+    case Op_ja:  return !cf && !zf;
+    case Op_js:  return sf;
+    case Op_jns: return !sf;
+    case Op_jp:  return pf;
+    case Op_jnp: return !pf;
+    case Op_jl:  return sf != of;
+    case Op_jnl: return sf == of;
+    case Op_jle: return zf || sf != of;
+    case Op_jg:  return !zf && sf == of;
+  }
+
+  // the loops count cx down first, jcxz only looks at it
+  u16* cx = cpu->regs + (Reg_cx - Reg_ax);
+  switch (op) {
+    case Op_loop:   return --*cx != 0;
+    case Op_loopz:  return --*cx != 0 && zf;
+    case Op_loopnz: return --*cx != 0 && !zf;
+    case Op_jcxz:   return *cx == 0;
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////
+/// Execution
+// ip is moved past the instruction before anything runs, relative jumps count from there
+enum exec_result execute_instruction(struct cpu* cpu, struct address_space* memory, const struct instruction* inst) {
+  const struct operand* a = inst->operands;
+  const struct operand* b = inst->operands + 1;
+  const bool wide = inst->flags & Inst_Wide;
+
+  cpu->ip = (u16)(cpu->ip + inst->size);
+
+  switch (inst->op) {
+    case Op_mov:
+      write_operand(cpu, memory, inst, a, read_operand(cpu, memory, inst, b));
+      break;
+
+    case Op_add:
+    case Op_adc:
+    case Op_sub:
+    case Op_sbb:
+    case Op_cmp: {
+      bool subtract = inst->op == Op_sub || inst->op == Op_sbb || inst->op == Op_cmp;
+      u16 carry_in = (inst->op == Op_adc || inst->op == Op_sbb) && (cpu->flags & Flag_CF);
+      u16 result = add_sub(cpu, read_operand(cpu, memory, inst, a), read_operand(cpu, memory, inst, b), carry_in, subtract, wide, false);
+      if (inst->op != Op_cmp) {
+        write_operand(cpu, memory, inst, a, result);
+      }
+      break;
+    }
+
+    case Op_inc:
+    case Op_dec:
+      write_operand(cpu, memory, inst, a, add_sub(cpu, read_operand(cpu, memory, inst, a), 1, 0, inst->op == Op_dec, wide, true));
+      break;
+
+    case Op_neg: {
+      u16 value = read_operand(cpu, memory, inst, a);
+      write_operand(cpu, memory, inst, a, add_sub(cpu, 0, value, 0, true, wide, false));
+      break;
+    }
+
+    case Op_and:
+    case Op_or:
+    case Op_xor:
+    case Op_test: {
+      u16 result = logic(cpu, inst->op, read_operand(cpu, memory, inst, a), read_operand(cpu, memory, inst, b), wide);
+      if (inst->op != Op_test) {
+        write_operand(cpu, memory, inst, a, result);
+      }
+      break;
+    }
+
+    case Op_not:
+      write_operand(cpu, memory, inst, a, (u16)~read_operand(cpu, memory, inst, a));
+      break;
+
+    case Op_xchg: {
+      u16 value = read_operand(cpu, memory, inst, a);
+      write_operand(cpu, memory, inst, a, read_operand(cpu, memory, inst, b));
+      write_operand(cpu, memory, inst, b, value);
+      break;
+    }
+
+    case Op_push:
+      push_word(cpu, memory, read_operand(cpu, memory, inst, a));
+      break;
+
+    case Op_pop:
+      write_operand(cpu, memory, inst, a, pop_word(cpu, memory));
+      break;
+
+    case Op_pushf:
+      push_word(cpu, memory, cpu->flags);
+      break;
+
+    case Op_popf:
+      cpu->flags = pop_word(cpu, memory);
+      break;
+
+    case Op_call:
+      if (a->kind != Operand_Relative) {
+        return Exec_Unsupported;
+      }
+      push_word(cpu, memory, cpu->ip);
+      cpu->ip = (u16)(cpu->ip + a->value);
+      break;
+
+    case Op_ret:
+      cpu->ip = pop_word(cpu, memory);
+      if (a->kind == Operand_Immediate) {
+        cpu->regs[Reg_sp - Reg_ax] += (u16)a->value;
+      }
+      break;
+
+    case Op_jmp:
+      if (a->kind != Operand_Relative) {
+        return Exec_Unsupported;
+      }
+      cpu->ip = (u16)(cpu->ip + a->value);
+      break;
+
+    case Op_jo: case Op_jno: case Op_jb: case Op_jnb:
+    case Op_je: case Op_jne: case Op_jbe: case Op_ja:
+    case Op_js: case Op_jns: case Op_jp: case Op_jnp:
+    case Op_jl: case Op_jnl: case Op_jle: case Op_jg:
+    case Op_loop: case Op_loopz: case Op_loopnz: case Op_jcxz:
+      if (jump_taken(cpu, inst->op)) {
+        cpu->ip = (u16)(cpu->ip + a->value);
+      }
+      break;
+
+    case Op_clc: set_flag(cpu, Flag_CF, false); break;
+    case Op_stc: set_flag(cpu, Flag_CF, true); break;
+    case Op_cmc: set_flag(cpu, Flag_CF, !(cpu->flags & Flag_CF)); break;
+    case Op_cld: set_flag(cpu, Flag_DF, false); break;
+    case Op_std: set_flag(cpu, Flag_DF, true); break;
+    case Op_cli: set_flag(cpu, Flag_IF, false); break;
+    case Op_sti: set_flag(cpu, Flag_IF, true); break;
+
+    case Op_nop:
+      break;
+
+    case Op_hlt:
+      return Exec_Halt;
+
+    default:
+      cpu->ip = (u16)(cpu->ip - inst->size);
+      return Exec_Unsupported;
+  }
+
+  return Exec_Continue;
+}
+
+// the plain loop, one switch on op per instruction. runs until ip leaves [0, end), the program
+// stops itself or limit instructions ran, ip is left on an unsupported instruction. returns how many ran
+u64 run_switch(struct cpu* cpu, struct address_space* memory, u32 end, u64 limit, enum exec_result* result) {
+  u64 count = 0;
+  *result = Exec_Continue;
+
+  while (cpu->ip < end && count < limit) {
+    const struct instruction* inst = fetch_instruction(memory->cache, memory->bytes, physical_address(segment_register(cpu, Reg_cs), cpu->ip));
+    if (!inst) {
+      break;
+    }
+
+    *result = execute_instruction(cpu, memory, inst);
+    if (*result == Exec_Unsupported) {
+      break;
+    }
+
+    ++count;
+    if (*result == Exec_Halt) {
+      break;
+    }
+  }
+
+  return count;
+}
+
+///////////////////////////////////////////////////////////////
+/// Output
+static void format_flags(struct output_buffer* out, u16 flags) {
+  for (int bit = 0; bit < 16; ++bit) {
+    if ((flags & (1 << bit)) && flag_names[bit]) {
+      append_char(out, flag_names[bit]);
+    }
+  }
+}
+
+// only what the instruction touched, "cx:0x0->0xc8 ip:0x0->0x3 flags:->PZ"
+void format_changes(struct output_buffer* out, const struct cpu* before, const struct cpu* after) {
+  for (u8 reg = Reg_ax; reg < Reg_Count; ++reg) {
+    u16 old_value = read_register(before, reg);
+    u16 new_value = read_register(after, reg);
+    if (old_value != new_value) {
+      append_string(out, registers[reg]);
+      append_char(out, ':');
+      append_hex(out, old_value, 0);
+      append_string(out, "->");
+      append_hex(out, new_value, 0);
+      append_char(out, ' ');
+    }
+  }
+
+  append_string(out, "ip:");
+  append_hex(out, before->ip, 0);
+  append_string(out, "->");
+  append_hex(out, after->ip, 0);
+  append_char(out, ' ');
+
+  if (before->flags != after->flags) {
+    append_string(out, "flags:");
+    format_flags(out, before->flags);
+    append_string(out, "->");
+    format_flags(out, after->flags);
+    append_char(out, ' ');
+  }
+}
+
+void format_final_state(struct output_buffer* out, const struct cpu* cpu) {
+  append_string(out, "\nFinal registers:\n");
+  for (u8 reg = Reg_ax; reg < Reg_Count; ++reg) {
+    u16 value = read_register(cpu, reg);
+    if (value) {
+      append_string(out, "      ");
+      append_string(out, registers[reg]);
+      append_string(out, ": ");
+      append_hex(out, value, 4);
+      append_string(out, " (");
+      append_unsigned(out, value);
+      append_string(out, ")\n");
+    }
+  }
+
+  append_string(out, "      ip: ");
+  append_hex(out, cpu->ip, 4);
+  append_string(out, " (");
+  append_unsigned(out, cpu->ip);
+  append_string(out, ")\n");
+
+  if (cpu->flags) {
+    append_string(out, "   flags: ");
+    format_flags(out, cpu->flags);
+    append_char(out, '\n');
+  }
+}
+
+#endif // SIM_H_
@@ -0,0 +1,238 @@
+// clock_gettime for the timing, strict -std=c17 hides it otherwise
+#define _POSIX_C_SOURCE 200809L
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+
+#include "types.h"
+#include "memory.h"
+#include "decode_cache.h"
+#include "sim.h"
+#include "threaded.h"
+#include "block.h"
+#include "../harvesine/timers.h"
+
+// runs every program on every engine, checks they agree and prints millions of instructions per second
+//
+// usage: sim_bench [8086 binary ...], with no arguments only the synthetic programs run
+//        sim_bench --write dir, saves the synthetic programs as dir/register_loop.bin and so on
+
+#define BENCH_RUNS 5
+
+struct program {
+  const char* name;
+  const u8* bytes;
+  size_t size;
+};
+
+// mov dx, 100 / outer: mov cx, 0 / inner: add bx, 1 / sub ax, bx / loop inner / dec dx / jnz outer
+static const u8 register_loop[] = {
+  0xba, 0x64, 0x00, 0xb9, 0x00, 0x00, 0x83, 0xc3, 0x01, 0x29, 0xd8, 0xe2,
+  0xf9, 0x4a, 0x75, 0xf3
+};
+
+// mov dx, 200 / outer: mov cx, 1000 / mov bx, 4096 / inner: mov ax, [bx] / add ax, cx / mov [bx], ax
+// add bx, 2 / loop inner / dec dx / jnz outer
+static const u8 memory_loop[] = {
+  0xba, 0xc8, 0x00, 0xb9, 0xe8, 0x03, 0xbb, 0x00, 0x10, 0x8b, 0x07, 0x01,
+  0xc8, 0x89, 0x07, 0x83, 0xc3, 0x02, 0xe2, 0xf5, 0x4a, 0x75, 0xec
+};
+
+// mov dx, 25 / outer: mov cx, 0 / top: mov al, cl / and al, 15 / cmp al, 7 / jb skip / xor bl, al
+// add byte [bx+si+64], al / skip: sub cx, 1 / jnz top / dec dx / jnz outer
+static const u8 branch_loop[] = {
+  0xba, 0x19, 0x00, 0xb9, 0x00, 0x00, 0x88, 0xc8, 0x24, 0x0f, 0x3c, 0x07,
+  0x72, 0x05, 0x30, 0xc3, 0x00, 0x40, 0x40, 0x83, 0xe9, 0x01, 0x75, 0xee,
+  0x4a, 0x75, 0xe8
+};
+
+// mov dx, 3 / top: rep lock mov word es:[bx+256], 0x5678 / mov [10], dx / dec dx / jnz top / mov ax, [256]
+// the store rewrites the immediate of the 9 byte mov, every pass has to run what the last one wrote
+static const u8 self_modifying[] = {
+  0xba, 0x03, 0x00, 0xf3, 0xf0, 0x26, 0xc7, 0x87, 0x00, 0x01, 0x78, 0x56,
+  0x89, 0x16, 0x0a, 0x00, 0x4a, 0x75, 0xf0, 0xa1, 0x00, 0x01
+};
+
+enum engine_type {
+  Engine_Switch,
+  Engine_Threaded,
+  Engine_Blocks,
+  Engine_Count
+};
+
+static const char* engine_names[Engine_Count] = {"switch", "threaded", "blocks"};
+
+struct engines {
+  struct threaded_engine* threaded;
+  struct block_engine* blocks;
+};
+
+struct bench_result {
+  u64 instructions;
+  u64 best_time;
+  struct cpu cpu;
+  u64 memory_hash;
+  enum exec_result exit;
+};
+
+static u64 hash_memory(const u8* bytes) {
+  u64 hash = 14695981039346656037ull;
+  for (u32 i = 0; i < MEMORY_SIZE; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static struct bench_result run_engine(enum engine_type engine, const struct program* program, struct address_space* memory, struct engines* engines) {
+  struct bench_result result;
+  memset(&result, 0, sizeof(result));
+  result.best_time = ~0ull;
+
+  u32 end = program->size < MEMORY_SIZE ? (u32)program->size : MEMORY_SIZE;
+
+  for (int run = 0; run < BENCH_RUNS; ++run) {
+    // every run starts cold, the caches are part of what is measured
+    memset(memory->bytes, 0, MEMORY_SIZE);
+    memcpy(memory->bytes, program->bytes, end);
+    memset(memory->cache, 0, sizeof(struct decode_cache));
+    reset_threaded_engine(engines->threaded);
+    flush_blocks(engines->blocks);
+
+    struct cpu cpu;
+    memset(&cpu, 0, sizeof(cpu));
+
+    u64 start = read_os_timer();
+    u64 count = 0;
+    switch (engine) {
+      case Engine_Threaded: count = run_threaded(engines->threaded, &cpu, memory, end, ~0ull, &result.exit); break;
+      case Engine_Blocks:   count = run_blocks(engines->blocks, &cpu, memory, end, ~0ull, &result.exit); break;
+      default:              count = run_switch(&cpu, memory, end, ~0ull, &result.exit); break;
+    }
+    u64 elapsed = read_os_timer() - start;
+
+    if (elapsed < result.best_time) {
+      result.best_time = elapsed;
+    }
+    result.instructions = count;
+    result.cpu = cpu;
+  }
+
+  result.memory_hash = hash_memory(memory->bytes);
+  return result;
+}
+
+static bool bench_program(const struct program* program, struct address_space* memory, struct engines* engines) {
+  struct bench_result results[Engine_Count];
+  for (int engine = 0; engine < Engine_Count; ++engine) {
+    results[engine] = run_engine((enum engine_type)engine, program, memory, engines);
+  }
+
+  printf("\n--- %s ---\n", program->name);
+  printf("%-10s %14s %10s %10s %8s\n", "engine", "instructions", "best ms", "MIPS", "speedup");
+
+  f64 freq = (f64)read_os_timer_freq();
+  f64 baseline = (f64)results[Engine_Switch].best_time;
+  for (int engine = 0; engine < Engine_Count; ++engine) {
+    struct bench_result* r = results + engine;
+    f64 seconds = (f64)r->best_time / freq;
+    printf("%-10s %14lu %10.3f %10.2f %7.2fx\n", engine_names[engine], r->instructions, seconds * 1e3,
+           seconds > 0.0 ? (f64)r->instructions / seconds * 1e-6 : 0.0,
+           r->best_time ? baseline / (f64)r->best_time : 0.0);
+  }
+
+  bool match = true;
+  for (int engine = 1; engine < Engine_Count; ++engine) {
+    struct bench_result* r = results + engine;
+    if (r->instructions != results[0].instructions || r->exit != results[0].exit ||
+        r->memory_hash != results[0].memory_hash || memcmp(&r->cpu, &results[0].cpu, sizeof(struct cpu)) != 0) {
+      fprintf(stderr, "ERROR: %s engine ends in a different state than %s on %s\n", engine_names[engine], engine_names[0], program->name);
+      match = false;
+    }
+  }
+
+  if (results[0].exit == Exec_Unsupported) {
+    fprintf(stderr, "WARNING: %s stopped on an unsupported instruction at ip 0x%x\n", program->name, results[0].cpu.ip);
+  }
+
+  return match;
+}
+
+// "memory loop" goes to dir/memory_loop.bin
+static bool write_program(const struct program* program, const char* dir) {
+  char path[1024];
+  int length = snprintf(path, sizeof(path), "%s/%s.bin", dir, program->name);
+  if (length < 0 || (size_t)length >= sizeof(path)) {
+    fprintf(stderr, "ERROR: path for %s is too long\n", program->name);
+    return false;
+  }
+  for (char* c = path + strlen(dir) + 1; *c; ++c) {
+    *c = *c == ' ' ? '_' : *c;
+  }
+
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    perror("fopen for program failed\n");
+    return false;
+  }
+  bool ok = fwrite(program->bytes, program->size, 1, file) == 1;
+  ok &= fclose(file) == 0;
+  if (!ok) {
+    perror("writing program failed\n");
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[argc + 1]) {
+  struct program synthetic[] = {
+    {"register loop", register_loop, sizeof(register_loop)},
+    {"memory loop", memory_loop, sizeof(memory_loop)},
+    {"branch loop", branch_loop, sizeof(branch_loop)},
+    {"self modifying", self_modifying, sizeof(self_modifying)},
+  };
+  size_t synthetic_count = sizeof(synthetic) / sizeof(synthetic[0]);
+
+  if (argc == 3 && strcmp(argv[1], "--write") == 0) {
+    bool ok = true;
+    for (size_t i = 0; i < synthetic_count; ++i) {
+      ok &= write_program(synthetic + i, argv[2]);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  struct address_space memory;
+  memory.bytes = (u8*)calloc(MEMORY_SIZE, 1);
+  memory.cache = create_decode_cache();
+  memory.trace = NULL;
+  memory.dirty_pages = NULL;
+  memory.translated = NULL;
+  memory.translated_writes = 0;
+  struct engines engines = {create_threaded_engine(), create_block_engine()};
+  if (!memory.bytes || !memory.cache || !engines.threaded || !engines.blocks) {
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < synthetic_count; ++i) {
+    ok &= bench_program(synthetic + i, &memory, &engines);
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    struct memory image;
+    if (!init_from_file(&image, argv[i])) {
+      ok = false;
+      continue;
+    }
+
+    struct program program = {argv[i], image.data, image.size};
+    ok &= bench_program(&program, &memory, &engines);
+    free_memory(&image);
+  }
+
+  free(engines.blocks);
+  free(engines.threaded);
+  free(memory.cache);
+  free(memory.bytes);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
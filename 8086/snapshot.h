@@ -0,0 +1,297 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdbool.h"
+
+#include "types.h"
+#include "address_space.h"
+#include "decode_cache.h"
+#include "sim.h"
+
+// snapshots of the cpu and the 1 MB, for going back to a late state without running up to it again.
+// every snapshot has a page table into copies of 4 KB pages. only the pages written since the one
+// memory last matched (the last taken or restored) get copied, the rest are shared with it, and pages
+// that are all zeros aren't stored at all. restoring only touches pages that were written since, or
+// that differ between the two snapshots, so it costs the dirty pages and not the whole 1 MB.
+// the simulator is deterministic, so restoring the nearest snapshot and stepping forward lands on
+// exactly the state a full run would have had there.
+//
+// the file is the same deltas: "8086SNP1", then per snapshot
+//   u64 instruction count, struct cpu, u32 base snapshot, u16 page count,
+//   then per page u16 index (| SNAPSHOT_ZERO_PAGE with no data after it) and the 4 KB
+// struct cpu goes out as it is in memory, the files are for the build that wrote them
+#define SNAPSHOT_NONE 0xffffffffu
+#define SNAPSHOT_ZERO_PAGE 0x8000
+
+struct snapshot {
+  u64 instruction_count;
+  struct cpu cpu;
+  u32 base;          // where the unchanged pages come from, SNAPSHOT_NONE for none
+  u16 changed_count;
+  u16 changed[DIRTY_PAGE_COUNT]; // pages this one stores, with SNAPSHOT_ZERO_PAGE when it went to zeros
+  u8* storage;                   // the stored pages back to back
+  const u8* pages[DIRTY_PAGE_COUNT]; // NULL is all zeros
+};
+
+struct snapshot_log {
+  struct snapshot* snapshots;
+  u32 count;
+  u32 capacity;
+  u32 current;                  // the snapshot memory matches apart from dirty pages, SNAPSHOT_NONE before any
+  u8 dirty[DIRTY_PAGE_COUNT];   // hand to address_space.dirty_pages
+  u64 stored_pages;
+  u64 restored_pages;
+};
+
+static void init_snapshot_log(struct snapshot_log* log);
+static void free_snapshot_log(struct snapshot_log* log);
+static bool take_snapshot(struct snapshot_log* log, const struct address_space* memory, const struct cpu* cpu, u64 instruction_count);
+static u64 restore_snapshot(struct snapshot_log* log, struct address_space* memory, struct cpu* cpu, u32 index);
+static u32 find_snapshot(const struct snapshot_log* log, u64 instruction_count);
+static bool save_snapshot_log(const struct snapshot_log* log, const char* file_name);
+static bool load_snapshot_log(struct snapshot_log* log, const char* file_name);
+
+
+void init_snapshot_log(struct snapshot_log* log) {
+  memset(log, 0, sizeof(*log));
+  log->current = SNAPSHOT_NONE;
+  memset(log->dirty, 1, sizeof(log->dirty)); // nothing is known about memory yet
+}
+
+void free_snapshot_log(struct snapshot_log* log) {
+  for (u32 i = 0; i < log->count; ++i) {
+    free(log->snapshots[i].storage);
+  }
+  free(log->snapshots);
+  log->snapshots = NULL;
+  log->count = 0;
+  log->capacity = 0;
+}
+
+// a zeroed slot at the end of the log, sharing every page with base
+static struct snapshot* push_snapshot(struct snapshot_log* log, u32 base) {
+  if (log->count == log->capacity) {
+    u32 capacity = log->capacity ? log->capacity * 2 : 64;
+    struct snapshot* grown = (struct snapshot*)realloc(log->snapshots, capacity * sizeof(struct snapshot));
+    if (!grown) {
+      perror("realloc for snapshots failed\n");
+      return NULL;
+    }
+    log->snapshots = grown;
+    log->capacity = capacity;
+  }
+
+  struct snapshot* snapshot = log->snapshots + log->count;
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->base = base;
+  if (base != SNAPSHOT_NONE) {
+    memcpy(snapshot->pages, log->snapshots[base].pages, sizeof(snapshot->pages));
+  }
+  return snapshot;
+}
+
+static bool is_zero_page(const u8* page) {
+  for (u32 i = 0; i < DIRTY_PAGE_SIZE; ++i) {
+    if (page[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool take_snapshot(struct snapshot_log* log, const struct address_space* memory, const struct cpu* cpu, u64 instruction_count) {
+  struct snapshot* snapshot = push_snapshot(log, log->current);
+  if (!snapshot) {
+    return false;
+  }
+  snapshot->instruction_count = instruction_count;
+  snapshot->cpu = *cpu;
+
+  // written pages that still hold what the base has, or zeros where it had none, aren't stored
+  u32 copies = 0;
+  for (u32 page = 0; page < DIRTY_PAGE_COUNT; ++page) {
+    if (!log->dirty[page]) {
+      continue;
+    }
+
+    const u8* bytes = memory->bytes + (page << DIRTY_PAGE_BITS);
+    const u8* shared = snapshot->pages[page];
+    bool zero = is_zero_page(bytes);
+    if (shared ? memcmp(shared, bytes, DIRTY_PAGE_SIZE) == 0 : zero) {
+      continue;
+    }
+
+    snapshot->changed[snapshot->changed_count++] = (u16)(page | (zero ? SNAPSHOT_ZERO_PAGE : 0));
+    copies += zero ? 0 : 1;
+  }
+
+  if (copies) {
+    snapshot->storage = (u8*)malloc((size_t)copies * DIRTY_PAGE_SIZE);
+    if (!snapshot->storage) {
+      perror("malloc for snapshot pages failed\n");
+      return false;
+    }
+  }
+
+  u8* next = snapshot->storage;
+  for (u16 i = 0; i < snapshot->changed_count; ++i) {
+    u32 page = snapshot->changed[i] & ~SNAPSHOT_ZERO_PAGE;
+    if (snapshot->changed[i] & SNAPSHOT_ZERO_PAGE) {
+      snapshot->pages[page] = NULL;
+      continue;
+    }
+
+    memcpy(next, memory->bytes + (page << DIRTY_PAGE_BITS), DIRTY_PAGE_SIZE);
+    snapshot->pages[page] = next;
+    next += DIRTY_PAGE_SIZE;
+  }
+
+  log->stored_pages += copies;
+  log->current = log->count++;
+  memset(log->dirty, 0, sizeof(log->dirty));
+  return true;
+}
+
+// returns the snapshot's instruction count, memory is left matching it
+u64 restore_snapshot(struct snapshot_log* log, struct address_space* memory, struct cpu* cpu, u32 index) {
+  const struct snapshot* target = log->snapshots + index;
+  const struct snapshot* current = log->current != SNAPSHOT_NONE ? log->snapshots + log->current : NULL;
+
+  u32 copied = 0;
+  for (u32 page = 0; page < DIRTY_PAGE_COUNT; ++page) {
+    if (!log->dirty[page] && current && current->pages[page] == target->pages[page]) {
+      continue;
+    }
+
+    u8* bytes = memory->bytes + (page << DIRTY_PAGE_BITS);
+    if (target->pages[page]) {
+      memcpy(bytes, target->pages[page], DIRTY_PAGE_SIZE);
+    } else {
+      memset(bytes, 0, DIRTY_PAGE_SIZE);
+    }
+    ++copied;
+  }
+
+  // whatever was decoded out of the old pages is stale
+  if (copied && memory->cache) {
+    flush_decode_cache(memory->cache);
+  }
+
+  *cpu = target->cpu;
+  log->restored_pages += copied;
+  log->current = index;
+  memset(log->dirty, 0, sizeof(log->dirty));
+  return target->instruction_count;
+}
+
+// the last one taken at or before instruction_count
+u32 find_snapshot(const struct snapshot_log* log, u64 instruction_count) {
+  u32 found = SNAPSHOT_NONE;
+  for (u32 i = 0; i < log->count; ++i) {
+    const struct snapshot* snapshot = log->snapshots + i;
+    if (snapshot->instruction_count <= instruction_count &&
+        (found == SNAPSHOT_NONE || snapshot->instruction_count >= log->snapshots[found].instruction_count)) {
+      found = i;
+    }
+  }
+  return found;
+}
+
+static const char snapshot_magic[8] = {'8', '0', '8', '6', 'S', 'N', 'P', '1'};
+
+bool save_snapshot_log(const struct snapshot_log* log, const char* file_name) {
+  FILE* file = fopen(file_name, "wb");
+  if (!file) {
+    perror("fopen for snapshot file failed\n");
+    return false;
+  }
+
+  bool ok = fwrite(snapshot_magic, sizeof(snapshot_magic), 1, file) == 1;
+  for (u32 i = 0; i < log->count && ok; ++i) {
+    const struct snapshot* snapshot = log->snapshots + i;
+    ok &= fwrite(&snapshot->instruction_count, sizeof(u64), 1, file) == 1;
+    ok &= fwrite(&snapshot->cpu, sizeof(struct cpu), 1, file) == 1;
+    ok &= fwrite(&snapshot->base, sizeof(u32), 1, file) == 1;
+    ok &= fwrite(&snapshot->changed_count, sizeof(u16), 1, file) == 1;
+    for (u16 c = 0; c < snapshot->changed_count && ok; ++c) {
+      u16 changed = snapshot->changed[c];
+      ok &= fwrite(&changed, sizeof(u16), 1, file) == 1;
+      if (!(changed & SNAPSHOT_ZERO_PAGE)) {
+        ok &= fwrite(snapshot->pages[changed], DIRTY_PAGE_SIZE, 1, file) == 1;
+      }
+    }
+  }
+
+  ok &= fclose(file) == 0;
+  if (!ok) {
+    perror("writing snapshot file failed\n");
+  }
+  return ok;
+}
+
+// replaces whatever log had, memory isn't touched until a restore
+bool load_snapshot_log(struct snapshot_log* log, const char* file_name) {
+  free_snapshot_log(log);
+  init_snapshot_log(log);
+
+  FILE* file = fopen(file_name, "rb");
+  if (!file) {
+    perror("fopen for snapshot file failed\n");
+    return false;
+  }
+
+  char magic[sizeof(snapshot_magic)];
+  bool ok = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, snapshot_magic, sizeof(magic)) == 0;
+
+  u64 instruction_count;
+  while (ok && fread(&instruction_count, sizeof(u64), 1, file) == 1) {
+    struct cpu cpu;
+    u32 base;
+    u16 changed_count;
+    ok = fread(&cpu, sizeof(cpu), 1, file) == 1 && fread(&base, sizeof(u32), 1, file) == 1 &&
+         fread(&changed_count, sizeof(u16), 1, file) == 1 &&
+         (base == SNAPSHOT_NONE || base < log->count) && changed_count <= DIRTY_PAGE_COUNT;
+
+    struct snapshot* snapshot = ok ? push_snapshot(log, base) : NULL;
+    ok = snapshot && (snapshot->storage = (u8*)malloc((size_t)changed_count * DIRTY_PAGE_SIZE + 1)) != NULL;
+    if (!ok) {
+      break;
+    }
+    snapshot->instruction_count = instruction_count;
+    snapshot->cpu = cpu;
+    ++log->count; // owns storage from here on, so a failure further down still frees it
+
+    u8* next = snapshot->storage;
+    for (u16 c = 0; c < changed_count && ok; ++c) {
+      u16 changed;
+      ok = fread(&changed, sizeof(u16), 1, file) == 1 && (changed & ~SNAPSHOT_ZERO_PAGE) < DIRTY_PAGE_COUNT;
+      if (!ok) {
+        break;
+      }
+
+      u32 page = changed & ~SNAPSHOT_ZERO_PAGE;
+      snapshot->changed[snapshot->changed_count++] = changed;
+      if (changed & SNAPSHOT_ZERO_PAGE) {
+        snapshot->pages[page] = NULL;
+        continue;
+      }
+
+      ok = fread(next, DIRTY_PAGE_SIZE, 1, file) == 1;
+      snapshot->pages[page] = next;
+      next += DIRTY_PAGE_SIZE;
+      ++log->stored_pages;
+    }
+  }
+
+  fclose(file);
+  if (!ok) {
+    fprintf(stderr, "ERROR: %s is not a snapshot file or is cut short\n", file_name);
+    free_snapshot_log(log);
+  }
+  return ok;
+}
+
+#endif // SNAPSHOT_H_
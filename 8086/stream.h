@@ -0,0 +1,84 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdbool.h"
+
+#include "types.h"
+#include "memory.h"
+
+// a fixed window over a file or pipe, for inputs that shouldn't or can't be loaded whole.
+// the tail the decoder couldn't finish slides to the front before the next read, so an
+// instruction split across two reads is decoded from one piece
+#define STREAM_WINDOW_SIZE (1u << 20)
+
+struct input_stream {
+  FILE* file;
+  struct memory window; // position is where decoding stopped
+  u64 base;             // file offset of window.data[0]
+  bool eof;
+};
+
+static bool open_stream(struct input_stream* stream, const char* file_name);
+static void close_stream(struct input_stream* stream);
+static bool refill_stream(struct input_stream* stream);
+
+
+// "-" is stdin
+bool open_stream(struct input_stream* stream, const char* file_name) {
+  memset(stream, 0, sizeof(*stream));
+
+  stream->file = strcmp(file_name, "-") == 0 ? stdin : fopen(file_name, "rb");
+  if (!stream->file) {
+    perror("fopen for input file failed\n");
+    return false;
+  }
+
+  stream->window.data = (u8*)malloc(STREAM_WINDOW_SIZE);
+  if (!stream->window.data) {
+    perror("malloc for input window failed\n");
+    close_stream(stream);
+    return false;
+  }
+
+  return true;
+}
+
+void close_stream(struct input_stream* stream) {
+  if (stream->file && stream->file != stdin) {
+    fclose(stream->file);
+  }
+  free(stream->window.data);
+  stream->file = NULL;
+  stream->window.data = NULL;
+}
+
+// keeps what's left after window.position and fills up the rest, false once nothing new came in
+bool refill_stream(struct input_stream* stream) {
+  struct memory* window = &stream->window;
+  size_t left = window->size - window->position;
+  memmove(window->data, window->data + window->position, left);
+  stream->base += window->position;
+  window->position = 0;
+  window->size = left;
+
+  if (stream->eof) {
+    return false;
+  }
+
+  // fread keeps going on a pipe until the window is full or the writer is done
+  size_t read = fread(window->data + left, 1, STREAM_WINDOW_SIZE - left, stream->file);
+  window->size += read;
+  if (read < STREAM_WINDOW_SIZE - left) {
+    if (ferror(stream->file)) {
+      perror("reading input file failed\n");
+    }
+    stream->eof = true;
+  }
+
+  return read > 0;
+}
+
+#endif // STREAM_H_
@@ -0,0 +1,328 @@
+#ifndef THREADED_H_
+#define THREADED_H_
+
+#include "stdlib.h"
+#include "string.h"
+
+#include "types.h"
+#include "opcodes.h"
+#include "instruction.h"
+#include "decode_cache.h"
+#include "sim.h"
+
+// Threaded dispatch: every cached instruction carries the address of its own handler, and every
+// handler ends by jumping straight to the next one's, so there is no central switch for the branch
+// predictor to get wrong. Handlers are specialized per (op, operand shape, width) by the macros
+// below, anything else goes through execute_instruction. Needs computed goto (gcc, clang).
+
+// operand shapes with their own handlers, register, immediate and memory destination/source
+#define THREADED_SHAPES(M, op) \
+  M(op, RR, 0) M(op, RR, 1) M(op, RI, 0) M(op, RI, 1) M(op, RM, 0) M(op, RM, 1) \
+  M(op, MR, 0) M(op, MR, 1) M(op, MI, 0) M(op, MI, 1)
+
+#define THREADED_SHAPE_COUNT 5
+
+#define THREADED_ALU_OPS(M) \
+  THREADED_SHAPES(M, Op_mov) \
+  THREADED_SHAPES(M, Op_add) \
+  THREADED_SHAPES(M, Op_sub) \
+  THREADED_SHAPES(M, Op_cmp) \
+  THREADED_SHAPES(M, Op_and) \
+  THREADED_SHAPES(M, Op_or)  \
+  THREADED_SHAPES(M, Op_xor)
+
+#define THREADED_INC_DEC(M) M(Op_inc, 0) M(Op_inc, 1) M(Op_dec, 0) M(Op_dec, 1)
+
+#define THREADED_JUMPS(M) \
+  M(Op_jo) M(Op_jno) M(Op_jb) M(Op_jnb) M(Op_je) M(Op_jne) M(Op_jbe) M(Op_ja) \
+  M(Op_js) M(Op_jns) M(Op_jp) M(Op_jnp) M(Op_jl) M(Op_jnl) M(Op_jle) M(Op_jg) \
+  M(Op_loop) M(Op_loopz) M(Op_loopnz) M(Op_jcxz)
+
+#define THREADED_ALU_ID(op, shape, wide) Handler_##op##_##shape##_##wide,
+#define THREADED_INC_DEC_ID(op, wide) Handler_##op##_R_##wide,
+#define THREADED_JUMP_ID(op) Handler_##op,
+
+// the label table in run_threaded is generated from the same lists in the same order
+enum threaded_handler {
+  Handler_Generic,
+  Handler_jmp,
+  THREADED_INC_DEC(THREADED_INC_DEC_ID)
+  THREADED_JUMPS(THREADED_JUMP_ID)
+  THREADED_ALU_OPS(THREADED_ALU_ID)
+  Handler_Count
+};
+
+enum threaded_shape {
+  Shape_RR,
+  Shape_RI,
+  Shape_RM,
+  Shape_MR,
+  Shape_MI,
+};
+
+// an instruction with its handler and operands resolved, in a slot parallel to the decode cache's
+struct threaded_op {
+  u16 handler;    // enum threaded_handler, Handler_Count while empty
+  u16 imm;        // immediate or jump displacement
+  u32 generation; // decode cache generation it was built in
+  u8 dst;         // byte offset into cpu.regs of a register destination
+  u8 src;         // byte offset into cpu.regs of a register source
+  struct instruction inst;
+};
+
+struct threaded_engine {
+  struct threaded_op ops[DECODE_CACHE_SIZE];
+  struct threaded_op scratch; // for instructions the decode cache won't keep
+};
+
+static struct threaded_engine* create_threaded_engine(void);
+static void reset_threaded_engine(struct threaded_engine* engine);
+static u64 run_threaded(struct threaded_engine* engine, struct cpu* cpu, struct address_space* memory, u32 end, u64 limit, enum exec_result* result);
+
+
+struct threaded_engine* create_threaded_engine(void) {
+  struct threaded_engine* engine = (struct threaded_engine*)malloc(sizeof(struct threaded_engine));
+  if (!engine) {
+    perror("malloc for threaded engine failed\n");
+    return NULL;
+  }
+
+  reset_threaded_engine(engine);
+  return engine;
+}
+
+// translations are only good for the decode cache they came from, a new program needs a reset
+void reset_threaded_engine(struct threaded_engine* engine) {
+  for (u32 i = 0; i < DECODE_CACHE_SIZE; ++i) {
+    engine->ops[i].handler = Handler_Count;
+  }
+}
+
+// byte registers are the low or high half of their word, the host has to be little endian
+static u8 register_offset(u8 reg) {
+  if (reg >= Reg_ax) {
+    return (u8)((reg - Reg_ax) * sizeof(u16));
+  }
+  return (u8)((reg & 0b11) * sizeof(u16) + (reg >> 2));
+}
+
+static int threaded_alu_slot(u8 op) {
+  switch (op) {
+    case Op_mov: return 0;
+    case Op_add: return 1;
+    case Op_sub: return 2;
+    case Op_cmp: return 3;
+    case Op_and: return 4;
+    case Op_or:  return 5;
+    case Op_xor: return 6;
+    default:     return -1;
+  }
+}
+
+static int threaded_shape(const struct instruction* inst) {
+  u8 a = inst->operands[0].kind;
+  u8 b = inst->operands[1].kind;
+  if (a == Operand_Register && inst->operands[0].reg >= Reg_es) return -1; // segment registers stay generic
+  if (b == Operand_Register && inst->operands[1].reg >= Reg_es) return -1;
+
+  if (a == Operand_Register && b == Operand_Register)  return Shape_RR;
+  if (a == Operand_Register && b == Operand_Immediate) return Shape_RI;
+  if (a == Operand_Register && b == Operand_Memory)    return Shape_RM;
+  if (a == Operand_Memory && b == Operand_Register)    return Shape_MR;
+  if (a == Operand_Memory && b == Operand_Immediate)   return Shape_MI;
+  return -1;
+}
+
+static u16 pick_handler(const struct instruction* inst) {
+  const u8 op = inst->op;
+  const int wide = (inst->flags & Inst_Wide) ? 1 : 0;
+  const struct operand* a = inst->operands;
+
+  if (op == Op_jmp && a->kind == Operand_Relative) {
+    return Handler_jmp;
+  }
+
+  if ((op == Op_inc || op == Op_dec) && a->kind == Operand_Register) {
+    return (u16)((op == Op_inc ? Handler_Op_inc_R_0 : Handler_Op_dec_R_0) + wide);
+  }
+
+  if (a->kind == Operand_Relative) {
+    switch (op) {
+#define THREADED_JUMP_CASE(jump) case jump: return Handler_##jump;
+      THREADED_JUMPS(THREADED_JUMP_CASE)
+#undef THREADED_JUMP_CASE
+      default: break;
+    }
+  }
+
+  int slot = threaded_alu_slot(op);
+  int shape = threaded_shape(inst);
+  if (slot >= 0 && shape >= 0) {
+    return (u16)(Handler_Op_mov_RR_0 + (slot * THREADED_SHAPE_COUNT + shape) * 2 + wide);
+  }
+
+  return Handler_Generic;
+}
+
+static bool translate(struct threaded_engine* engine, struct address_space* memory, u32 address, struct threaded_op** slot) {
+  const struct instruction* inst = fetch_instruction(memory->cache, memory->bytes, address);
+  if (!inst) {
+    return false;
+  }
+
+  // the decode cache didn't keep it, so neither can we
+  struct threaded_op* op = (inst == &memory->cache->uncached) ? &engine->scratch : *slot;
+
+  op->inst = *inst;
+  op->handler = pick_handler(inst);
+  op->generation = memory->cache->generation;
+  op->dst = 0;
+  op->src = 0;
+  op->imm = 0;
+
+  const struct operand* a = inst->operands;
+  const struct operand* b = inst->operands + 1;
+  if (a->kind == Operand_Register) op->dst = register_offset(a->reg);
+  if (b->kind == Operand_Register) op->src = register_offset(b->reg);
+  if (b->kind == Operand_Immediate) op->imm = (u16)b->value;
+  if (a->kind == Operand_Relative) op->imm = (u16)a->value;
+
+  *slot = op;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////
+/// Handler bodies, pasted together by the lists above
+#define REG_LOAD(offset, wide) ((wide) ? *(u16*)(regs + (offset)) : regs[offset])
+#define REG_STORE(offset, wide, value) \
+  do { if (wide) *(u16*)(regs + (offset)) = (u16)(value); else regs[offset] = (u8)(value); } while (0)
+
+#define SHAPE_ADDRESS_RR 0
+#define SHAPE_ADDRESS_RI 0
+#define SHAPE_ADDRESS_RM memory_address(cpu, &op->inst, op->inst.operands + 1)
+#define SHAPE_ADDRESS_MR memory_address(cpu, &op->inst, op->inst.operands)
+#define SHAPE_ADDRESS_MI memory_address(cpu, &op->inst, op->inst.operands)
+
+#define SHAPE_DST_RR(wide) REG_LOAD(op->dst, wide)
+#define SHAPE_DST_RI(wide) REG_LOAD(op->dst, wide)
+#define SHAPE_DST_RM(wide) REG_LOAD(op->dst, wide)
+#define SHAPE_DST_MR(wide) read_memory(memory, address, wide)
+#define SHAPE_DST_MI(wide) read_memory(memory, address, wide)
+
+#define SHAPE_SRC_RR(wide) REG_LOAD(op->src, wide)
+#define SHAPE_SRC_RI(wide) op->imm
+#define SHAPE_SRC_RM(wide) read_memory(memory, address, wide)
+#define SHAPE_SRC_MR(wide) REG_LOAD(op->src, wide)
+#define SHAPE_SRC_MI(wide) op->imm
+
+#define SHAPE_STORE_RR(wide, value) REG_STORE(op->dst, wide, value)
+#define SHAPE_STORE_RI(wide, value) REG_STORE(op->dst, wide, value)
+#define SHAPE_STORE_RM(wide, value) REG_STORE(op->dst, wide, value)
+#define SHAPE_STORE_MR(wide, value) write_memory(memory, address, value, wide)
+#define SHAPE_STORE_MI(wide, value) write_memory(memory, address, value, wide)
+
+#define ALU_Op_mov(a, b, wide) (b)
+#define ALU_Op_add(a, b, wide) add_sub(cpu, a, b, 0, false, wide, false)
+#define ALU_Op_sub(a, b, wide) add_sub(cpu, a, b, 0, true, wide, false)
+#define ALU_Op_cmp(a, b, wide) add_sub(cpu, a, b, 0, true, wide, false)
+#define ALU_Op_and(a, b, wide) logic(cpu, Op_and, a, b, wide)
+#define ALU_Op_or(a, b, wide)  logic(cpu, Op_or, a, b, wide)
+#define ALU_Op_xor(a, b, wide) logic(cpu, Op_xor, a, b, wide)
+
+#define ALU_WRITES_Op_mov 1
+#define ALU_WRITES_Op_add 1
+#define ALU_WRITES_Op_sub 1
+#define ALU_WRITES_Op_cmp 0
+#define ALU_WRITES_Op_and 1
+#define ALU_WRITES_Op_or  1
+#define ALU_WRITES_Op_xor 1
+
+// parameters are called name so they can't collide with the op variable inside the bodies
+#define THREADED_ALU_LABEL(name, shape, wide) &&name##_##shape##_##wide,
+#define THREADED_INC_DEC_LABEL(name, wide) &&name##_R_##wide,
+#define THREADED_JUMP_LABEL(name) &&name##_,
+
+#define THREADED_ALU_HANDLER(name, shape, wide) \
+  name##_##shape##_##wide: { \
+    u32 address = SHAPE_ADDRESS_##shape; \
+    (void)address; \
+    u16 result = ALU_##name(SHAPE_DST_##shape(wide), SHAPE_SRC_##shape(wide), wide); \
+    if (ALU_WRITES_##name) { \
+      SHAPE_STORE_##shape(wide, result); \
+    } \
+    DISPATCH(); \
+  }
+
+#define THREADED_INC_DEC_HANDLER(name, wide) \
+  name##_R_##wide: \
+    REG_STORE(op->dst, wide, add_sub(cpu, REG_LOAD(op->dst, wide), 1, 0, name == Op_dec, wide, true)); \
+    DISPATCH();
+
+#define THREADED_JUMP_HANDLER(name) \
+  name##_: \
+    if (jump_taken(cpu, name)) { \
+      cpu->ip = (u16)(cpu->ip + op->imm); \
+    } \
+    DISPATCH();
+
+// fetch, count and jump, pasted at the end of every handler so each one has its own indirect branch
+#define DISPATCH() \
+  do { \
+    if (cpu->ip >= end || count >= limit) goto done; \
+    u32 next = physical_address(cpu->regs[Reg_cs - Reg_ax], cpu->ip); \
+    op = engine->ops + (next & DECODE_CACHE_MASK); \
+    if (op->handler == Handler_Count || op->inst.address != next || op->generation != memory->cache->generation) { \
+      if (!translate(engine, memory, next, &op)) goto done; \
+    } \
+    ++count; \
+    cpu->ip = (u16)(cpu->ip + op->inst.size); \
+    goto *labels[op->handler]; \
+  } while (0)
+
+// same contract as run_switch, the results have to match it exactly
+u64 run_threaded(struct threaded_engine* engine, struct cpu* cpu, struct address_space* memory, u32 end, u64 limit, enum exec_result* result) {
+  static void* const labels[Handler_Count] = {
+    &&generic,
+    &&jmp,
+    THREADED_INC_DEC(THREADED_INC_DEC_LABEL)
+    THREADED_JUMPS(THREADED_JUMP_LABEL)
+    THREADED_ALU_OPS(THREADED_ALU_LABEL)
+  };
+
+  u64 count = 0;
+  u8* regs = (u8*)cpu->regs;
+  struct threaded_op* op = NULL;
+  *result = Exec_Continue;
+
+  DISPATCH();
+
+generic:
+  // execute_instruction moves ip itself
+  cpu->ip = (u16)(cpu->ip - op->inst.size);
+  *result = execute_instruction(cpu, memory, &op->inst);
+  if (*result == Exec_Unsupported) {
+    --count;
+    goto done;
+  }
+  if (*result == Exec_Halt) {
+    goto done;
+  }
+  DISPATCH();
+
+jmp:
+  cpu->ip = (u16)(cpu->ip + op->imm);
+  DISPATCH();
+
+  THREADED_INC_DEC(THREADED_INC_DEC_HANDLER)
+  THREADED_JUMPS(THREADED_JUMP_HANDLER)
+  THREADED_ALU_OPS(THREADED_ALU_HANDLER)
+
+done:
+  return count;
+}
+
+#undef DISPATCH
+#undef REG_LOAD
+#undef REG_STORE
+
+#endif // THREADED_H_
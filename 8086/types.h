@@ -1,10 +1,10 @@
 #ifndef TYPES_H
 #define TYPES_H
 
-typedef uint8_t  u8;
-typedef int8_t   i8;
-typedef int16_t  i16;
-typedef uint16_t u16;
+// the integer and float names are the harvesine ones, so code from both halves can share a program
+#include "../harvesine/types.h"
 
-#endif // #define TYPES_H
+// the headers are shared by every program here, a helper one of them doesn't call is fine
+#define MAYBE_UNUSED __attribute__((unused))
 
+#endif // #define TYPES_H
@@ -0,0 +1,106 @@
+#ifndef _ARENA_HPP_
+#define _ARENA_HPP_
+
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "types.h"
+#include "profiler.hpp"
+
+// only address space, pages are committed when pushes reach them
+#define ARENA_DEFAULT_RESERVE (64ull * 1024 * 1024 * 1024)
+#define ARENA_COMMIT_GRANULARITY (1024ull * 1024)
+
+struct Arena {
+  u8* base;
+  u64 reserved;
+  u64 committed;
+  u64 used;
+  u64 peak_committed;
+};
+
+#define arena_push_array(Arena, Type, Count) (Type*)arena_push((Arena), sizeof(Type) * (Count), alignof(Type))
+#define arena_push_struct(Arena, Type) arena_push_array(Arena, Type, 1)
+
+[[maybe_unused]] static bool arena_init(Arena* arena, u64 reserve = ARENA_DEFAULT_RESERVE) {
+  *arena = {};
+
+  void* base = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    perror("mmap arena reserve");
+    return false;
+  }
+
+  arena->base = (u8*)base;
+  arena->reserved = reserve;
+
+  return true;
+}
+
+static bool arena_commit(Arena* arena, u64 size) {
+  u64 commit_size = (size + ARENA_COMMIT_GRANULARITY - 1) & ~(ARENA_COMMIT_GRANULARITY - 1);
+  if (commit_size > arena->reserved) {
+    commit_size = arena->reserved;
+  }
+
+  if (commit_size > arena->committed) {
+    if (mprotect(arena->base + arena->committed, commit_size - arena->committed, PROT_READ | PROT_WRITE) != 0) {
+      perror("mprotect arena commit");
+      return false;
+    }
+
+    ProfileCommit(commit_size - arena->committed);
+    arena->committed = commit_size;
+
+    if (arena->peak_committed < arena->committed) {
+      arena->peak_committed = arena->committed;
+    }
+  }
+
+  return true;
+}
+
+static void* arena_push(Arena* arena, u64 size, u64 alignment = 8) {
+  u64 begin = (arena->used + alignment - 1) & ~(alignment - 1);
+  u64 end = begin + size;
+
+  if (end > arena->committed) {
+    if (end > arena->reserved || !arena_commit(arena, end)) {
+      fprintf(stderr, "ERROR: arena out of memory, %lu bytes requested with %lu used\n", size, arena->used);
+      return nullptr;
+    }
+  }
+
+  arena->used = end;
+  return arena->base + begin;
+}
+
+// rewinds without giving the pages back, for repeating work on the same memory
+[[maybe_unused]] static void arena_pop_to(Arena* arena, u64 used) {
+  if (used < arena->used) {
+    arena->used = used;
+  }
+}
+
+// frees everything at once, pages go back to the os but the reservation stays
+[[maybe_unused]] static void arena_reset(Arena* arena) {
+  if (arena->committed) {
+    madvise(arena->base, arena->committed, MADV_DONTNEED);
+    mprotect(arena->base, arena->committed, PROT_NONE);
+    ProfileCommit(-(i64)arena->committed);
+  }
+
+  arena->committed = 0;
+  arena->used = 0;
+}
+
+[[maybe_unused]] static void arena_release(Arena* arena) {
+  if (arena->base) {
+    ProfileCommit(-(i64)arena->committed);
+    munmap(arena->base, arena->reserved);
+  }
+
+  *arena = {};
+}
+
+#endif // _ARENA_HPP_
@@ -0,0 +1,644 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "repetition_tester.hpp"
+#include "pipeline.hpp"
+#include "dispatch.hpp"
+#include "endpoint_cache.hpp"
+
+///////////////////////////////////////////////////////////////
+/// Everything is loaded and prepared once, every bench only runs its own stage
+struct BenchData {
+  Buffer buffer;
+
+  TokenItem* tokens;
+  u64 tokens_size;
+  u64 token_bytes;
+
+  Coords* pairs;
+  u64 pairs_count;
+
+  // the pairs again as structure of arrays, what the haversine kernels take
+  f64* x0;
+  f64* y0;
+  f64* x1;
+  f64* y1;
+  f64* distances;
+
+  // and narrowed for the f32 kernels
+  f32* x0_f32;
+  f32* y0_f32;
+  f32* x1_f32;
+  f32* y1_f32;
+  f32* distances_f32;
+
+  Arena arena;
+  Arena scratch; // lexer and parser output while benchmarking, rewound after every run
+
+  f64 sink; // results go here so the compiler can't drop the work
+};
+
+typedef f64 parse_number_func(const struct Buffer* const buffer, const u64 begin, const u64 end);
+
+struct ParseNumberBench {
+  BenchData* data;
+  parse_number_func* func;
+};
+
+struct LexerBench {
+  BenchData* data;
+  lexer_func* func;
+};
+
+struct HaversineBench {
+  BenchData* data;
+  haversine_func* func;
+};
+
+struct HaversineF32Bench {
+  BenchData* data;
+  haversine_f32_func* func;
+};
+
+struct EndpointCacheBench {
+  BenchData* data;
+  EndpointCache* cache;
+  haversine_cached_func* cached;
+  haversine_func* plain; // what the pairs go to once the cache gives up
+};
+
+struct SummationBench {
+  BenchData* data;
+  sum_values_func* func; // null for the superaccumulator one value at a time
+  SumMode mode;
+};
+
+///////////////////////////////////////////////////////////////
+/// Bench functions
+static void bench_lexer(RepTester *tester, void *context) {
+  LexerBench* bench = (LexerBench*)context;
+  BenchData* data = bench->data;
+  while (is_testing(tester)) {
+    TokenItem* tokens = nullptr;
+
+    begin_time(tester);
+    u64 tokens_size = bench->func(&data->buffer, &data->scratch, &tokens);
+    end_time(tester);
+
+    arena_pop_to(&data->scratch, 0);
+
+    count_bytes(tester, data->buffer.size);
+    if (tokens_size != data->tokens_size) {
+      error(tester, "lexer token count mismatch");
+    }
+  }
+}
+
+static void bench_parser(RepTester *tester, void *context) {
+  BenchData* data = (BenchData*)context;
+  while (is_testing(tester)) {
+    Coords* pairs = nullptr;
+
+    begin_time(tester);
+    u64 pairs_count = parser(&data->buffer, data->tokens, data->tokens_size, &data->scratch, &pairs);
+    end_time(tester);
+
+    arena_pop_to(&data->scratch, 0);
+
+    count_bytes(tester, data->buffer.size);
+    if (pairs_count != data->pairs_count) {
+      error(tester, "parser pairs count mismatch");
+    }
+  }
+}
+
+static void bench_parse_number(RepTester *tester, void *context) {
+  ParseNumberBench* bench = (ParseNumberBench*)context;
+  BenchData* data = bench->data;
+  while (is_testing(tester)) {
+    f64 sum = 0.0;
+
+    begin_time(tester);
+    for (u64 i = 0; i < data->tokens_size; ++i) {
+      sum += bench->func(&data->buffer, data->tokens[i].begin, data->tokens[i].end);
+    }
+    end_time(tester);
+
+    count_bytes(tester, data->token_bytes);
+    data->sink += sum;
+  }
+}
+
+static void bench_reference_haversine(RepTester *tester, void *context) {
+  BenchData* data = (BenchData*)context;
+  while (is_testing(tester)) {
+    f64 sum = 0.0;
+
+    begin_time(tester);
+    for (u64 i = 0; i < data->pairs_count; ++i) {
+      Coords* pair = data->pairs + i;
+      sum += reference_haversine(pair->a, pair->b, pair->c, pair->d, EARTH_RADIUS);
+    }
+    end_time(tester);
+
+    count_bytes(tester, data->pairs_count * sizeof(Coords));
+    data->sink += sum;
+  }
+}
+
+static void bench_haversine_kernel(RepTester *tester, void *context) {
+  HaversineBench* bench = (HaversineBench*)context;
+  BenchData* data = bench->data;
+  while (is_testing(tester)) {
+    begin_time(tester);
+    bench->func(data->x0, data->y0, data->x1, data->y1, data->pairs_count, EARTH_RADIUS, data->distances);
+    end_time(tester);
+
+    count_bytes(tester, data->pairs_count * sizeof(Coords));
+    data->sink += data->distances[data->pairs_count / 2];
+  }
+}
+
+static void bench_haversine_f32(RepTester *tester, void *context) {
+  HaversineF32Bench* bench = (HaversineF32Bench*)context;
+  BenchData* data = bench->data;
+  while (is_testing(tester)) {
+    begin_time(tester);
+    bench->func(data->x0_f32, data->y0_f32, data->x1_f32, data->y1_f32, data->pairs_count, (f32)EARTH_RADIUS, data->distances_f32);
+    end_time(tester);
+
+    count_bytes(tester, data->pairs_count * 4 * sizeof(f32));
+    data->sink += data->distances_f32[data->pairs_count / 2];
+  }
+}
+
+static void bench_summation(RepTester *tester, void *context) {
+  SummationBench* bench = (SummationBench*)context;
+  BenchData* data = bench->data;
+  while (is_testing(tester)) {
+    f64 result;
+    if (bench->func) {
+      Summation sum;
+      sum_init(&sum, bench->mode);
+
+      begin_time(tester);
+      bench->func(&sum, data->distances, data->pairs_count);
+      result = sum_result(&sum);
+      end_time(tester);
+    } else {
+      SuperAccumulator acc;
+      super_init(&acc);
+
+      begin_time(tester);
+      for (u64 i = 0; i < data->pairs_count; ++i) {
+        super_add(&acc, data->distances[i]);
+      }
+      result = super_round(&acc);
+      end_time(tester);
+    }
+
+    count_bytes(tester, data->pairs_count * sizeof(f64));
+    data->sink += result;
+  }
+}
+
+// the pre-pass and the kernel a batch at a time like the library runs them, from an empty table
+#define ENDPOINT_BATCH_SIZE 1024
+
+static void endpoint_cache_pass(BenchData* data, EndpointCache* cache, haversine_cached_func* cached, haversine_func* plain) {
+  f64 cosines[2][ENDPOINT_BATCH_SIZE];
+
+  endpoint_cache_init(cache);
+  for (u64 i = 0; i < data->pairs_count; i += ENDPOINT_BATCH_SIZE) {
+    u64 batch = data->pairs_count - i < ENDPOINT_BATCH_SIZE ? data->pairs_count - i : ENDPOINT_BATCH_SIZE;
+    if (endpoint_cache_pays_off(cache)) {
+      endpoint_cosines(cache, data->y0 + i, data->y1 + i, batch, cosines[0], cosines[1]);
+      cached(data->x0 + i, data->y0 + i, data->x1 + i, data->y1 + i, cosines[0], cosines[1], batch, EARTH_RADIUS, data->distances + i);
+    } else {
+      plain(data->x0 + i, data->y0 + i, data->x1 + i, data->y1 + i, batch, EARTH_RADIUS, data->distances + i);
+      cache->skipped += batch;
+    }
+  }
+}
+
+static void bench_endpoint_cache(RepTester *tester, void *context) {
+  EndpointCacheBench* bench = (EndpointCacheBench*)context;
+  BenchData* data = bench->data;
+  while (is_testing(tester)) {
+    begin_time(tester);
+    endpoint_cache_pass(data, bench->cache, bench->cached, bench->plain);
+    end_time(tester);
+
+    count_bytes(tester, data->pairs_count * sizeof(Coords));
+    data->sink += data->distances[data->pairs_count / 2];
+  }
+}
+
+///////////////////////////////////////////////////////////////
+/// Summing on threads, fixed size chunks merged in order
+#define SUM_CHUNK_SIZE (16 * 1024)
+
+struct SumChunks {
+  const f64* values;
+  u64 count;
+  SumMode mode;
+  sum_values_func* func;
+  Summation* chunks;
+  u32 chunks_count;
+  u32 next_chunk;
+};
+
+static void* sum_chunks_thread(void* context) {
+  SumChunks* work = (SumChunks*)context;
+  for (;;) {
+    u32 chunk = __atomic_fetch_add(&work->next_chunk, 1, __ATOMIC_RELAXED);
+    if (chunk >= work->chunks_count) {
+      return NULL;
+    }
+
+    u64 begin = (u64)chunk * SUM_CHUNK_SIZE;
+    u64 count = work->count - begin < SUM_CHUNK_SIZE ? work->count - begin : SUM_CHUNK_SIZE;
+    sum_init(work->chunks + chunk, work->mode);
+    work->func(work->chunks + chunk, work->values + begin, count);
+  }
+}
+
+// whichever thread takes a chunk, the chunks and the merge order are the same
+static f64 sum_on_threads(Arena* scratch, const f64* values, u64 count, SumMode mode, sum_values_func* func, u32 threads_count) {
+  SumChunks work = {values, count, mode, func};
+  work.chunks_count = (u32)((count + SUM_CHUNK_SIZE - 1) / SUM_CHUNK_SIZE);
+  work.chunks = arena_push_array(scratch, Summation, work.chunks_count);
+
+  pthread_t threads[8];
+  for (u32 i = 0; i < threads_count; ++i) {
+    pthread_create(threads + i, NULL, sum_chunks_thread, &work);
+  }
+  for (u32 i = 0; i < threads_count; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  Summation total;
+  sum_init(&total, mode);
+  for (u32 i = 0; i < work.chunks_count; ++i) {
+    sum_merge(&total, work.chunks + i);
+  }
+
+  arena_pop_to(scratch, 0);
+  return sum_result(&total);
+}
+
+///////////////////////////////////////////////////////////////
+/// Every variant is checked against the scalar kernel before it is timed
+static bool check_kernels(BenchData* data, const Kernels* kernels) {
+  bool ok = true;
+
+  TokenItem* tokens = nullptr;
+  u64 tokens_size = kernels->lexer(&data->buffer, &data->scratch, &tokens);
+  if (tokens_size != data->tokens_size || memcmp(tokens, data->tokens, tokens_size * sizeof(TokenItem)) != 0) {
+    fprintf(stderr, "ERROR: %s tokens differ from lexer\n", kernels->lexer_name);
+    ok = false;
+  }
+  arena_pop_to(&data->scratch, 0);
+
+  for (u64 i = 0; i < data->tokens_size; ++i) {
+    f64 expected = parse_number_fast(&data->buffer, data->tokens[i].begin, data->tokens[i].end);
+    f64 parsed = kernels->parse_number(&data->buffer, data->tokens[i].begin, data->tokens[i].end);
+    if (memcmp(&expected, &parsed, sizeof(f64)) != 0) {
+      fprintf(stderr, "ERROR: %s gives %.17g for token %lu, parse_number_fast %.17g\n", kernels->parse_number_name, parsed, i, expected);
+      ok = false;
+      break;
+    }
+  }
+
+  // every level runs the same polynomials without fma, so the distances are the bits of haversine_scalar.
+  // against libm the polynomials may be off in the last few bits, anything more is a bug
+  f64* expected_distances = arena_push_array(&data->scratch, f64, data->pairs_count);
+  haversine_scalar(data->x0, data->y0, data->x1, data->y1, data->pairs_count, EARTH_RADIUS, expected_distances);
+  kernels->haversine(data->x0, data->y0, data->x1, data->y1, data->pairs_count, EARTH_RADIUS, data->distances);
+  if (memcmp(expected_distances, data->distances, data->pairs_count * sizeof(f64)) != 0) {
+    fprintf(stderr, "ERROR: %s differs from haversine_scalar\n", kernels->haversine_name);
+    ok = false;
+  }
+  arena_pop_to(&data->scratch, 0);
+
+  f64 max_error = 0.0;
+  for (u64 i = 0; i < data->pairs_count; ++i) {
+    Coords* pair = data->pairs + i;
+    f64 expected = reference_haversine(pair->a, pair->b, pair->c, pair->d, EARTH_RADIUS);
+    f64 error = fabs(data->distances[i] - expected) / (expected > 0.0 ? expected : 1.0);
+    max_error = error > max_error ? error : max_error;
+  }
+  if (max_error > 1e-12) {
+    fprintf(stderr, "ERROR: %s is off from reference_haversine by %g relative\n", kernels->haversine_name, max_error);
+    ok = false;
+  }
+
+  return ok;
+}
+
+// every width has to give the bits of the baseline loop, however the values are split into calls and
+// across threads, and the exact mode the bits of the superaccumulator fed one value at a time
+static bool check_summation(BenchData* data, const Kernels* kernels) {
+  bool ok = true;
+
+  SuperAccumulator acc;
+  super_init(&acc);
+  for (u64 i = 0; i < data->pairs_count; ++i) {
+    super_add(&acc, data->distances[i]);
+  }
+  f64 exact = super_round(&acc);
+
+  for (u32 mode = 0; mode < SumMode_Count; ++mode) {
+    Summation sum;
+    sum_init(&sum, (SumMode)mode);
+    sum_values(&sum, data->distances, data->pairs_count);
+    f64 expected = sum_result(&sum);
+
+    if (mode == SumMode_Exact && memcmp(&expected, &exact, sizeof(f64)) != 0) {
+      fprintf(stderr, "ERROR: exact summation gives %.17g, the superaccumulator %.17g\n", expected, exact);
+      ok = false;
+    }
+
+    // odd sized pieces, so every lane and leaf boundary is crossed somewhere
+    sum_init(&sum, (SumMode)mode);
+    for (u64 i = 0, step = 1; i < data->pairs_count; i += step, step = step * 3 % 1021 + 1) {
+      u64 count = data->pairs_count - i < step ? data->pairs_count - i : step;
+      kernels->sum_values(&sum, data->distances + i, count);
+    }
+    f64 split = sum_result(&sum);
+    if (memcmp(&expected, &split, sizeof(f64)) != 0) {
+      fprintf(stderr, "ERROR: %s %s gives %.17g in pieces, %.17g at once\n", kernels->sum_values_name, sum_mode_names[mode], split, expected);
+      ok = false;
+    }
+
+    f64 chunked = sum_on_threads(&data->scratch, data->distances, data->pairs_count, (SumMode)mode, sum_values, 1);
+    for (u32 threads = 2; threads <= 4; threads *= 2) {
+      f64 threaded = sum_on_threads(&data->scratch, data->distances, data->pairs_count, (SumMode)mode, kernels->sum_values, threads);
+      if (memcmp(&chunked, &threaded, sizeof(f64)) != 0) {
+        fprintf(stderr, "ERROR: %s %s gives %.17g on %u threads, %.17g on one\n", kernels->sum_values_name, sum_mode_names[mode], threaded, threads, chunked);
+        ok = false;
+      }
+    }
+    if (mode == SumMode_Exact && memcmp(&chunked, &exact, sizeof(f64)) != 0) {
+      fprintf(stderr, "ERROR: exact summation gives %.17g in chunks, the superaccumulator %.17g\n", chunked, exact);
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////
+static void run_group(RepRunner* runner, const char* name) {
+  printf("\n--- %s ---\n", name);
+  run_interleaved(runner);
+  print_ranked_summary(runner);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s [coords json]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  FILE* input = fopen(argv[1], "rb");
+  if (input == NULL) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  struct stat input_stat;
+  stat(argv[1], &input_stat);
+
+  BenchData data = {};
+  if (!arena_init(&data.arena) || !arena_init(&data.scratch)) {
+    return EXIT_FAILURE;
+  }
+
+  data.buffer.size = input_stat.st_size;
+  data.buffer.data = arena_push_array(&data.arena, u8, data.buffer.size + 1);
+  if (fread(data.buffer.data, data.buffer.size, 1, input) != 1) {
+    fprintf(stderr, "ERROR: Unable to read %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  data.buffer.data[data.buffer.size] = 0;
+  fclose(input);
+
+  data.tokens_size = lexer(&data.buffer, &data.arena, &data.tokens);
+  data.pairs_count = parser(&data.buffer, data.tokens, data.tokens_size, &data.arena, &data.pairs);
+  for (u64 i = 0; i < data.tokens_size; ++i) {
+    data.token_bytes += data.tokens[i].end - data.tokens[i].begin + 1;
+  }
+
+  u64 cpu_freq = read_cpu_timer_freq();
+
+  printf("%-20s %-4.2f MHz\n", "CPU Frequency:", cpu_freq * 1e-6f);
+  printf("%-20s %lu bytes\n", "File size:", data.buffer.size);
+  printf("%-20s %lu\n", "Tokens:", data.tokens_size);
+  printf("%-20s %lu\n", "Pairs:", data.pairs_count);
+
+  data.x0 = arena_push_array(&data.arena, f64, data.pairs_count);
+  data.y0 = arena_push_array(&data.arena, f64, data.pairs_count);
+  data.x1 = arena_push_array(&data.arena, f64, data.pairs_count);
+  data.y1 = arena_push_array(&data.arena, f64, data.pairs_count);
+  data.distances = arena_push_array(&data.arena, f64, data.pairs_count);
+  data.x0_f32 = arena_push_array(&data.arena, f32, data.pairs_count);
+  data.y0_f32 = arena_push_array(&data.arena, f32, data.pairs_count);
+  data.x1_f32 = arena_push_array(&data.arena, f32, data.pairs_count);
+  data.y1_f32 = arena_push_array(&data.arena, f32, data.pairs_count);
+  data.distances_f32 = arena_push_array(&data.arena, f32, data.pairs_count);
+  for (u64 i = 0; i < data.pairs_count; ++i) {
+    data.x0[i] = data.pairs[i].a;
+    data.y0[i] = data.pairs[i].b;
+    data.x1[i] = data.pairs[i].c;
+    data.y1[i] = data.pairs[i].d;
+    data.x0_f32[i] = (f32)data.x0[i];
+    data.y0_f32[i] = (f32)data.y0[i];
+    data.x1_f32[i] = (f32)data.x1[i];
+    data.y1_f32[i] = (f32)data.y1[i];
+  }
+
+  // every level up to what this cpu has, select_kernels is what the library would run
+  IsaLevel supported = detect_isa();
+  const Kernels* selected = select_kernels();
+  printf("%-20s %s, selected %s\n", "ISA:", isa_names[supported], isa_names[selected->level]);
+
+  Kernels kernels[Isa_Count];
+  u32 kernels_count = 0;
+  bool kernels_ok = true;
+  for (u32 level = Isa_SSE2; level <= supported; ++level) {
+    kernels[kernels_count] = kernels_for((IsaLevel)level);
+    kernels_ok &= check_kernels(&data, kernels + kernels_count);
+    kernels_ok &= check_summation(&data, kernels + kernels_count);
+    ++kernels_count;
+  }
+  if (!kernels_ok) {
+    return EXIT_FAILURE;
+  }
+
+  {
+    LexerBench benches[Isa_Count + 1] = {{&data, lexer}};
+    for (u32 i = 0; i < kernels_count; ++i) {
+      benches[i + 1] = {&data, kernels[i].lexer};
+    }
+
+    RepRunner runner;
+    init_runner(&runner, cpu_freq);
+    add_variant(&runner, "lexer", bench_lexer, benches, data.buffer.size);
+    for (u32 i = 0; i < kernels_count; ++i) {
+      add_variant(&runner, kernels[i].lexer_name, bench_lexer, benches + i + 1, data.buffer.size);
+    }
+    run_group(&runner, "lexer");
+  }
+
+  {
+    RepRunner runner;
+    init_runner(&runner, cpu_freq);
+    add_variant(&runner, "parser", bench_parser, &data, data.buffer.size);
+    run_group(&runner, "parser");
+  }
+
+  {
+    ParseNumberBench benches[Isa_Count + 2] = {{&data, parse_number}, {&data, parse_number_fast}};
+    for (u32 i = 0; i < kernels_count; ++i) {
+      benches[i + 2] = {&data, kernels[i].parse_number};
+    }
+
+    RepRunner runner;
+    init_runner(&runner, cpu_freq);
+    add_variant(&runner, "parse_number", bench_parse_number, benches, data.token_bytes);
+    add_variant(&runner, "parse_number_fast", bench_parse_number, benches + 1, data.token_bytes);
+    for (u32 i = 0; i < kernels_count; ++i) {
+      add_variant(&runner, kernels[i].parse_number_name, bench_parse_number, benches + i + 2, data.token_bytes);
+    }
+    run_group(&runner, "parse_number");
+  }
+
+  {
+    HaversineBench benches[Isa_Count + 1] = {{&data, haversine_scalar}};
+    for (u32 i = 0; i < kernels_count; ++i) {
+      benches[i + 1] = {&data, kernels[i].haversine};
+    }
+
+    RepRunner runner;
+    init_runner(&runner, cpu_freq);
+    add_variant(&runner, "reference_haversine", bench_reference_haversine, &data, data.pairs_count * sizeof(Coords));
+    add_variant(&runner, "haversine_scalar", bench_haversine_kernel, benches, data.pairs_count * sizeof(Coords));
+    for (u32 i = 0; i < kernels_count; ++i) {
+      add_variant(&runner, kernels[i].haversine_name, bench_haversine_kernel, benches + i + 1, data.pairs_count * sizeof(Coords));
+    }
+    run_group(&runner, "haversine");
+  }
+
+  {
+    // the f64 kernel the library would pick against every f32 one, bytes are what each reads
+    HaversineBench f64_bench = {&data, selected->haversine};
+    HaversineF32Bench benches[Isa_Count + 1] = {{&data, haversine_f32_scalar}};
+    for (u32 i = 0; i < kernels_count; ++i) {
+      benches[i + 1] = {&data, kernels[i].haversine_f32};
+    }
+
+    RepRunner runner;
+    init_runner(&runner, cpu_freq);
+    add_variant(&runner, selected->haversine_name, bench_haversine_kernel, &f64_bench, data.pairs_count * 4 * sizeof(f64));
+    add_variant(&runner, "haversine_f32_scalar", bench_haversine_f32, benches, data.pairs_count * 4 * sizeof(f32));
+    for (u32 i = 0; i < kernels_count; ++i) {
+      // sse2 runs the baseline loop, already in the list
+      if (kernels[i].haversine_f32 != haversine_f32_scalar) {
+        add_variant(&runner, kernels[i].haversine_f32_name, bench_haversine_f32, benches + i + 1, data.pairs_count * 4 * sizeof(f32));
+      }
+    }
+    run_group(&runner, "haversine f32");
+
+    printf("\nf32 error against reference_haversine over %lu pairs\n", data.pairs_count);
+    for (u32 i = 0; i < kernels_count + 1; ++i) {
+      if (i > 0 && benches[i].func == haversine_f32_scalar) {
+        continue;
+      }
+
+      benches[i].func(data.x0_f32, data.y0_f32, data.x1_f32, data.y1_f32, data.pairs_count, (f32)EARTH_RADIUS, data.distances_f32);
+      PrecisionReport report = measure_precision(data.x0, data.y0, data.x1, data.y1, data.distances_f32, data.pairs_count, EARTH_RADIUS);
+      print_precision_report(i ? kernels[i - 1].haversine_f32_name : "haversine_f32_scalar", &report);
+    }
+  }
+
+  {
+    // the lookups and the cached kernel against the plain soa kernel, at the selected level and the scalar one
+    EndpointCache* cache = arena_push_struct(&data.arena, EndpointCache);
+    EndpointCacheBench bench[2] = {{&data, cache, selected->haversine_cached, selected->haversine},
+                                   {&data, cache, haversine_cached_scalar, haversine_scalar}};
+    HaversineBench plain[2] = {{&data, selected->haversine}, {&data, haversine_scalar}};
+
+    // every level has to give the bits of haversine_scalar through the cache as well
+    f64* expected = arena_push_array(&data.arena, f64, data.pairs_count);
+    haversine_scalar(data.x0, data.y0, data.x1, data.y1, data.pairs_count, EARTH_RADIUS, expected);
+    for (u32 level = 0; level <= selected->level; ++level) {
+      Kernels kernels = kernels_for((IsaLevel)level);
+      endpoint_cache_pass(&data, cache, kernels.haversine_cached, kernels.haversine);
+      if (memcmp(expected, data.distances, data.pairs_count * sizeof(f64)) != 0) {
+        fprintf(stderr, "ERROR: %s differs from haversine_scalar\n", kernels.haversine_cached_name);
+        return EXIT_FAILURE;
+      }
+    }
+
+    RepRunner runner;
+    init_runner(&runner, cpu_freq);
+    add_variant(&runner, selected->haversine_name, bench_haversine_kernel, plain, data.pairs_count * sizeof(Coords));
+    add_variant(&runner, selected->haversine_cached_name, bench_endpoint_cache, bench, data.pairs_count * sizeof(Coords));
+    add_variant(&runner, "haversine_scalar", bench_haversine_kernel, plain + 1, data.pairs_count * sizeof(Coords));
+    add_variant(&runner, "haversine_cached_scalar", bench_endpoint_cache, bench + 1, data.pairs_count * sizeof(Coords));
+    run_group(&runner, "endpoint cache");
+
+    printf("\nendpoint cache: %.1f%% of %lu lookups hit, %u latitudes kept, %lu pairs went around it\n",
+           endpoint_cache_hit_rate(cache) * 100.0, cache->lookups, cache->count, cache->skipped);
+  }
+
+  {
+    // the distances check_kernels left behind, summed by every mode with the selected width
+    for (u64 i = 0; i < data.pairs_count; ++i) {
+      Coords* pair = data.pairs + i;
+      data.distances[i] = reference_haversine(pair->a, pair->b, pair->c, pair->d, EARTH_RADIUS);
+    }
+
+    SummationBench benches[SumMode_Count + 1] = {{&data, NULL, SumMode_Exact}};
+    for (u32 mode = 0; mode < SumMode_Count; ++mode) {
+      benches[mode + 1] = {&data, selected->sum_values, (SumMode)mode};
+    }
+
+    RepRunner runner;
+    init_runner(&runner, cpu_freq);
+    add_variant(&runner, "superaccumulator", bench_summation, benches, data.pairs_count * sizeof(f64));
+    for (u32 mode = 0; mode < SumMode_Count; ++mode) {
+      add_variant(&runner, sum_mode_names[mode], bench_summation, benches + mode + 1, data.pairs_count * sizeof(f64));
+    }
+    run_group(&runner, "summation");
+
+    SuperAccumulator acc;
+    super_init(&acc);
+    for (u64 i = 0; i < data.pairs_count; ++i) {
+      super_add(&acc, data.distances[i]);
+    }
+    f64 exact = super_round(&acc);
+    f64 ulp = ldexp(1.0, ilogb(exact) - 52);
+
+    printf("\n%s over %lu distances, off from the exact sum by\n", selected->sum_values_name, data.pairs_count);
+    for (u32 mode = 0; mode < SumMode_Count; ++mode) {
+      Summation sum;
+      sum_init(&sum, (SumMode)mode);
+      selected->sum_values(&sum, data.distances, data.pairs_count);
+      f64 result = sum_result(&sum);
+      f64 chunked = sum_on_threads(&data.scratch, data.distances, data.pairs_count, (SumMode)mode, selected->sum_values, 4);
+      printf("%-10s | %.17g | %6.1f ulp | in %lu chunks on 4 threads %6.1f ulp\n", sum_mode_names[mode], result,
+             fabs(result - exact) / ulp, (data.pairs_count + SUM_CHUNK_SIZE - 1) / SUM_CHUNK_SIZE, fabs(chunked - exact) / ulp);
+    }
+  }
+
+  // printing the sink keeps every result alive
+  printf("checksum: %f\n", data.sink);
+
+  arena_release(&data.scratch);
+  arena_release(&data.arena);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,705 @@
+#ifndef _DISPATCH_HPP_
+#define _DISPATCH_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "profiler.hpp"
+#include "pipeline.hpp"  // the scalar kernels every variant has to agree with
+#include "precision.hpp" // the f32 haversine variants
+#include "summation.hpp" // and the summation ones
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// one binary for every host: the block classifier behind the lexer and harvesine_feed, the number
+// parser and the haversine loop each come in sse2, avx2 and avx-512 variants compiled with target attributes, and cpuid picks the widest one the cpu and the
+// os support the first time select_kernels runs. HARVESINE_ISA=scalar|sse2|avx2|avx512 in the
+// environment caps the choice, for comparing or when the wide one clocks the core down.
+// the variants give the same tokens and bit-identical numbers as the scalar code, distances included:
+// every haversine level, scalar too, runs polynomials the compiler can vectorize and stays within
+// 1e-12 of reference_haversine. the file is built for the x86-64 baseline, see CMakeLists.txt
+enum IsaLevel : u32 {
+  Isa_Scalar,
+  Isa_SSE2,
+  Isa_AVX2,
+  Isa_AVX512,
+  Isa_Count,
+};
+
+static const char* isa_names[Isa_Count] = {"scalar", "sse2", "avx2", "avx512"};
+
+typedef u64 lexer_func(const struct Buffer* const buffer, Arena* arena, struct TokenItem** tokens);
+typedef f64 parse_number_func(const struct Buffer* const buffer, const u64 begin, const u64 end);
+typedef void haversine_func(const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count, f64 earth_radius, f64* distances);
+// the same with the cosines of the latitudes handed in, see endpoint_cache.hpp
+typedef void haversine_cached_func(const f64* x0, const f64* y0, const f64* x1, const f64* y1, const f64* cos0, const f64* cos1, u64 count, f64 earth_radius, f64* distances);
+
+// a bit per byte of a 64 byte block, see the lexer below
+struct BlockMasks {
+  u64 quotes;
+  u64 numbers;
+};
+
+typedef BlockMasks classify_block_func(const u8* block);
+
+struct Kernels {
+  IsaLevel level;
+  lexer_func* lexer;
+  classify_block_func* classify_block;
+  parse_number_func* parse_number;
+  haversine_func* haversine;
+  haversine_cached_func* haversine_cached;
+  haversine_f32_func* haversine_f32;
+  sum_values_func* sum_values;
+  const char* lexer_name;
+  const char* classify_block_name;
+  const char* parse_number_name;
+  const char* haversine_name;
+  const char* haversine_cached_name;
+  const char* haversine_f32_name;
+  const char* sum_values_name;
+};
+
+// widest level both the cpu and the os handle
+[[maybe_unused]] static IsaLevel detect_isa(void);
+
+// every kernel at the widest variant not above level
+[[maybe_unused]] static Kernels kernels_for(IsaLevel level);
+
+// detects once, applies HARVESINE_ISA and tells the profiler what it picked
+[[maybe_unused]] static const Kernels* select_kernels(void);
+
+// the scalar fallback for everything the variants don't take on
+static void haversine_scalar(const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count, f64 earth_radius, f64* distances);
+
+
+///////////////////////////////////////////////////////////////
+/// Lexer
+// 64 bytes at a time turn into bit masks, strings are the bits between quotes and numbers are what
+// is left of [0-9.-] outside of them, so the per-byte switch becomes a walk over the edges of the
+// number runs. a run is a token like lex_number makes, valid json never starts one with '.'
+// the masks eight bytes at a time in a u64, for the scalar level. high bit of every byte set where it
+// matches, the multiply gathers the eight high bits into the top byte (swar)
+static inline u64 swar_equal(u64 bytes, u8 ch) {
+  const u64 low_bits = 0x7f7f7f7f7f7f7f7full;
+  u64 x = bytes ^ (0x0101010101010101ull * ch);
+  return ~(((x & low_bits) + low_bits) | x | low_bits);
+}
+
+static inline u64 swar_gather(u64 high_bits) {
+  return ((high_bits >> 7) * 0x0102040810204080ull) >> 56;
+}
+
+static BlockMasks classify_block_scalar(const u8* block) {
+  const u64 low_bits = 0x7f7f7f7f7f7f7f7full;
+
+  BlockMasks masks = {0, 0};
+  for (u32 i = 0; i < 64; i += 8) {
+    u64 bytes;
+    memcpy(&bytes, block + i, sizeof(bytes));
+
+    // '0' to '9': below 0x80, at least '0' and below '9' + 1, each test is a carry into the high bit
+    u64 low = bytes & low_bits;
+    u64 at_least_zero = low + 0x0101010101010101ull * (0x80 - '0');
+    u64 above_nine = low + 0x0101010101010101ull * (0x80 - '9' - 1);
+    u64 digits = at_least_zero & ~above_nine & ~bytes & ~low_bits;
+
+    u64 numbers = digits | swar_equal(bytes, '-') | swar_equal(bytes, '.');
+    masks.quotes |= swar_gather(swar_equal(bytes, '"')) << i;
+    masks.numbers |= swar_gather(numbers) << i;
+  }
+  return masks;
+}
+
+// bit i set when an odd number of quotes is at or before i
+static u64 prefix_xor(u64 bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+static u64 lex_blocks(const struct Buffer* const buffer, Arena* arena, struct TokenItem** tokens, classify_block_func* classify) {
+  *tokens = (struct TokenItem*)(arena->base + arena->used);
+
+  u64 index = 0;
+  u64 in_string = 0; // all ones when a string goes on into the next block
+  u64 in_number = 0; // 1 when a number does
+  u64 begin = 0;
+  for (u64 base = 0; base < buffer->size; base += 64) {
+    BlockMasks masks;
+    if (base + 64 <= buffer->size) {
+      masks = classify((const u8*)buffer->data + base);
+    } else {
+      // zeros are neither quotes nor numbers
+      u8 tail[64] = {};
+      memcpy(tail, buffer->data + base, buffer->size - base);
+      masks = classify(tail);
+    }
+
+    u64 strings = prefix_xor(masks.quotes) ^ in_string;
+    in_string = (u64)((i64)strings >> 63);
+
+    u64 numbers = masks.numbers & ~(strings | masks.quotes);
+    u64 edges = numbers ^ ((numbers << 1) | in_number);
+    in_number = numbers >> 63;
+
+    while (edges) {
+      u64 bit = (u64)__builtin_ctzll(edges);
+      edges &= edges - 1;
+
+      if ((numbers >> bit) & 1) {
+        begin = base + bit;
+        continue;
+      }
+
+      struct TokenItem* token_item = arena_push_struct(arena, TokenItem);
+      if (!token_item) {
+        return index;
+      }
+      if (index == 0) {
+        *tokens = token_item;
+      }
+      *token_item = {begin, base + bit - 1};
+      ++index;
+    }
+  }
+
+  if (in_number) {
+    struct TokenItem* token_item = arena_push_struct(arena, TokenItem);
+    if (!token_item) {
+      return index;
+    }
+    if (index == 0) {
+      *tokens = token_item;
+    }
+    *token_item = {begin, buffer->size - 1};
+    ++index;
+  }
+
+  return index;
+}
+
+///////////////////////////////////////////////////////////////
+/// Number parser
+// the fraction digits sit right-aligned in the 16 bytes that end at the number, the integer digits
+// in the 16 that end before the '.', with everything else zeroed each window is one 16-digit integer.
+// the sum is the same (f64)integer + fraction / 10^n parse_number_fast does, so are the results
+static const f64 powers_of_ten[16] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+};
+
+// the windows only reach back from the number, so nothing past end is ever read
+struct NumberWindows {
+  u64 dot;          // position of the '.'
+  u32 integer_keep; // digits at the end of the integer window
+  u32 fraction_keep;
+  f64 sign;
+};
+
+// false for anything the windows can't take: no '.', more than 16 digits on a side, too close to the start
+static bool find_number_windows(const u8* data, const u64 begin, const u64 end, u32 dots, NumberWindows* windows) {
+  u64 length = end - begin + 1;
+  if (length > 16) {
+    return false;
+  }
+
+  // dots holds the '.' bits of the window ending at end, the ones before begin belong to someone else
+  dots &= ~((1u << (16 - length)) - 1);
+  if (!dots) {
+    return false;
+  }
+
+  windows->dot = end - 15 + (31 - (u64)__builtin_clz(dots));
+  windows->sign = data[begin] == '-' ? -1.0 : 1.0;
+  u64 digits_begin = begin + (data[begin] == '-');
+  windows->integer_keep = (u32)(windows->dot - digits_begin);
+  windows->fraction_keep = (u32)(end - windows->dot);
+  return windows->dot >= 16;
+}
+
+static f64 combine_number(const NumberWindows* windows, u64 integer_high, u64 integer_low, u64 fraction_high, u64 fraction_low) {
+  f64 value = (f64)(integer_high * 100000000 + integer_low);
+  value += (f64)(fraction_high * 100000000 + fraction_low) / powers_of_ten[windows->fraction_keep];
+  return windows->sign * value;
+}
+
+///////////////////////////////////////////////////////////////
+/// Haversine
+
+// the f64 counterpart of precision.hpp: plain code without branches or libm calls, vectorized by the
+// compiler for each target. sin, cos and asin are the fdlibm polynomials, within 2 ulps of libm.
+//
+// nothing in here may be contracted into fma. a fused multiply and add rounds once, the avx2 and
+// avx-512 levels would round differently from scalar and sse2 and the distances would depend on the
+// cpu. the f32 kernels (precision.hpp) keep their fma, only these regions turn it off
+#if defined(__clang__)
+#define F64_NO_CONTRACT_BEGIN _Pragma("float_control(push)") _Pragma("clang fp contract(off)")
+#define F64_NO_CONTRACT_END _Pragma("float_control(pop)")
+#else
+#define F64_NO_CONTRACT_BEGIN _Pragma("GCC push_options") _Pragma("GCC optimize(\"fp-contract=off\")")
+#define F64_NO_CONTRACT_END _Pragma("GCC pop_options")
+#endif
+
+F64_NO_CONTRACT_BEGIN
+// fdlibm's kernels on [-pi/4, pi/4]
+static inline f64 sin_f64_kernel(f64 x) {
+  f64 x2 = x * x;
+  f64 p = 1.58969099521155010221e-10;
+  p = p * x2 - 2.50507602534068634195e-08;
+  p = p * x2 + 2.75573137070700676789e-06;
+  p = p * x2 - 1.98412698298579493134e-04;
+  p = p * x2 + 8.33333333332248946124e-03;
+  p = p * x2 - 1.66666666666666324348e-01;
+  return x + x * x2 * p;
+}
+
+static inline f64 cos_f64_kernel(f64 x) {
+  f64 x2 = x * x;
+  f64 p = -1.13596475577881948265e-11;
+  p = p * x2 + 2.08757232129817482790e-09;
+  p = p * x2 - 2.75573143513906633035e-07;
+  p = p * x2 + 2.48015872894767294178e-05;
+  p = p * x2 - 1.38888888888741095749e-03;
+  p = p * x2 + 4.16666666666666019037e-02;
+  return 1.0 - 0.5 * x2 + x2 * x2 * p;
+}
+
+// pi / 2 in three parts, the first two with their low bits zero so the products are exact (cody and waite)
+#define HALF_PI_F64_HIGH 1.57079632673412561417e+00
+#define HALF_PI_F64_MID 6.07710050630396597660e-11
+#define HALF_PI_F64_LOW 2.02226624879595063154e-21
+
+// quadrant_offset 0 is sin, 1 is cos. the quadrant ends up in the low mantissa bits of
+// x * 2 / pi + 1.5 * 2^52, and the kernel and sign are picked with masks, sse2 has no 64-bit compares
+static inline f64 sin_cos_f64(f64 x, u64 quadrant_offset) {
+  const f64 rounder = 6755399441055744.0;
+  f64 shifted = x * 6.36619772367581382433e-01 + rounder;
+  f64 quadrant = shifted - rounder;
+  f64 r = ((x - quadrant * HALF_PI_F64_HIGH) - quadrant * HALF_PI_F64_MID) - quadrant * HALF_PI_F64_LOW;
+
+  u64 q;
+  memcpy(&q, &shifted, sizeof(q));
+  q += quadrant_offset;
+
+  f64 sine = sin_f64_kernel(r);
+  f64 cosine = cos_f64_kernel(r);
+  u64 sine_bits, cosine_bits;
+  memcpy(&sine_bits, &sine, sizeof(sine_bits));
+  memcpy(&cosine_bits, &cosine, sizeof(cosine_bits));
+
+  u64 odd = 0 - (q & 1);
+  u64 bits = ((sine_bits & ~odd) | (cosine_bits & odd)) ^ ((q & 2) << 62);
+  f64 value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// fdlibm asin, x + x R(x^2) below 0.5 and pi/2 - 2 asin(sqrt((1 - x) / 2)) above.
+// both sides are computed and picked between so there is no branch
+static inline f64 asin_f64(f64 x) {
+  bool high = x > 0.5;
+  f64 z = high ? 0.5 * (1.0 - x) : x * x;
+  f64 a = high ? sqrt(z) : x;
+
+  f64 p = 3.47933107596021167570e-05;
+  p = p * z + 7.91534994289814532176e-04;
+  p = p * z - 4.00555345006794114027e-02;
+  p = p * z + 2.01212532134862925881e-01;
+  p = p * z - 3.25565818622400915405e-01;
+  p = p * z + 1.66666666666666657415e-01;
+  f64 q = 7.70381505559019352791e-02;
+  q = q * z - 6.88283971605453293030e-01;
+  q = q * z + 2.02094576023350569471e+00;
+  q = q * z - 2.40339491173441421878e+00;
+  q = q * z + 1.0;
+  f64 r = a + a * (z * p / q);
+
+  f64 r_high = (HALF_PI_F64_HIGH - (r + r)) + (HALF_PI_F64_MID + HALF_PI_F64_LOW);
+  return high ? r_high : r;
+}
+
+static inline f64 latitude_cosine_f64(f64 latitude) {
+  return sin_cos_f64(degrees_to_radians(latitude), 1);
+}
+
+// reference_haversine step for step, only the trig differs. cos0 and cos1 are latitude_cosine_f64
+// of y0 and y1, worked out here or looked up by the endpoint cache
+static inline f64 haversine_f64_cosines(f64 x0, f64 y0, f64 x1, f64 y1, f64 cos0, f64 cos1, f64 earth_radius) {
+  f64 dLat = degrees_to_radians(y1 - y0);
+  f64 dLon = degrees_to_radians(x1 - x0);
+
+  f64 a = square(sin_cos_f64(dLat / 2.0, 0)) + cos0 * cos1 * square(sin_cos_f64(dLon / 2, 0));
+  f64 c = 2.0 * asin_f64(sqrt(a));
+
+  return earth_radius * c;
+}
+
+static inline f64 haversine_f64_pair(f64 x0, f64 y0, f64 x1, f64 y1, f64 earth_radius) {
+  return haversine_f64_cosines(x0, y0, x1, y1, latitude_cosine_f64(y0), latitude_cosine_f64(y1), earth_radius);
+}
+
+// the same polynomials as every vector level, so the distances don't depend on the level picked.
+// libm is left to reference_haversine
+static void haversine_scalar(const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count, f64 earth_radius, f64* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f64_pair(x0[i], y0[i], x1[i], y1[i], earth_radius);
+  }
+}
+
+static void haversine_cached_scalar(const f64* x0, const f64* y0, const f64* x1, const f64* y1, const f64* cos0, const f64* cos1, u64 count, f64 earth_radius, f64* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f64_cosines(x0[i], y0[i], x1[i], y1[i], cos0[i], cos1[i], earth_radius);
+  }
+}
+F64_NO_CONTRACT_END
+
+#if defined(__x86_64__)
+
+///////////////////////////////////////////////////////////////
+/// SSE2
+static BlockMasks classify_block_sse2(const u8* block) {
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i minus = _mm_set1_epi8('-');
+  const __m128i dot = _mm_set1_epi8('.');
+  const __m128i quote = _mm_set1_epi8('"');
+
+  BlockMasks masks = {0, 0};
+  for (u32 i = 0; i < 64; i += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(block + i));
+    __m128i digits = _mm_sub_epi8(bytes, zero);
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digits, nine), digits);
+    __m128i is_number = _mm_or_si128(is_digit, _mm_or_si128(_mm_cmpeq_epi8(bytes, minus), _mm_cmpeq_epi8(bytes, dot)));
+
+    masks.quotes |= (u64)(u32)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)) << i;
+    masks.numbers |= (u64)(u32)_mm_movemask_epi8(is_number) << i;
+  }
+  return masks;
+}
+
+static u64 lexer_sse2(const struct Buffer* const buffer, Arena* arena, struct TokenItem** tokens) {
+  TIME_FUNC;
+  return lex_blocks(buffer, arena, tokens, classify_block_sse2);
+}
+
+// 16 digits, most significant first, to two 8-digit halves. no pmaddubsw before ssse3, so the
+// bytes are widened and every step is a pmaddwd
+static void digits_to_halves_sse2(__m128i digits, u64* high, u64* low) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i tens = _mm_setr_epi16(10, 1, 10, 1, 10, 1, 10, 1);
+  __m128i pairs_low = _mm_madd_epi16(_mm_unpacklo_epi8(digits, zero), tens);
+  __m128i pairs_high = _mm_madd_epi16(_mm_unpackhi_epi8(digits, zero), tens);
+  __m128i pairs = _mm_packs_epi32(pairs_low, pairs_high);
+  __m128i quads = _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+  quads = _mm_packs_epi32(quads, quads);
+  __m128i octs = _mm_madd_epi16(quads, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+  *high = (u32)_mm_cvtsi128_si32(octs);
+  *low = (u32)_mm_cvtsi128_si32(_mm_srli_si128(octs, 4));
+}
+
+// digits of the window ending at at + 15, all but the last keep zeroed
+static __m128i window_digits_sse2(const u8* at, u32 keep) {
+  const __m128i lane_index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i bytes = _mm_loadu_si128((const __m128i*)at);
+  __m128i kept = _mm_cmpgt_epi8(lane_index, _mm_set1_epi8((char)(15 - keep)));
+  return _mm_and_si128(_mm_sub_epi8(bytes, _mm_set1_epi8('0')), kept);
+}
+
+static f64 parse_number_sse2(const struct Buffer* const buffer, const u64 begin, const u64 end) {
+  const u8* data = buffer->data;
+  if (end < 15) {
+    return parse_number_fast(buffer, begin, end);
+  }
+
+  NumberWindows windows;
+  u32 dots = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + end - 15)), _mm_set1_epi8('.')));
+  if (!find_number_windows(data, begin, end, dots, &windows)) {
+    return parse_number_fast(buffer, begin, end);
+  }
+
+  u64 integer_high, integer_low, fraction_high, fraction_low;
+  digits_to_halves_sse2(window_digits_sse2(data + windows.dot - 16, windows.integer_keep), &integer_high, &integer_low);
+  digits_to_halves_sse2(window_digits_sse2(data + end - 15, windows.fraction_keep), &fraction_high, &fraction_low);
+  return combine_number(&windows, integer_high, integer_low, fraction_high, fraction_low);
+}
+
+// sse2 is the x86-64 baseline the library is built for (see CMakeLists.txt), this is the loop as
+// the compiler vectorizes it for that
+F64_NO_CONTRACT_BEGIN
+static void haversine_sse2(const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count, f64 earth_radius, f64* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f64_pair(x0[i], y0[i], x1[i], y1[i], earth_radius);
+  }
+}
+
+static void haversine_cached_sse2(const f64* x0, const f64* y0, const f64* x1, const f64* y1, const f64* cos0, const f64* cos1, u64 count, f64 earth_radius, f64* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f64_cosines(x0[i], y0[i], x1[i], y1[i], cos0[i], cos1[i], earth_radius);
+  }
+}
+F64_NO_CONTRACT_END
+
+///////////////////////////////////////////////////////////////
+/// AVX2
+__attribute__((target("avx2")))
+static BlockMasks classify_block_avx2(const u8* block) {
+  const __m256i zero = _mm256_set1_epi8('0');
+  const __m256i nine = _mm256_set1_epi8(9);
+  const __m256i minus = _mm256_set1_epi8('-');
+  const __m256i dot = _mm256_set1_epi8('.');
+  const __m256i quote = _mm256_set1_epi8('"');
+
+  BlockMasks masks = {0, 0};
+  for (u32 i = 0; i < 64; i += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)(block + i));
+    __m256i digits = _mm256_sub_epi8(bytes, zero);
+    __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digits, nine), digits);
+    __m256i is_number = _mm256_or_si256(is_digit, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, minus), _mm256_cmpeq_epi8(bytes, dot)));
+
+    masks.quotes |= (u64)(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, quote)) << i;
+    masks.numbers |= (u64)(u32)_mm256_movemask_epi8(is_number) << i;
+  }
+  return masks;
+}
+
+static u64 lexer_avx2(const struct Buffer* const buffer, Arena* arena, struct TokenItem** tokens) {
+  TIME_FUNC;
+  return lex_blocks(buffer, arena, tokens, classify_block_avx2);
+}
+
+// the integer window in the low lane, the fraction in the high one, both go through one pmaddubsw chain
+__attribute__((target("avx2")))
+static void digits_to_halves_avx2(__m256i digits, u64* halves) {
+  __m256i pairs = _mm256_maddubs_epi16(digits, _mm256_set1_epi16(0x010a));
+  __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00010064));
+  quads = _mm256_packus_epi32(quads, quads);
+  __m256i octs = _mm256_madd_epi16(quads, _mm256_set1_epi32(0x00012710));
+  halves[0] = (u32)_mm256_extract_epi32(octs, 0);
+  halves[1] = (u32)_mm256_extract_epi32(octs, 1);
+  halves[2] = (u32)_mm256_extract_epi32(octs, 4);
+  halves[3] = (u32)_mm256_extract_epi32(octs, 5);
+}
+
+__attribute__((target("avx2")))
+static f64 parse_number_avx2(const struct Buffer* const buffer, const u64 begin, const u64 end) {
+  const u8* data = buffer->data;
+  if (end < 15) {
+    return parse_number_fast(buffer, begin, end);
+  }
+
+  __m128i fraction_bytes = _mm_loadu_si128((const __m128i*)(data + end - 15));
+  NumberWindows windows;
+  u32 dots = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(fraction_bytes, _mm_set1_epi8('.')));
+  if (!find_number_windows(data, begin, end, dots, &windows)) {
+    return parse_number_fast(buffer, begin, end);
+  }
+
+  const __m256i lane_index = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                              0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(data + windows.dot - 16))), fraction_bytes, 1);
+  __m256i first_kept = _mm256_setr_m128i(_mm_set1_epi8((char)(15 - windows.integer_keep)), _mm_set1_epi8((char)(15 - windows.fraction_keep)));
+  __m256i digits = _mm256_and_si256(_mm256_sub_epi8(bytes, _mm256_set1_epi8('0')), _mm256_cmpgt_epi8(lane_index, first_kept));
+
+  u64 halves[4];
+  digits_to_halves_avx2(digits, halves);
+  return combine_number(&windows, halves[0], halves[1], halves[2], halves[3]);
+}
+
+F64_NO_CONTRACT_BEGIN
+__attribute__((target("avx2,fma")))
+static void haversine_avx2(const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count, f64 earth_radius, f64* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f64_pair(x0[i], y0[i], x1[i], y1[i], earth_radius);
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static void haversine_cached_avx2(const f64* x0, const f64* y0, const f64* x1, const f64* y1, const f64* cos0, const f64* cos1, u64 count, f64 earth_radius, f64* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f64_cosines(x0[i], y0[i], x1[i], y1[i], cos0[i], cos1[i], earth_radius);
+  }
+}
+F64_NO_CONTRACT_END
+
+///////////////////////////////////////////////////////////////
+/// AVX-512
+// mask compares give the 64-bit masks directly, and masked loads read only the digits, so the
+// number windows don't need anything before the number
+#define AVX512_TARGET "avx512f,avx512bw,avx512vl"
+
+__attribute__((target(AVX512_TARGET)))
+static BlockMasks classify_block_avx512(const u8* block) {
+  __m512i bytes = _mm512_loadu_si512((const void*)block);
+  __m512i digits = _mm512_sub_epi8(bytes, _mm512_set1_epi8('0'));
+
+  BlockMasks masks;
+  masks.quotes = _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8('"'));
+  masks.numbers = _mm512_cmplt_epu8_mask(digits, _mm512_set1_epi8(10)) |
+                  _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8('-')) |
+                  _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8('.'));
+  return masks;
+}
+
+static u64 lexer_avx512(const struct Buffer* const buffer, Arena* arena, struct TokenItem** tokens) {
+  TIME_FUNC;
+  return lex_blocks(buffer, arena, tokens, classify_block_avx512);
+}
+
+__attribute__((target(AVX512_TARGET)))
+static f64 parse_number_avx512(const struct Buffer* const buffer, const u64 begin, const u64 end) {
+  const u8* data = buffer->data;
+  u64 length = end - begin + 1;
+  if (length > 16) {
+    return parse_number_fast(buffer, begin, end);
+  }
+
+  // the number alone, right-aligned in the window that ends at end
+  __mmask16 number_lanes = (__mmask16)(0xffffu << (16 - length));
+  __m128i number = _mm_maskz_loadu_epi8(number_lanes, data + end - 15);
+  u32 dots = _mm_mask_cmpeq_epi8_mask(number_lanes, number, _mm_set1_epi8('.'));
+  if (!dots) {
+    return parse_number_fast(buffer, begin, end);
+  }
+
+  NumberWindows windows;
+  windows.dot = end - 15 + (31 - (u64)__builtin_clz(dots));
+  windows.sign = data[begin] == '-' ? -1.0 : 1.0;
+  u64 digits_begin = begin + (data[begin] == '-');
+  windows.integer_keep = (u32)(windows.dot - digits_begin);
+  windows.fraction_keep = (u32)(end - windows.dot);
+
+  __mmask16 integer_lanes = (__mmask16)(0xffffu << (16 - windows.integer_keep));
+  __mmask16 fraction_lanes = (__mmask16)(0xffffu << (16 - windows.fraction_keep));
+  __m128i integer = _mm_maskz_loadu_epi8(integer_lanes, data + windows.dot - 16);
+  __m128i fraction = _mm_maskz_loadu_epi8(fraction_lanes, data + end - 15);
+  __m128i integer_digits = _mm_maskz_sub_epi8(integer_lanes, integer, _mm_set1_epi8('0'));
+  __m128i fraction_digits = _mm_maskz_sub_epi8(fraction_lanes, fraction, _mm_set1_epi8('0'));
+
+  u64 halves[4];
+  digits_to_halves_avx2(_mm256_inserti128_si256(_mm256_castsi128_si256(integer_digits), fraction_digits, 1), halves);
+  return combine_number(&windows, halves[0], halves[1], halves[2], halves[3]);
+}
+
+F64_NO_CONTRACT_BEGIN
+__attribute__((target(AVX512_TARGET ",fma")))
+static void haversine_avx512(const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count, f64 earth_radius, f64* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f64_pair(x0[i], y0[i], x1[i], y1[i], earth_radius);
+  }
+}
+
+__attribute__((target(AVX512_TARGET ",fma")))
+static void haversine_cached_avx512(const f64* x0, const f64* y0, const f64* x1, const f64* y1, const f64* cos0, const f64* cos1, u64 count, f64 earth_radius, f64* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f64_cosines(x0[i], y0[i], x1[i], y1[i], cos0[i], cos1[i], earth_radius);
+  }
+}
+F64_NO_CONTRACT_END
+
+#endif // __x86_64__
+
+///////////////////////////////////////////////////////////////
+/// Selection
+static IsaLevel detect_isa(void) {
+#if defined(__x86_64__)
+  u32 eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & bit_SSE2)) {
+    return Isa_Scalar;
+  }
+
+  // the os has to save the wide registers on a context switch too, xcr0 says which it does
+  if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+    return Isa_SSE2;
+  }
+  u32 xcr0, xcr0_high;
+  __asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+
+  // avx2 cpus all have fma as well, the f32 kernels count on it
+  if ((xcr0 & 0x6) != 0x6 || !(ecx & bit_FMA) ||
+      !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_AVX2)) {
+    return Isa_SSE2;
+  }
+
+  // opmask, upper halves of zmm0-15 and zmm16-31
+  u32 avx512 = bit_AVX512F | bit_AVX512BW | bit_AVX512VL;
+  if ((xcr0 & 0xe0) != 0xe0 || (ebx & avx512) != avx512) {
+    return Isa_AVX2;
+  }
+  return Isa_AVX512;
+#else
+  return Isa_Scalar;
+#endif
+}
+
+// the baseline f32 loop is already vectorized for sse2, it stays the pick at that level
+static Kernels kernels_for(IsaLevel level) {
+  Kernels kernels = {Isa_Scalar, lexer, classify_block_scalar, parse_number_fast, haversine_scalar, haversine_cached_scalar, haversine_f32_scalar,
+                     sum_values, "lexer", "classify_block_scalar", "parse_number_fast", "haversine_scalar", "haversine_cached_scalar",
+                     "haversine_f32_scalar", "sum_values"};
+#if defined(__x86_64__)
+  if (level >= Isa_SSE2) {
+    kernels = {Isa_SSE2, lexer_sse2, classify_block_sse2, parse_number_sse2, haversine_sse2, haversine_cached_sse2, haversine_f32_scalar, sum_values,
+               "lexer_sse2", "classify_block_sse2", "parse_number_sse2", "haversine_sse2", "haversine_cached_sse2", "haversine_f32_scalar",
+               "sum_values"};
+  }
+  if (level >= Isa_AVX2) {
+    kernels = {Isa_AVX2, lexer_avx2, classify_block_avx2, parse_number_avx2, haversine_avx2, haversine_cached_avx2, haversine_f32_avx2, sum_values_avx2,
+               "lexer_avx2", "classify_block_avx2", "parse_number_avx2", "haversine_avx2", "haversine_cached_avx2", "haversine_f32_avx2",
+               "sum_values_avx2"};
+  }
+  if (level >= Isa_AVX512) {
+    kernels = {Isa_AVX512, lexer_avx512, classify_block_avx512, parse_number_avx512, haversine_avx512, haversine_cached_avx512, haversine_f32_avx512, sum_values_avx512,
+               "lexer_avx512", "classify_block_avx512", "parse_number_avx512", "haversine_avx512", "haversine_cached_avx512",
+               "haversine_f32_avx512", "sum_values_avx512"};
+  }
+#endif
+  return kernels;
+}
+
+static Kernels global_kernels;
+static bool global_kernels_selected;
+
+static const Kernels* select_kernels(void) {
+  if (global_kernels_selected) {
+    return &global_kernels;
+  }
+
+  IsaLevel level = detect_isa();
+  const char* requested = getenv("HARVESINE_ISA");
+  if (requested) {
+    u32 cap = 0;
+    while (cap < Isa_Count && strcmp(requested, isa_names[cap]) != 0) {
+      ++cap;
+    }
+
+    if (cap == Isa_Count) {
+      fprintf(stderr, "WARNING: HARVESINE_ISA=%s is not scalar, sse2, avx2 or avx512, ignored\n", requested);
+    } else if (cap > level) {
+      fprintf(stderr, "WARNING: HARVESINE_ISA=%s is not supported here, using %s\n", requested, isa_names[level]);
+    } else {
+      level = (IsaLevel)cap;
+    }
+  }
+
+  global_kernels = kernels_for(level);
+  global_kernels_selected = true;
+
+  ProfileNote("isa", isa_names[global_kernels.level]);
+  ProfileNote("json scanner", global_kernels.classify_block_name);
+  ProfileNote("number parser", global_kernels.parse_number_name);
+  ProfileNote("haversine", global_kernels.haversine_name);
+  ProfileNote("haversine f32", global_kernels.haversine_f32_name);
+  ProfileNote("summation", global_kernels.sum_values_name);
+  return &global_kernels;
+}
+
+#endif // _DISPATCH_HPP_
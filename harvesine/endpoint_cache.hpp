@@ -0,0 +1,112 @@
+#ifndef _ENDPOINT_CACHE_HPP_
+#define _ENDPOINT_CACHE_HPP_
+
+#include <string.h>
+
+#include "types.h"
+#include "profiler.hpp"
+#include "dispatch.hpp" // latitude_cosine_f64 and the haversine_cached kernels
+
+// the haversine kernels take the cosine of both latitudes for every pair, two of their five
+// polynomials. when the same endpoints keep coming back (cities, depots, clustered data) a pass
+// before the kernel looks each latitude up in a small open addressing table and hands the cosines to
+// Kernels::haversine_cached, a batch at a time. the key is the exact bits of the latitude, a rounded
+// one would hand out the cosine of a nearby latitude, so the distances stay bit for bit what
+// haversine_scalar gives, at every level.
+// the table stays at most half full so probes are short, past that new latitudes just miss
+#define ENDPOINT_CACHE_BITS 13
+#define ENDPOINT_CACHE_SIZE (1 << ENDPOINT_CACHE_BITS)
+#define ENDPOINT_CACHE_MAX_COUNT (ENDPOINT_CACHE_SIZE / 2)
+
+// a nan no parser makes, the table starts out all of it
+#define ENDPOINT_CACHE_EMPTY 0xffffffffffffffffull
+
+// a hit reads one cache line
+struct EndpointEntry {
+  u64 key;
+  f64 cosine;
+};
+
+struct EndpointCache {
+  EndpointEntry entries[ENDPOINT_CACHE_SIZE];
+  u32 count;
+
+  u64 lookups;
+  u64 hits;
+  u64 skipped; // pairs that went to the plain kernel instead
+};
+
+[[maybe_unused]] static void endpoint_cache_init(EndpointCache* cache);
+
+// cos0[i] and cos1[i] become latitude_cosine_f64 of y0[i] and y1[i]
+[[maybe_unused]] static void endpoint_cosines(EndpointCache* cache, const f64* y0, const f64* y1, u64 count, f64* cos0, f64* cos1);
+
+// a full table with less than half the lookups hitting means the endpoints don't repeat,
+// the plain kernel is faster from there on
+[[maybe_unused]] static bool endpoint_cache_pays_off(const EndpointCache* cache);
+
+[[maybe_unused]] static f64 endpoint_cache_hit_rate(const EndpointCache* cache);
+
+
+///////////////////////////////////////////////////////////////
+/// Table
+static void endpoint_cache_init(EndpointCache* cache) {
+  memset(cache->entries, 0xff, sizeof(cache->entries));
+  cache->count = 0;
+  cache->lookups = 0;
+  cache->hits = 0;
+  cache->skipped = 0;
+}
+
+// under the same no-fma rule as the kernels, a cosine rounded differently would move the distances
+F64_NO_CONTRACT_BEGIN
+static inline f64 endpoint_cosine(EndpointCache* cache, f64 latitude) {
+  u64 key;
+  memcpy(&key, &latitude, sizeof(key));
+  if (key == ENDPOINT_CACHE_EMPTY) {
+    return latitude_cosine_f64(latitude);
+  }
+
+  // fibonacci hashing, the top bits of the product mix in all of the mantissa
+  u32 slot = (u32)((key * 0x9e3779b97f4a7c15ull) >> (64 - ENDPOINT_CACHE_BITS));
+  for (;;) {
+    EndpointEntry* entry = cache->entries + slot;
+    if (entry->key == key) {
+      ++cache->hits;
+      return entry->cosine;
+    }
+    if (entry->key == ENDPOINT_CACHE_EMPTY) {
+      break;
+    }
+    slot = (slot + 1) & (ENDPOINT_CACHE_SIZE - 1);
+  }
+
+  f64 cosine = latitude_cosine_f64(latitude);
+  if (cache->count < ENDPOINT_CACHE_MAX_COUNT) {
+    cache->entries[slot].key = key;
+    cache->entries[slot].cosine = cosine;
+    ++cache->count;
+  }
+  return cosine;
+}
+F64_NO_CONTRACT_END
+
+static void endpoint_cosines(EndpointCache* cache, const f64* y0, const f64* y1, u64 count, f64* cos0, f64* cos1) {
+  TIME_BLOCK("endpoint cache")
+
+  for (u64 i = 0; i < count; ++i) {
+    cos0[i] = endpoint_cosine(cache, y0[i]);
+    cos1[i] = endpoint_cosine(cache, y1[i]);
+  }
+  cache->lookups += 2 * count;
+}
+
+static bool endpoint_cache_pays_off(const EndpointCache* cache) {
+  return cache->count < ENDPOINT_CACHE_MAX_COUNT || 2 * cache->hits >= cache->lookups;
+}
+
+static f64 endpoint_cache_hit_rate(const EndpointCache* cache) {
+  return cache->lookups ? (f64)cache->hits / (f64)cache->lookups : 0.0;
+}
+
+#endif // _ENDPOINT_CACHE_HPP_
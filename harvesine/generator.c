@@ -1,5 +1,6 @@
 #include "stdlib.h"
 #include "stdio.h"
+#include "stdint.h"
 
 typedef int8_t  i8;
 typedef int16_t i16;
@@ -8,7 +9,11 @@ typedef double   f64;
 
 f64 rand_in_range(f64 min, f64 max);
 void insert_random_coords_to_file(FILE* file);
+void insert_pool_coords_to_file(FILE* file, const f64* pool, i32 pool_count);
 
+// generator seed count [endpoints]
+// with endpoints the pairs are drawn from that many random points, like trips between a fixed set
+// of cities, so the same coordinates keep coming back
 int main(int argc, char* argv[argc + 1]) {
   if (argc < 3) {
     printf("not enough parameters\n");
@@ -26,18 +31,40 @@ int main(int argc, char* argv[argc + 1]) {
     fprintf(stderr, "error - argv[2] (count) not an integer");
   }
 
+  i32 pool_count = 0;
+  if (argc > 3 && (sscanf(argv[3], "%d", &pool_count) != 1 || pool_count < 1)) {
+    fprintf(stderr, "error - argv[3] (endpoints) is not a positive integer");
+    return EXIT_FAILURE;
+  }
+
   char output_name[64];
-  snprintf(output_name, sizeof(output_name), "coords_%d.json", count);
+  if (pool_count) {
+    snprintf(output_name, sizeof(output_name), "coords_%d_pool_%d.json", count, pool_count);
+  } else {
+    snprintf(output_name, sizeof(output_name), "coords_%d.json", count);
+  }
+
+  // x and y of every endpoint
+  f64* pool = NULL;
+  if (pool_count) {
+    pool = malloc(2 * sizeof(f64) * pool_count);
+    for (i32 i = 0; i < pool_count; ++i) {
+      pool[2 * i] = rand_in_range(-180.0, 180.);
+      pool[2 * i + 1] = rand_in_range(-90.0, 90.0);
+    }
+  }
 
   FILE* output = fopen(output_name, "w");
   fprintf(output, "{\"pairs\":[\n");
 
-  for (i32 i = 0; i < count - 1; ++i) {
-    insert_random_coords_to_file(output);
-    fprintf(output, ",\n");
+  for (i32 i = 0; i < count; ++i) {
+    if (pool) {
+      insert_pool_coords_to_file(output, pool, pool_count);
+    } else {
+      insert_random_coords_to_file(output);
+    }
+    fprintf(output, i < count - 1 ? ",\n" : "\n");
   }
-  insert_random_coords_to_file(output);
-  fprintf(output, "\n");
 
   fprintf(output, "]}");
 
@@ -58,3 +85,9 @@ void insert_random_coords_to_file(FILE* file) {
   fprintf(file, "    \"x0\":%f, \"y0\":%f, \"x1\":%f, \"y1\":%f", x0, y0, x1, y1);
 }
 
+void insert_pool_coords_to_file(FILE* file, const f64* pool, i32 pool_count) {
+  const f64* from = pool + 2 * (rand() % pool_count);
+  const f64* to = pool + 2 * (rand() % pool_count);
+
+  fprintf(file, "    \"x0\":%f, \"y0\":%f, \"x1\":%f, \"y1\":%f", from[0], from[1], to[0], to[1]);
+}
@@ -0,0 +1,328 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "harvesine_lib.h"
+#include "dispatch.hpp" // the number parser and haversine variants for this cpu
+#include "endpoint_cache.hpp"
+
+enum HarvesineScanState : u32 {
+  ScanState_Between,
+  ScanState_String,
+  ScanState_Number,
+};
+
+///////////////////////////////////////////////////////////////
+/// Incremental scanner
+static bool is_number_char(u8 ch) {
+  return (ch >= '0' && ch <= '9') || ch == '-' || ch == '+' || ch == '.' || ch == 'e' || ch == 'E';
+}
+
+// the number is bytes[begin..end], the simd parsers look at the bytes before it when there are some
+static f64 parse_number_text(const u8* bytes, u64 begin, u64 end) {
+  for (u64 i = begin; i <= end; ++i) {
+    if (bytes[i] == 'e' || bytes[i] == 'E') {
+      // rare enough to hand it to libc
+      char terminated[HARVESINE_MAX_NUMBER_LENGTH + 1];
+      u64 length = end - begin + 1;
+      u64 copy_length = length < HARVESINE_MAX_NUMBER_LENGTH ? length : HARVESINE_MAX_NUMBER_LENGTH;
+      memcpy(terminated, bytes + begin, copy_length);
+      terminated[copy_length] = 0;
+      return strtod(terminated, NULL);
+    }
+  }
+
+  struct Buffer buffer = {end + 1, (u8*)bytes};
+  return global_kernels.parse_number(&buffer, begin, end);
+}
+
+static void flush_staged(HarvesineContext* context) {
+  if (context->staged_count) {
+    harvesine_add_pairs(context, context->x0, context->y0, context->x1, context->y1, context->staged_count);
+    context->staged_count = 0;
+  }
+}
+
+static void store_value(HarvesineContext* context, f64 value) {
+  // keys decide the slot, plain arrays of four numbers fall back to the position
+  u32 slot = (context->key_slot >= 0) ? (u32)context->key_slot : (context->value_index & 3);
+  context->key_slot = -1;
+
+  context->values[slot] = value;
+  context->filled_mask |= 1u << slot;
+  ++context->value_index;
+
+  if (context->filled_mask == 0xF) {
+    u64 index = context->staged_count++;
+    context->x0[index] = context->values[0];
+    context->y0[index] = context->values[1];
+    context->x1[index] = context->values[2];
+    context->y1[index] = context->values[3];
+
+    context->filled_mask = 0;
+    context->value_index = 0;
+
+    if (context->staged_count == HARVESINE_BATCH_SIZE) {
+      flush_staged(context);
+    }
+  }
+}
+
+static void set_key(HarvesineContext* context, const u8* key, u64 length) {
+  context->key_slot = -1;
+  if (length == 2 && (key[0] == 'x' || key[0] == 'y') && (key[1] == '0' || key[1] == '1')) {
+    context->key_slot = (key[1] - '0') * 2 + (key[0] == 'y');
+  }
+}
+
+static void finish_string(HarvesineContext* context) {
+  set_key(context, context->text, context->text_length);
+  context->scan_state = ScanState_Between;
+}
+
+// NOTE: escaped quotes are not handled, keys in this format never have them
+static u64 continue_string(HarvesineContext* context, const u8* bytes, u64 size, u64 offset) {
+  const u8* quote = (const u8*)memchr(bytes + offset, '"', size - offset);
+  u64 end = quote ? (u64)(quote - bytes) : size;
+
+  // only short keys matter, the rest of a long string is just skipped
+  for (u64 i = offset; i < end && context->text_length < HARVESINE_MAX_NUMBER_LENGTH; ++i) {
+    context->text[context->text_length++] = bytes[i];
+  }
+
+  if (quote) {
+    finish_string(context);
+    return end + 1;
+  }
+
+  return size;
+}
+
+static u64 continue_number(HarvesineContext* context, const u8* bytes, u64 size, u64 offset) {
+  while (offset < size && is_number_char(bytes[offset])) {
+    if (context->text_length < HARVESINE_MAX_NUMBER_LENGTH) {
+      context->text[context->text_length++] = bytes[offset];
+    }
+    ++offset;
+  }
+
+  if (offset < size) {
+    store_value(context, parse_number_text(context->text, 0, context->text_length - 1));
+    context->scan_state = ScanState_Between;
+  }
+
+  return offset;
+}
+
+// the rest of the feed goes into text, the next feed continues from there
+static void carry_over(HarvesineContext* context, HarvesineScanState state, const u8* bytes, u64 size, u64 begin) {
+  context->text_length = 0;
+  context->scan_state = state;
+  if (state == ScanState_String) {
+    continue_string(context, bytes, size, begin);
+  } else {
+    continue_number(context, bytes, size, begin);
+  }
+}
+
+// the lexer's masks (dispatch.hpp), with the quotes as events too: an opening one starts a key, a
+// closing one ends it, and the edges of the number runs start and end the values. the masks have no
+// exponents, a number that ends at e or E is finished by the scalar scanner and the events inside
+// it are skipped. the feed starts between values, the events past size are the zeros of the last block
+static void scan_blocks(HarvesineContext* context, const Kernels* kernels, const u8* bytes, u64 size, u64 offset) {
+  u64 in_string = 0;
+  u64 in_number = 0;
+  u64 string_begin = 0;
+  u64 number_begin = 0;
+  bool number_open = false;
+  u64 skip_until = 0;
+
+  for (u64 base = offset; base < size; base += 64) {
+    BlockMasks masks;
+    if (base + 64 <= size) {
+      masks = kernels->classify_block(bytes + base);
+    } else {
+      u8 tail[64] = {};
+      memcpy(tail, bytes + base, size - base);
+      masks = kernels->classify_block(tail);
+    }
+
+    u64 strings = prefix_xor(masks.quotes) ^ in_string;
+    in_string = (u64)((i64)strings >> 63);
+
+    u64 numbers = masks.numbers & ~(strings | masks.quotes);
+    u64 previous = (numbers << 1) | in_number;
+    in_number = numbers >> 63;
+
+    u64 starts = numbers & ~previous;
+    u64 ends = previous & ~numbers;
+    u64 events = masks.quotes | starts | ends;
+    while (events) {
+      u64 bit = (u64)__builtin_ctzll(events);
+      events &= events - 1;
+      u64 at = base + bit;
+      if (at < skip_until) {
+        continue;
+      }
+
+      if (((ends >> bit) & 1) && number_open) {
+        number_open = false;
+        if (at >= size) {
+          carry_over(context, ScanState_Number, bytes, size, number_begin);
+          return;
+        }
+
+        if (bytes[at] == 'e' || bytes[at] == 'E') {
+          u64 end = at;
+          while (end < size && is_number_char(bytes[end])) {
+            ++end;
+          }
+          if (end == size) {
+            carry_over(context, ScanState_Number, bytes, size, number_begin);
+            return;
+          }
+          skip_until = end;
+          store_value(context, parse_number_text(bytes, number_begin, end - 1));
+        } else {
+          // no exponent, straight to the parser
+          struct Buffer buffer = {at, (u8*)bytes};
+          store_value(context, kernels->parse_number(&buffer, number_begin, at - 1));
+        }
+      }
+
+      if ((starts >> bit) & 1) {
+        number_begin = at;
+        number_open = true;
+      } else if ((masks.quotes >> bit) & 1) {
+        if ((strings >> bit) & 1) {
+          string_begin = at + 1;
+        } else {
+          set_key(context, bytes + string_begin, at - string_begin);
+        }
+      }
+    }
+  }
+
+  // a number is only finished by the byte after it
+  if (number_open) {
+    carry_over(context, ScanState_Number, bytes, size, number_begin);
+  } else if (in_string) {
+    carry_over(context, ScanState_String, bytes, size, string_begin);
+  }
+}
+
+///////////////////////////////////////////////////////////////
+/// Precision
+// the pairs come in as f64 from the parser or the caller, they are narrowed a batch at a time
+static void haversine_batch_f32(const HarvesineContext* context, const Kernels* kernels, const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count, f64* distances) {
+  f32 narrow[5][HARVESINE_BATCH_SIZE];
+  for (u64 i = 0; i < count; ++i) {
+    narrow[0][i] = (f32)x0[i];
+    narrow[1][i] = (f32)y0[i];
+    narrow[2][i] = (f32)x1[i];
+    narrow[3][i] = (f32)y1[i];
+  }
+
+  kernels->haversine_f32(narrow[0], narrow[1], narrow[2], narrow[3], count, (f32)context->earth_radius, narrow[4]);
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = narrow[4][i];
+  }
+}
+
+///////////////////////////////////////////////////////////////
+/// Public API
+void harvesine_init(HarvesineContext* context, f64 earth_radius) {
+  memset(context, 0, sizeof(*context));
+  context->earth_radius = earth_radius;
+  context->key_slot = -1;
+  sum_init(&context->sum, SumMode_Neumaier);
+
+  select_kernels();
+}
+
+void harvesine_set_precision(HarvesineContext* context, HarvesinePrecision precision) {
+  // staged pairs still go with the precision they were fed under
+  flush_staged(context);
+  context->precision = precision;
+}
+
+void harvesine_set_summation(HarvesineContext* context, SumMode mode) {
+  flush_staged(context);
+  if (mode == context->sum.mode) {
+    return;
+  }
+
+  u64 count = context->sum.count;
+  Summation carried;
+  sum_init(&carried, mode);
+  f64 total = sum_result(&context->sum);
+  sum_values(&carried, &total, 1);
+
+  // the lanes are still zeros, the count only says which of them the next distances go to
+  sum_init(&context->sum, mode);
+  sum_merge(&context->sum, &carried);
+  context->sum.count = count;
+}
+
+void harvesine_set_endpoint_cache(HarvesineContext* context, EndpointCache* cache) {
+  flush_staged(context);
+  context->endpoint_cache = cache;
+}
+
+void harvesine_feed(HarvesineContext* context, const u8* bytes, u64 size) {
+  TIME_BANDWIDTH("feed", size)
+
+  context->bytes_fed += size;
+
+  // finish whatever the previous feed cut in half
+  u64 offset = 0;
+  if (context->scan_state == ScanState_String) {
+    offset = continue_string(context, bytes, size, offset);
+  } else if (context->scan_state == ScanState_Number) {
+    offset = continue_number(context, bytes, size, offset);
+  }
+
+  if (context->scan_state == ScanState_Between) {
+    scan_blocks(context, select_kernels(), bytes, size, offset);
+  }
+}
+
+void harvesine_add_pairs(HarvesineContext* context, const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count) {
+  TIME_BANDWIDTH("harvesine sum", count * 4 * sizeof(f64))
+
+  // distances a batch at a time, the summation variants all give the same bits
+  const Kernels* kernels = select_kernels();
+  f64 distances[HARVESINE_BATCH_SIZE];
+
+  for (u64 i = 0; i < count; i += HARVESINE_BATCH_SIZE) {
+    u64 batch = count - i < HARVESINE_BATCH_SIZE ? count - i : HARVESINE_BATCH_SIZE;
+    if (context->precision == HarvesinePrecision_F32) {
+      haversine_batch_f32(context, kernels, x0 + i, y0 + i, x1 + i, y1 + i, batch, distances);
+    } else if (context->endpoint_cache && endpoint_cache_pays_off(context->endpoint_cache)) {
+      // the same kernel level with the latitude cosines looked up, the same bits either way
+      f64 cosines[2][HARVESINE_BATCH_SIZE];
+      endpoint_cosines(context->endpoint_cache, y0 + i, y1 + i, batch, cosines[0], cosines[1]);
+      kernels->haversine_cached(x0 + i, y0 + i, x1 + i, y1 + i, cosines[0], cosines[1], batch, context->earth_radius, distances);
+    } else {
+      kernels->haversine(x0 + i, y0 + i, x1 + i, y1 + i, batch, context->earth_radius, distances);
+      if (context->endpoint_cache) {
+        context->endpoint_cache->skipped += batch;
+      }
+    }
+
+    kernels->sum_values(&context->sum, distances, batch);
+  }
+}
+
+HarvesineResult harvesine_result(HarvesineContext* context) {
+  flush_staged(context);
+
+  HarvesineResult result = {};
+  result.sum = sum_result(&context->sum);
+  result.pairs_count = context->sum.count;
+  result.bytes_fed = context->bytes_fed;
+  if (result.pairs_count) {
+    result.mean = result.sum / (f64)result.pairs_count;
+  }
+
+  return result;
+}
@@ -0,0 +1,73 @@
+#ifndef _HARVESINE_LIB_H_
+#define _HARVESINE_LIB_H_
+
+#include "types.h"
+#include "summation.hpp"
+
+// pairs parsed by harvesine_feed are staged and summed in batches of this size
+#define HARVESINE_BATCH_SIZE 1024
+#define HARVESINE_MAX_NUMBER_LENGTH 63
+
+enum HarvesinePrecision : u32 {
+  HarvesinePrecision_F64, // polynomial trig within 1e-12 of reference_haversine, the same on every cpu, see dispatch.hpp
+  HarvesinePrecision_F32, // f32 coordinates and polynomial trig, around a metre off, see precision.hpp
+};
+
+struct EndpointCache; // endpoint_cache.hpp
+
+struct HarvesineResult {
+  f64 mean;
+  f64 sum;
+  u64 pairs_count;
+  u64 bytes_fed;
+};
+
+struct HarvesineContext {
+  f64 earth_radius;
+  HarvesinePrecision precision;
+  Summation sum; // the distances, neumaier unless changed
+  EndpointCache* endpoint_cache;
+
+  u64 bytes_fed;
+
+  // incremental json scanner, everything needed to continue a number or string cut by a feed boundary
+  u32 scan_state;
+  u32 text_length;
+  u8 text[HARVESINE_MAX_NUMBER_LENGTH + 1];
+  i32 key_slot;    // which of x0, y0, x1, y1 the last key named, -1 when unknown
+  u32 value_index; // values seen in the current pair
+  u32 filled_mask;
+  f64 values[4];
+
+  // parsed pairs waiting to be summed, structure of arrays
+  u64 staged_count;
+  f64 x0[HARVESINE_BATCH_SIZE];
+  f64 y0[HARVESINE_BATCH_SIZE];
+  f64 x1[HARVESINE_BATCH_SIZE];
+  f64 y1[HARVESINE_BATCH_SIZE];
+};
+
+void harvesine_init(HarvesineContext* context, f64 earth_radius);
+
+// F64 unless changed, applies to the pairs summed from here on
+void harvesine_set_precision(HarvesineContext* context, HarvesinePrecision precision);
+
+// how the distances are summed, see summation.hpp. the total so far carries over as one value
+void harvesine_set_summation(HarvesineContext* context, SumMode mode);
+
+// f64 pairs take the cosines of their latitudes from the cache, which the caller owns and
+// endpoint_cache_init has set up. every level has a kernel that takes them and the sum stays the
+// same bits, it pays off when endpoints repeat. NULL turns it off again
+void harvesine_set_endpoint_cache(HarvesineContext* context, EndpointCache* cache);
+
+// feeds any part of a pairs json, numbers and keys may be split across calls.
+// a number counts once the byte after it is fed, the closing ]} of the file does that
+void harvesine_feed(HarvesineContext* context, const u8* bytes, u64 size);
+
+// adds already parsed pairs, the arrays are read in place
+void harvesine_add_pairs(HarvesineContext* context, const f64* x0, const f64* y0, const f64* x1, const f64* y1, u64 count);
+
+// sums any staged pairs first, the context can keep being fed afterwards
+HarvesineResult harvesine_result(HarvesineContext* context);
+
+#endif // _HARVESINE_LIB_H_
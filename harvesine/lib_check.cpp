@@ -0,0 +1,194 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "harvesine_lib.h"
+
+// lib_check [coords json]
+// feeds the json to the library whole, then again cut into slices of every odd size, and the
+// results have to come out the same to the bit. without a file it writes its own pairs, with
+// keys in any order and numbers of any length or with exponents, and also checks them against harvesine_add_pairs
+
+#define CHECK_PAIRS_COUNT 3000
+#define CHECK_EARTH_RADIUS 6372.8
+
+struct CheckInput {
+  u8* data;
+  u64 size;
+
+  // only known for the pairs written here
+  f64* x0;
+  f64* y0;
+  f64* x1;
+  f64* y1;
+  u64 pairs_count;
+};
+
+static u64 random_state = 0x2545f4914f6cdd1dull;
+
+static u64 next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static f64 random_degrees(f64 range) {
+  return ((f64)(next_random() >> 11) / (f64)(1ull << 53) * 2.0 - 1.0) * range;
+}
+
+///////////////////////////////////////////////////////////////
+/// Input
+static bool write_pairs(CheckInput* input) {
+  u64 capacity = CHECK_PAIRS_COUNT * 160 + 64;
+  input->data = (u8*)malloc(capacity);
+  input->x0 = (f64*)malloc(4 * CHECK_PAIRS_COUNT * sizeof(f64));
+  if (input->data == NULL || input->x0 == NULL) {
+    return false;
+  }
+  input->y0 = input->x0 + CHECK_PAIRS_COUNT;
+  input->x1 = input->y0 + CHECK_PAIRS_COUNT;
+  input->y1 = input->x1 + CHECK_PAIRS_COUNT;
+  input->pairs_count = CHECK_PAIRS_COUNT;
+
+  static const char* key_names[4] = {"x0", "y0", "x1", "y1"};
+  static const char* formats[4] = {"%f", "%.12f", "%.3f", "%.9e"};
+
+  char* out = (char*)input->data;
+  out += sprintf(out, "{\"pairs\":[\n");
+  for (u64 i = 0; i < CHECK_PAIRS_COUNT; ++i) {
+    f64* slots[4] = {input->x0 + i, input->y0 + i, input->x1 + i, input->y1 + i};
+    u32 first = (u32)(i % 4); // keys don't come in order
+
+    out += sprintf(out, "  {");
+    for (u32 k = 0; k < 4; ++k) {
+      u32 slot = (first + k) & 3;
+      char number[64];
+      snprintf(number, sizeof(number), formats[next_random() % 4], random_degrees(slot & 1 ? 90.0 : 180.0));
+
+      // what the text says, not the value it was printed from
+      *slots[slot] = strtod(number, NULL);
+      out += sprintf(out, "%s\"%s\":%s", k ? ", " : "", key_names[slot], number);
+    }
+    out += sprintf(out, i < CHECK_PAIRS_COUNT - 1 ? "},\n" : "}\n");
+  }
+  out += sprintf(out, "]}");
+
+  input->size = (u64)(out - (char*)input->data);
+  return true;
+}
+
+static bool read_pairs(CheckInput* input, const char* name) {
+  FILE* file = fopen(name, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", name);
+    return false;
+  }
+
+  struct stat file_stat;
+  stat(name, &file_stat);
+  input->size = file_stat.st_size;
+  input->data = (u8*)malloc(input->size + 1);
+
+  bool ok = input->data && fread(input->data, input->size, 1, file) == 1;
+  fclose(file);
+  if (!ok) {
+    fprintf(stderr, "ERROR: Unable to read %s\n", name);
+  }
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////
+/// Feeding
+static HarvesineResult feed_whole(const CheckInput* input, HarvesineContext* context) {
+  harvesine_init(context, CHECK_EARTH_RADIUS);
+  harvesine_feed(context, input->data, input->size);
+  return harvesine_result(context);
+}
+
+// slices of 1 to max_slice bytes, the sizes picked at random
+static HarvesineResult feed_sliced(const CheckInput* input, HarvesineContext* context, u64 max_slice) {
+  harvesine_init(context, CHECK_EARTH_RADIUS);
+  for (u64 offset = 0; offset < input->size;) {
+    u64 slice = 1 + next_random() % max_slice;
+    if (slice > input->size - offset) {
+      slice = input->size - offset;
+    }
+    harvesine_feed(context, input->data + offset, slice);
+    offset += slice;
+  }
+  return harvesine_result(context);
+}
+
+// two feeds, the cut is in the middle of the first number
+static HarvesineResult feed_split_number(const CheckInput* input, HarvesineContext* context) {
+  const u8* colon = (const u8*)memchr(input->data, ':', input->size);
+  const u8* number = colon ? (const u8*)memchr(colon + 1, ':', input->size - (colon + 1 - input->data)) : NULL;
+  u64 cut = number ? (u64)(number - input->data) + 4 : input->size / 2;
+
+  harvesine_init(context, CHECK_EARTH_RADIUS);
+  harvesine_feed(context, input->data, cut);
+  harvesine_feed(context, input->data + cut, input->size - cut);
+  return harvesine_result(context);
+}
+
+static bool same_result(const char* name, HarvesineResult expected, HarvesineResult result) {
+  if (result.pairs_count != expected.pairs_count || memcmp(&result.sum, &expected.sum, sizeof(f64)) != 0 || result.bytes_fed != expected.bytes_fed) {
+    printf("%-24s FAILED: %lu pairs summing to %.17g, %lu expected summing to %.17g\n",
+           name, result.pairs_count, result.sum, expected.pairs_count, expected.sum);
+    return false;
+  }
+  printf("%-24s ok\n", name);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [coords json]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  CheckInput input = {};
+  if (!(argc == 2 ? read_pairs(&input, argv[1]) : write_pairs(&input))) {
+    return EXIT_FAILURE;
+  }
+
+  // the context holds a batch of staged pairs, too big for the stack of every platform
+  HarvesineContext* context = (HarvesineContext*)malloc(sizeof(HarvesineContext));
+  if (context == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  HarvesineResult whole = feed_whole(&input, context);
+  printf("%lu bytes, %lu pairs, mean %f\n", input.size, whole.pairs_count, whole.mean);
+
+  if (input.pairs_count) {
+    // the same pairs handed over already parsed, the parser may round a last bit differently than strtod
+    harvesine_init(context, CHECK_EARTH_RADIUS);
+    harvesine_add_pairs(context, input.x0, input.y0, input.x1, input.y1, input.pairs_count);
+    HarvesineResult added = harvesine_result(context);
+
+    bool close = added.pairs_count == input.pairs_count && whole.pairs_count == input.pairs_count && fabs(added.sum - whole.sum) <= 1e-9 * fabs(added.sum);
+    printf("%-24s %s\n", "add pairs", close ? "ok" : "FAILED");
+    ok &= close;
+  }
+
+  ok &= same_result("number split in two", whole, feed_split_number(&input, context));
+
+  static const u64 max_slices[] = {1, 2, 3, 7, 16, 61, 1000, 100003};
+  for (u32 i = 0; i < sizeof(max_slices) / sizeof(max_slices[0]); ++i) {
+    char name[64];
+    snprintf(name, sizeof(name), "slices up to %lu bytes", max_slices[i]);
+    ok &= same_result(name, whole, feed_sliced(&input, context, max_slices[i]));
+  }
+
+  free(context);
+  free(input.data);
+  free(input.x0);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
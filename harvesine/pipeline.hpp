@@ -0,0 +1,274 @@
+#ifndef _PIPELINE_HPP_
+#define _PIPELINE_HPP_
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "types.h"      // custom type aliases
+#include "profiler.hpp" // custom profiler, PROFILER has to be set before the first include
+#include "arena.hpp"    // linear allocator all stages push their output to
+
+#define EARTH_RADIUS 6372.8
+
+struct Buffer {
+  u64 size;
+  u8* data;
+};
+
+struct TokenItem {
+  u64 begin;
+  u64 end;
+};
+
+struct Coords {
+  f64 a;
+  f64 b;
+  f64 c;
+  f64 d;
+};
+
+// json tokeniser, tokens are pushed to the arena back to back, returns number of tokens
+[[maybe_unused]] static u64 lexer(const struct Buffer* const buffer, Arena* arena, struct TokenItem** tokens);
+static struct TokenItem lex_number(const struct Buffer* const buffer, u64* offset);
+
+// tokens parser, pairs are pushed to the arena back to back, returns number of pairs
+[[maybe_unused]] static u64 parser(const struct Buffer* const buffer, const struct TokenItem* const tokens, const u64 tokens_size, Arena* arena, struct Coords** pairs);
+static f64 parse_number(const struct Buffer* const buffer, const u64 begin, const u64 end);
+[[maybe_unused]] static f64 parse_number_fast(const struct Buffer* const buffer, const u64 begin, const u64 end);
+
+// harvesine calculations
+[[maybe_unused]] static f64 reference_haversine(f64 x0, f64 y0, f64 x1, f64 y1, f64 earth_radius);
+
+//helpers
+static f64 square(f64 a);
+static f64 degrees_to_radians(f64 degrees);
+
+static u64 lexer(const struct Buffer* const buffer, Arena* arena, struct TokenItem** tokens) {
+  TIME_FUNC;
+
+  *tokens = (struct TokenItem*)(arena->base + arena->used);
+
+  u64 offset = 0;
+  u64 index = 0;
+  while (offset < buffer->size) {
+    switch (buffer->data[offset]) {
+      // if we see - or 0..9 symbols we found number
+      case '-':
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9': {
+        struct TokenItem* token_item = arena_push_struct(arena, TokenItem);
+        if (!token_item) {
+          return index;
+        }
+
+        if (index == 0) {
+          *tokens = token_item;
+        }
+
+        *token_item = lex_number(buffer, &offset);
+        ++index;
+        break;
+      }
+      // strings are skipped whole, keys like "x1" have digits in them
+      case '"': {
+        ++offset;
+        while (offset < buffer->size && buffer->data[offset] != '"') {
+          ++offset;
+        }
+        break;
+      }
+      // everything else we ignore
+      case ',':
+      case ':':
+      case ' ':
+      default: break;
+    }
+    ++offset;
+  }
+
+  return index;
+}
+
+static struct TokenItem lex_number(const struct Buffer* const buffer, u64* offset) {
+  TIME_FUNC;
+
+  struct TokenItem token_item;
+
+  token_item.begin = (*offset);
+
+  while (*offset < buffer->size) {
+    const u8 ch = buffer->data[*offset];
+    if ((ch < '0' || ch > '9') && ch != '-' && ch != '.') {
+      break;
+    }
+    ++(*offset);
+  }
+
+  token_item.end = (*offset) - 1;
+
+  return token_item;
+}
+
+static u64 parser(const struct Buffer* const buffer, const struct TokenItem* const tokens, const u64 tokens_size, Arena* arena, struct Coords** pairs) {
+  TIME_FUNC;
+
+  *pairs = (struct Coords*)(arena->base + arena->used);
+
+  struct Coords coords;
+  u8 counter = 0;
+  u64 n = 0;
+  f64 value = 0.0;
+  for (size_t i = 0; i < tokens_size; ++i) {
+    value = parse_number(buffer, tokens[i].begin, tokens[i].end);
+    counter++;
+
+    switch (counter) {
+      case 1:
+        coords.a = value;
+        break;
+      case 2:
+        coords.b = value;
+        break;
+      case 3:
+        coords.c = value;
+        break;
+      case 4:
+        coords.d = value;
+        break;
+      default:
+        break;
+    }
+
+    if (counter == 4) {
+      counter = 0;
+
+      struct Coords* pair = arena_push_struct(arena, Coords);
+      if (!pair) {
+        break;
+      }
+
+      if (n == 0) {
+        *pairs = pair;
+      }
+
+      *pair = coords;
+      ++n;
+    }
+  }
+
+  return n;
+}
+
+static f64 parse_number(const struct Buffer* const buffer, const u64 begin, const u64 end) {
+  TIME_FUNC;
+
+  bool fractional = false;
+
+  f64 value = 0.0;
+
+  i8 sign = 1;
+
+  f64 digit = 10.0;
+  for (size_t i = begin; i <= end; ++i) {
+    const u8 ch = buffer->data[i];
+    if (ch == '-') {
+      sign = -1;
+      continue;
+    }
+
+    if (ch == '.') {
+      fractional = true;
+      digit = 1;
+      continue;
+    }
+
+    u8 number = ch - '0';
+
+    if (fractional) {
+      digit *= 10;
+      value = value + (number / digit);
+    } else {
+      value = value * 10 + number;
+    }
+
+  }
+
+  value *= sign;
+  return value;
+}
+
+// digits are accumulated as integers and the fraction is divided once at the end
+static f64 parse_number_fast(const struct Buffer* const buffer, const u64 begin, const u64 end) {
+  const u8* at = buffer->data + begin;
+  const u8* stop = buffer->data + end + 1;
+
+  f64 sign = 1.0;
+  if (at < stop && *at == '-') {
+    sign = -1.0;
+    ++at;
+  }
+
+  u64 integer = 0;
+  while (at < stop && *at != '.') {
+    integer = integer * 10 + (*at++ - '0');
+  }
+
+  f64 value = (f64)integer;
+  if (at < stop) {
+    ++at;
+
+    u64 fraction = 0;
+    f64 scale = 1.0;
+    while (at < stop) {
+      fraction = fraction * 10 + (*at++ - '0');
+      scale *= 10.0;
+    }
+
+    value += (f64)fraction / scale;
+  }
+
+  return sign * value;
+}
+
+// NOTE(casey): EarthRadius is generally expected to be 6372.8
+static f64 reference_haversine(f64 x0, f64 y0, f64 x1, f64 y1, f64 earth_radius) {
+  // NOTE(casey): This is not meant to be a "good" way to calculate the Haversine distance.
+  //  Instead, it attempts to follow, as closely as possible, the formula used in the real-world
+  //  question on which these homework exercises are loosely based.
+
+  f64 lat1 = y0;
+  f64 lat2 = y1;
+  f64 lon1 = x0;
+  f64 lon2 = x1;
+
+  f64 dLat = degrees_to_radians(lat2 - lat1);
+  f64 dLon = degrees_to_radians(lon2 - lon1);
+  lat1 = degrees_to_radians(lat1);
+  lat2 = degrees_to_radians(lat2);
+
+  f64 a = square(sin(dLat / 2.0)) + cos(lat1) * cos(lat2) * square(sin(dLon / 2));
+  f64 c = 2.0 * asin(sqrt(a));
+
+  f64 result = earth_radius * c;
+
+  return result;
+}
+
+static f64 square(f64 a) {
+  return a * a;
+}
+
+static f64 degrees_to_radians(f64 degrees) {
+  f64 result = 0.01745329251994329577 * degrees;
+  return result;
+}
+
+#endif // _PIPELINE_HPP_
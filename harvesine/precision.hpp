@@ -0,0 +1,193 @@
+#ifndef _PRECISION_HPP_
+#define _PRECISION_HPP_
+
+#include <math.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "pipeline.hpp" // reference_haversine is what the errors are measured against
+
+// f32 precision mode: coordinates as f32 and sin, cos and asin as polynomials, half the bytes per
+// pair and twice the lanes per register. f32 coordinates alone are ~1.7 m apart at 170 degrees
+// and a distance of 10000 km has a ~1 m ulp, the approximations are held to a few ulps under that.
+// the kernel is plain scalar code without branches or libm calls, the compiler vectorizes it for
+// each target, which takes -fno-math-errno and -fno-trapping-math for the sqrt and the selects
+typedef void haversine_f32_func(const f32* x0, const f32* y0, const f32* x1, const f32* y1, u64 count, f32 earth_radius, f32* distances);
+
+// how far the f32 distances are from reference_haversine, errors in metres and f32 ulps of the reference
+struct PrecisionReport {
+  u64 count;
+  f64 max_error;
+  f64 mean_error;
+  f64 max_ulp;
+  f64 mean_ulp;
+  f64 reference_mean; // km, the f64 average and the f32 one
+  f64 mean;
+};
+
+[[maybe_unused]] static PrecisionReport measure_precision(const f64* x0, const f64* y0, const f64* x1, const f64* y1, const f32* distances, u64 count, f64 earth_radius);
+[[maybe_unused]] static void print_precision_report(const char* name, const PrecisionReport* report);
+
+static void haversine_f32_scalar(const f32* x0, const f32* y0, const f32* x1, const f32* y1, u64 count, f32 earth_radius, f32* distances);
+
+
+///////////////////////////////////////////////////////////////
+/// Approximations
+// least squares on chebyshev nodes for sin(x) / x in x^2 over [0, pi/2], 1.4e-7 relative at most
+static inline f32 sin_f32_quadrant(f32 x) {
+  f32 x2 = x * x;
+  f32 p = 2.608390105e-06f;
+  p = p * x2 - 1.981075038e-04f;
+  p = p * x2 + 8.333079517e-03f;
+  p = p * x2 - 1.666665971e-01f;
+  p = p * x2 + 1.0f;
+  return x * p;
+}
+
+// pi and pi / 2 as the nearest f32 and what is left over, subtracting the parts one after the other
+// keeps the folded argument good to the last bit (cody and waite)
+#define PI_F32_HIGH 3.14159274101257f
+#define PI_F32_LOW -8.74227766e-08f
+#define HALF_PI_F32_HIGH 1.57079637050629f
+#define HALF_PI_F32_LOW -4.37113883e-08f
+
+// any x, folded to [-pi, pi] and then into the quadrant by sin(pi - x) = sin(x)
+static inline f32 sin_f32(f32 x) {
+  const f32 rounder = 12582912.0f; // 1.5 * 2^23, adding and taking it away rounds to an integer
+
+  f32 turns = (x * (0.5f / PI_F32_HIGH) + rounder) - rounder;
+  x = (x - turns * (2.0f * PI_F32_HIGH)) - turns * (2.0f * PI_F32_LOW);
+
+  f32 magnitude = fabsf(x);
+  f32 folded = (PI_F32_HIGH - magnitude) + PI_F32_LOW;
+  magnitude = folded < magnitude ? folded : magnitude;
+  return copysignf(sin_f32_quadrant(magnitude), x);
+}
+
+static inline f32 cos_f32(f32 x) {
+  return sin_f32((HALF_PI_F32_HIGH - fabsf(x)) + HALF_PI_F32_LOW);
+}
+
+// cephes asinf, above 0.5 it goes through asin(x) = pi/2 - 2 asin(sqrt((1 - x) / 2)).
+// both sides are computed and picked between so there is no branch
+static inline f32 asin_f32(f32 x) {
+  bool high = x > 0.5f;
+  f32 z_high = 0.5f * (1.0f - x);
+  f32 z_low = x * x;
+  f32 z = high ? z_high : z_low;
+  f32 root = sqrtf(z);
+  f32 a = high ? root : x;
+
+  f32 p = 4.2163199048e-2f;
+  p = p * z + 2.4181311049e-2f;
+  p = p * z + 4.5470025998e-2f;
+  p = p * z + 7.4953002686e-2f;
+  p = p * z + 1.6666752422e-1f;
+  f32 r = p * z * a + a;
+
+  f32 r_high = (HALF_PI_F32_HIGH - (r + r)) + HALF_PI_F32_LOW;
+  return high ? r_high : r;
+}
+
+///////////////////////////////////////////////////////////////
+/// Kernel
+// near antipodal points a is close to 1, and asin(sqrt(a)) turns the f32 rounding of a into
+// hundreds of metres. a and 1 - a are both written as sums of squares, so neither cancels:
+//   a     = sin^2(dlat / 2) cos^2(dlon / 2) + cos^2(mean lat) sin^2(dlon / 2)
+//   1 - a = cos^2(dlat / 2) cos^2(dlon / 2) + sin^2(mean lat) sin^2(dlon / 2)
+// and above 0.5 the angle comes from the second one
+static inline f32 haversine_f32_pair(f32 x0, f32 y0, f32 x1, f32 y1, f32 earth_radius) {
+  const f32 to_radians = 0.01745329251994329577f;
+
+  f32 half_lat = (y1 - y0) * (to_radians * 0.5f);
+  f32 mean_lat = (y1 + y0) * (to_radians * 0.5f);
+  f32 half_lon = (x1 - x0) * (to_radians * 0.5f);
+
+  f32 sin_lat = sin_f32(half_lat);
+  f32 cos_lat = cos_f32(half_lat);
+  f32 sin_mean = sin_f32(mean_lat);
+  f32 cos_mean = cos_f32(mean_lat);
+  f32 sin_lon = sin_f32(half_lon);
+  f32 cos_lon = cos_f32(half_lon);
+
+  f32 sin_lon2 = sin_lon * sin_lon;
+  f32 cos_lon2 = cos_lon * cos_lon;
+  f32 a = sin_lat * sin_lat * cos_lon2 + cos_mean * cos_mean * sin_lon2;
+  f32 complement = cos_lat * cos_lat * cos_lon2 + sin_mean * sin_mean * sin_lon2;
+
+  bool far = a > 0.5f;
+  f32 angle = asin_f32(sqrtf(far ? complement : a));
+  f32 far_angle = (HALF_PI_F32_HIGH - angle) + HALF_PI_F32_LOW;
+  return earth_radius * 2.0f * (far ? far_angle : angle);
+}
+
+static void haversine_f32_scalar(const f32* x0, const f32* y0, const f32* x1, const f32* y1, u64 count, f32 earth_radius, f32* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f32_pair(x0[i], y0[i], x1[i], y1[i], earth_radius);
+  }
+}
+
+#if defined(__x86_64__)
+
+// the same loop again, vectorized for the wider registers and with fma
+__attribute__((target("avx2,fma")))
+static void haversine_f32_avx2(const f32* x0, const f32* y0, const f32* x1, const f32* y1, u64 count, f32 earth_radius, f32* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f32_pair(x0[i], y0[i], x1[i], y1[i], earth_radius);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl,fma")))
+static void haversine_f32_avx512(const f32* x0, const f32* y0, const f32* x1, const f32* y1, u64 count, f32 earth_radius, f32* distances) {
+  for (u64 i = 0; i < count; ++i) {
+    distances[i] = haversine_f32_pair(x0[i], y0[i], x1[i], y1[i], earth_radius);
+  }
+}
+
+#endif // __x86_64__
+
+///////////////////////////////////////////////////////////////
+/// Error report
+static PrecisionReport measure_precision(const f64* x0, const f64* y0, const f64* x1, const f64* y1, const f32* distances, u64 count, f64 earth_radius) {
+  PrecisionReport report = {};
+  report.count = count;
+
+  f64 error_sum = 0.0;
+  f64 ulp_sum = 0.0;
+  f64 reference_sum = 0.0;
+  f64 sum = 0.0;
+  for (u64 i = 0; i < count; ++i) {
+    f64 reference = reference_haversine(x0[i], y0[i], x1[i], y1[i], earth_radius);
+    f64 error = fabs((f64)distances[i] - reference);
+
+    // the spacing of f32 values around the reference
+    f64 ulp = ldexp(1.0, ilogbf((f32)reference) - 23);
+    f64 ulps = reference != 0.0 ? error / ulp : 0.0;
+
+    report.max_error = error > report.max_error ? error : report.max_error;
+    report.max_ulp = ulps > report.max_ulp ? ulps : report.max_ulp;
+    error_sum += error;
+    ulp_sum += ulps;
+    reference_sum += reference;
+    sum += distances[i];
+  }
+
+  if (count) {
+    // km to m
+    report.max_error *= 1000.0;
+    report.mean_error = error_sum / (f64)count * 1000.0;
+    report.mean_ulp = ulp_sum / (f64)count;
+    report.reference_mean = reference_sum / (f64)count;
+    report.mean = sum / (f64)count;
+  }
+
+  return report;
+}
+
+static void print_precision_report(const char* name, const PrecisionReport* report) {
+  printf("%-24s | max %10.3f m | mean %8.3f m | max %6.2f ulp | mean %5.2f ulp | average off by %.3f m\n",
+         name, report->max_error, report->mean_error, report->max_ulp, report->mean_ulp,
+         fabs(report->mean - report->reference_mean) * 1000.0);
+}
+
+#endif // _PRECISION_HPP_
@@ -27,8 +27,19 @@ struct ProfileAnchor {
   u32 parent;
 };
 
-static ProfileAnchor global_anchors[4096];
-static u32 global_profiler_parent;
+// inline so the driver and the library it links share one set, anchor 0 is the root
+inline ProfileAnchor global_anchors[4096];
+inline u32 global_profiler_parent;
+inline u32 global_anchor_count;
+
+// __COUNTER__ starts over in every translation unit, so each block takes the next free anchor
+// the first time it runs instead. the last one is shared once they run out
+static u32 next_anchor_index(void) {
+  if (global_anchor_count < ARRAY_COUNT(global_anchors) - 1) {
+    ++global_anchor_count;
+  }
+  return global_anchor_count;
+}
 
 struct profile_block {
   profile_block(const char* label_, u32 index_, u64 byte_count) {
@@ -71,7 +82,9 @@ struct profile_block {
 
 #define NAME_CONCAT_NX(A, B) A##B
 #define NAME_CONCAT(A, B) NAME_CONCAT_NX(A, B)
-#define TIME_BANDWIDTH(Name, ByteCount) profile_block NAME_CONCAT(Block, __LINE__)(Name, __COUNTER__ + 1, ByteCount);
+#define TIME_BANDWIDTH(Name, ByteCount) \
+  static const u32 NAME_CONCAT(Anchor, __LINE__) = next_anchor_index(); \
+  profile_block NAME_CONCAT(Block, __LINE__)(Name, NAME_CONCAT(Anchor, __LINE__), ByteCount);
 
 static void PrintTimeElapsed(u64 total_elapsed, u64 timer_freq, ProfileAnchor *anchor) {
   f64 percent = 100.0 * ((f64)anchor->elapsed_exclusive / (f64)total_elapsed);
@@ -117,22 +130,48 @@ static void PrintAnchorData(u64 total_elapsed, u64 timer_freq) {
 
 #endif // PROFILER
 
+#define MAX_PROFILE_NOTES 16
+
 struct Profiler {
   u64 start;
   u64 end;
+  u64 committed_bytes;
+  u64 peak_committed_bytes;
+
+  // label: value lines for the report, like which kernel variant ran
+  const char* note_labels[MAX_PROFILE_NOTES];
+  const char* note_values[MAX_PROFILE_NOTES];
+  u32 note_count;
 };
 
-static Profiler global_profiler;
+inline Profiler global_profiler;
+
+// arenas report every commit and decommit here
+static void ProfileCommit(i64 byte_delta) {
+  global_profiler.committed_bytes += byte_delta;
+  if (global_profiler.peak_committed_bytes < global_profiler.committed_bytes) {
+    global_profiler.peak_committed_bytes = global_profiler.committed_bytes;
+  }
+}
+
+// both strings have to outlive the report
+static void ProfileNote(const char* label, const char* value) {
+  if (global_profiler.note_count < MAX_PROFILE_NOTES) {
+    global_profiler.note_labels[global_profiler.note_count] = label;
+    global_profiler.note_values[global_profiler.note_count] = value;
+    ++global_profiler.note_count;
+  }
+}
 
 #define TIME_BLOCK(Name) TIME_BANDWIDTH(Name, 0)
 #define TIME_FUNC TIME_BLOCK(__func__)
 
 
-static void BeginProfile(void) {
+[[maybe_unused]] static void BeginProfile(void) {
   global_profiler.start = READ_BLOCK_TIMER();
 }
 
-static void EndAndPrintProfile() {
+[[maybe_unused]] static void EndAndPrintProfile() {
   global_profiler.end = READ_BLOCK_TIMER();
   u64 timer_freq = read_cpu_timer_freq();
 
@@ -143,6 +182,18 @@ static void EndAndPrintProfile() {
   }
 
   PrintAnchorData(total_elapsed, timer_freq);
+
+  if (global_profiler.note_count) {
+    printf("\n");
+  }
+  for (u32 i = 0; i < global_profiler.note_count; ++i) {
+    printf("  %s: %s\n", global_profiler.note_labels[i], global_profiler.note_values[i]);
+  }
+
+  if (global_profiler.peak_committed_bytes) {
+    f64 megabyte = 1024.0f * 1024.0f;
+    printf("\nPeak committed memory: %.3fmb\n", (f64)global_profiler.peak_committed_bytes / megabyte);
+  }
 }
 
 #endif // _PROFILER_HPP_
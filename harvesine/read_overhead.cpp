@@ -25,11 +25,9 @@ struct ReadParameters {
   AllocationType alloc_type;
 };
 
-typedef void read_overhead_test_func(RepTester *tester, ReadParameters *params);
-
 struct TestFunction {
   const char *name;
-  read_overhead_test_func *func;
+  rep_test_func *func;
 };
 
 static Buffer allocate_buffer(size_t count) {
@@ -54,7 +52,7 @@ static void free_buffer(Buffer *buffer) {
 }
 
 static const char* alloc_type_descripion(AllocationType alloc_type) {
-  const char* result;
+  const char* result = "unknown";
   switch (alloc_type) {
     case AllocationType::none:
       result = "none";
@@ -95,7 +93,8 @@ static void handle_deallocation(ReadParameters* params, Buffer* buffer) {
 
 ///////////////////////////////////////////////////////////////
 /// Teste functions
-static void read_with_fread(RepTester *tester, ReadParameters *params) {
+static void read_with_fread(RepTester *tester, void *context) {
+  ReadParameters *params = (ReadParameters*)context;
   while (is_testing(tester)) {
     FILE *file = fopen(params->file_name, "rb");
     if (file) {
@@ -128,7 +127,7 @@ TestFunction testFunctions[] = {
 int main(int argc, char **argv) {
   u64 cpu_freq = read_cpu_timer_freq(); //estimate_block_freq();
 
-  if (argc == 2) {
+  if (argc == 2 || argc == 3) {
     char* file_name = argv[1];
     struct stat input_stat;
     stat(file_name, &input_stat);
@@ -140,36 +139,46 @@ int main(int argc, char **argv) {
     printf("\n");
 
     if (params.destination.count > 0) {
-      RepTester testers[ARRAY_COUNT(testFunctions)] = {};
-      u64 it = 0;
-      // for (;;) {
-      // while(true) {
-        for (u32 func_index = 0; func_index < ARRAY_COUNT(testFunctions); ++func_index) {
-
-          printf("%-20s %lu\n", "Iteration:", ++it);
-          printf("%-20s %-4.2f MHz\n", "CPU Frequency:", cpu_freq * 1e-6f);
-          printf("%-20s %llu bytes\n", "File size:", input_stat.st_size);
-
-          const u8 alloc_type_count = static_cast<u8>(AllocationType::COUNT);
-          for (u8 alloc_index = 0; alloc_index < alloc_type_count; ++alloc_index) {
-            params.alloc_type = static_cast<AllocationType>(alloc_index);
-
-            RepTester *tester = testers + func_index;
-            TestFunction test_func = testFunctions[func_index];
-
-            printf("\n--- %s (%s)---\n", test_func.name, alloc_type_descripion(static_cast<AllocationType>(alloc_index)));
-            new_test_wave(tester, params.destination.count, cpu_freq);
-            test_func.func(tester, &params);
-          }
+      printf("%-20s %-4.2f MHz\n", "CPU Frequency:", cpu_freq * 1e-6f);
+      printf("%-20s %llu bytes\n\n", "File size:", (unsigned long long)input_stat.st_size);
+
+      // every (function, allocation) pair is its own variant with its own parameters
+      const u8 alloc_type_count = static_cast<u8>(AllocationType::COUNT);
+      ReadParameters variant_params[ARRAY_COUNT(testFunctions) * alloc_type_count];
+      char variant_names[ARRAY_COUNT(variant_params)][64];
+
+      RepRunner runner;
+      init_runner(&runner, cpu_freq);
+      runner.options.warmup_ms = 100;
+      if (argc == 3) {
+        runner.options.pin = true;
+        runner.options.cpu = atoi(argv[2]);
+      }
+
+      for (u32 func_index = 0; func_index < ARRAY_COUNT(testFunctions); ++func_index) {
+        TestFunction test_func = testFunctions[func_index];
+
+        for (u8 alloc_index = 0; alloc_index < alloc_type_count; ++alloc_index) {
+          u32 variant_index = func_index * alloc_type_count + alloc_index;
+          ReadParameters *variant = variant_params + variant_index;
+          *variant = params;
+          variant->alloc_type = static_cast<AllocationType>(alloc_index);
+
+          snprintf(variant_names[variant_index], sizeof(variant_names[variant_index]), "%s (%s)",
+                   test_func.name, alloc_type_descripion(variant->alloc_type));
+          add_variant(&runner, variant_names[variant_index], test_func.func, variant, params.destination.count);
         }
-      // }
+      }
+
+      run_interleaved(&runner);
+      print_ranked_summary(&runner);
     } else {
       fprintf(stderr, "ERROR: Test data size must be non-zero\n");
     }
 
     free_buffer(&params.destination);
   } else {
-      fprintf(stderr, "Usage: %s [existing filename]\n", argv[0]);
+      fprintf(stderr, "Usage: %s [existing filename] [cpu to pin to]\n", argv[0]);
   }
 
   return 0;
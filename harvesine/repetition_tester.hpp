@@ -3,6 +3,10 @@
 
 #include <stdio.h>
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 #include "types.h"
 #include "timers.h"
 
@@ -18,6 +22,18 @@ struct RepTestResults {
   u64 total_time;
   u64 max_time;
   u64 min_time;
+
+  u32 unstable_wave_count;
+  f64 max_freq_drift;
+};
+
+// zero initialized options keep the old behaviour: no pinning, no warmup, no checks
+struct RepTestOptions {
+  bool pin;
+  u32 cpu;                // core to pin to when pin is set
+  u32 warmup_ms;          // every wave first runs this long without recording anything
+  u32 freq_check_ms;      // how often the cpu/os timer ratio is re-measured, 0 disables it
+  f64 freq_tolerance;     // relative drift of that ratio after which a wave is unstable
 };
 
 struct RepTester {
@@ -28,14 +44,32 @@ struct RepTester {
 
   RepTestMode test_mode;
   bool print_new_minimums;
+  bool silent; // set by the runner, results are printed in its summary instead
   u32 open_block_count;
   u32 close_block_count;
   u64 time_accumulated_on_this_test;
   u64 bytes_accumulated_on_this_test;
 
+  RepTestOptions options;
+  bool pinned;
+  u64 warmup_ends_at;
+  u64 next_freq_check_at;
+  u64 freq_check_cpu_start;
+  u64 freq_check_os_start;
+  i32 wave_cpu;
+  bool wave_unstable;
+  f64 wave_max_drift;
+
   RepTestResults results;
 };
 
+static RepTestOptions default_test_options() {
+  RepTestOptions result = {};
+  result.freq_check_ms = 100;
+  result.freq_tolerance = 0.01;
+  return result;
+}
+
 static f64 seconds_from_cpu_time(f64 cpu_time, u64 cpu_timer_freq) {
   f64 result = 0.0;
   if (cpu_timer_freq) {
@@ -59,10 +93,6 @@ static void print_time(char const *label, f64 cpu_time, u64 cpu_timer_freq, u64
   }
 }
 
-static void print_time(char const *label, u64 cpu_time, u64 cpu_timer_freq, u64 byte_count) {
-  print_time(label, (f64)cpu_time, cpu_timer_freq, byte_count);
-}
-
 static void print_results(RepTestResults results, u64 cpu_timer_freq, u64 byte_count) {
   print_time("min", (f64)results.min_time, cpu_timer_freq, byte_count);
   printf("\n");
@@ -81,6 +111,64 @@ static void error(RepTester *tester, char const *Message) {
   fprintf(stderr, "ERROR: %s\n", Message);
 }
 
+static bool pin_to_cpu(u32 cpu) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) == 0) {
+    return true;
+  }
+  perror("sched_setaffinity");
+#else
+  fprintf(stderr, "WARNING: pinning to cpu %u is not supported on this platform\n", cpu);
+#endif
+  return false;
+}
+
+static i32 current_cpu() {
+#if defined(__linux__)
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+static void start_freq_check(RepTester *tester, u64 cpu_now) {
+  tester->freq_check_cpu_start = cpu_now;
+  tester->freq_check_os_start = read_os_timer();
+  tester->next_freq_check_at = cpu_now + tester->options.freq_check_ms * tester->cpu_timer_freq / 1000;
+}
+
+// NOTE: an invariant tsc keeps its rate across P-states, so drift here means the clock itself is
+// not trustworthy (no invariant tsc, VM steal, unsynced sockets). Migrations are caught separately.
+static void check_freq(RepTester *tester, u64 cpu_now) {
+  u64 os_elapsed = read_os_timer() - tester->freq_check_os_start;
+  u64 cpu_elapsed = cpu_now - tester->freq_check_cpu_start;
+
+  if (os_elapsed && tester->cpu_timer_freq) {
+    f64 measured_freq = (f64)read_os_timer_freq() * (f64)cpu_elapsed / (f64)os_elapsed;
+    f64 drift = (measured_freq - (f64)tester->cpu_timer_freq) / (f64)tester->cpu_timer_freq;
+    if (drift < 0) {
+      drift = -drift;
+    }
+
+    if (tester->wave_max_drift < drift) {
+      tester->wave_max_drift = drift;
+    }
+
+    if (drift > tester->options.freq_tolerance) {
+      tester->wave_unstable = true;
+    }
+  }
+
+  if (tester->wave_cpu != current_cpu()) {
+    tester->wave_unstable = true;
+  }
+
+  start_freq_check(tester, cpu_now);
+}
+
 static void new_test_wave(RepTester *tester, u64 target_processed_byte_count, u64 cpu_timer_freq, u32 secondsToTry = 10) {
   if (tester->test_mode == RepTestMode::Uninitialized) {
     tester->test_mode = RepTestMode::Testing;
@@ -100,8 +188,18 @@ static void new_test_wave(RepTester *tester, u64 target_processed_byte_count, u6
     }
   }
 
+  if (tester->options.pin && !tester->pinned) {
+    tester->pinned = pin_to_cpu(tester->options.cpu);
+  }
+
   tester->try_for_time = secondsToTry*cpu_timer_freq;
   tester->tests_started_at = read_cpu_timer();
+  tester->warmup_ends_at = tester->tests_started_at + tester->options.warmup_ms * cpu_timer_freq / 1000;
+
+  tester->wave_unstable = false;
+  tester->wave_max_drift = 0.0;
+  tester->wave_cpu = current_cpu();
+  start_freq_check(tester, tester->tests_started_at);
 }
 
 static void begin_time(RepTester *tester) {
@@ -132,24 +230,29 @@ static bool is_testing(RepTester *tester) {
       }
 
       if (tester->test_mode == RepTestMode::Testing) {
-        RepTestResults *results = &tester->results;
-        u64 elapsed_time = tester->time_accumulated_on_this_test;
-        results->test_count += 1;
-        results->total_time += elapsed_time;
-
-        if (results->max_time < elapsed_time) {
-          results->max_time = elapsed_time;
-        }
-
-        if (results->min_time > elapsed_time) {
-          results->min_time = elapsed_time;
-
+        if (current_time < tester->warmup_ends_at) {
+          // still warming up, the result is thrown away and the wave timeout starts after it
           tester->tests_started_at = current_time;
-
-          // if (tester->print_new_minimums) {
-          //   print_time("min", results->min_time, tester->cpu_timer_freq, tester->bytes_accumulated_on_this_test);
-          //   printf("               \r");
-          // }
+        } else {
+          RepTestResults *results = &tester->results;
+          u64 elapsed_time = tester->time_accumulated_on_this_test;
+          results->test_count += 1;
+          results->total_time += elapsed_time;
+
+          if (results->max_time < elapsed_time) {
+            results->max_time = elapsed_time;
+          }
+
+          if (results->min_time > elapsed_time) {
+            results->min_time = elapsed_time;
+
+            tester->tests_started_at = current_time;
+
+            // if (tester->print_new_minimums) {
+            //   print_time("min", results->min_time, tester->cpu_timer_freq, tester->bytes_accumulated_on_this_test);
+            //   printf("               \r");
+            // }
+          }
         }
 
         tester->open_block_count = 0;
@@ -159,12 +262,31 @@ static bool is_testing(RepTester *tester) {
       }
     }
 
+    if (tester->options.freq_check_ms && current_time >= tester->next_freq_check_at) {
+      check_freq(tester, current_time);
+    }
+
     if ((current_time - tester->tests_started_at) > tester->try_for_time) {
       tester->test_mode = RepTestMode::Completed;
 
-      printf("%-6s | %8s | %10s | %10s \n", "stat", "counts", "time (ms)", "speed (gb/s)");
-      printf("----------------------------------------------\n");
-      print_results(tester->results, tester->cpu_timer_freq, tester->target_processed_byte_count);
+      RepTestResults *results = &tester->results;
+      if (results->max_freq_drift < tester->wave_max_drift) {
+        results->max_freq_drift = tester->wave_max_drift;
+      }
+
+      if (tester->wave_unstable) {
+        ++results->unstable_wave_count;
+      }
+
+      if (!tester->silent) {
+        printf("%-6s | %8s | %10s | %10s \n", "stat", "counts", "time (ms)", "speed (gb/s)");
+        printf("----------------------------------------------\n");
+        print_results(tester->results, tester->cpu_timer_freq, tester->target_processed_byte_count);
+
+        if (tester->wave_unstable) {
+          printf("WARNING: unstable wave, timer drifted up to %.2f%% or the test migrated cores\n\n", 100.0 * tester->wave_max_drift);
+        }
+      }
     }
   }
 
@@ -172,5 +294,171 @@ static bool is_testing(RepTester *tester) {
   return result;
 }
 
+///////////////////////////////////////////////////////////////
+/// Runner for comparing several variants of the same work.
+/// Waves of all variants are interleaved round-robin, so frequency and thermal
+/// drift hit every variant equally instead of skewing whichever ran last.
+typedef void rep_test_func(RepTester *tester, void *context);
+
+#define REP_RUNNER_MAX_VARIANTS 64
+
+struct RepTestVariant {
+  const char *name;
+  rep_test_func *func;
+  void *context;
+  u64 byte_count;
+  RepTester tester;
+};
+
+struct RepRunner {
+  RepTestVariant variants[REP_RUNNER_MAX_VARIANTS];
+  RepTestOptions options; // applied to every variant added after it is set
+  u32 variant_count;
+  u32 baseline_index;
+  u64 cpu_timer_freq;
+  u32 seconds_per_wave;
+  u32 max_rounds;
+  u32 rounds;
+};
+
+static void init_runner(RepRunner *runner, u64 cpu_timer_freq, u32 seconds_per_wave = 1, u32 max_rounds = 100) {
+  *runner = {};
+  runner->cpu_timer_freq = cpu_timer_freq;
+  runner->seconds_per_wave = seconds_per_wave;
+  runner->max_rounds = max_rounds;
+  runner->options = default_test_options();
+}
+
+static RepTestVariant *add_variant(RepRunner *runner, char const *name, rep_test_func *func, void *context, u64 byte_count) {
+  RepTestVariant *variant = nullptr;
+  if (runner->variant_count < REP_RUNNER_MAX_VARIANTS) {
+    variant = runner->variants + runner->variant_count++;
+    variant->name = name;
+    variant->func = func;
+    variant->context = context;
+    variant->byte_count = byte_count;
+    variant->tester = {};
+    variant->tester.silent = true;
+    variant->tester.options = runner->options;
+  } else {
+    fprintf(stderr, "ERROR: Too many variants, %s is not registered\n", name);
+  }
+
+  return variant;
+}
+
+static void run_interleaved(RepRunner *runner) {
+  // NOTE: every wave already runs until its variant stops finding new minimums, the runner
+  // keeps doing full rounds until a round where none of the variants improved
+  for (runner->rounds = 0; runner->rounds < runner->max_rounds;) {
+    ++runner->rounds;
+    bool improved = false;
+
+    for (u32 index = 0; index < runner->variant_count; ++index) {
+      RepTestVariant *variant = runner->variants + index;
+      RepTester *tester = &variant->tester;
+
+      bool first_wave = (tester->test_mode == RepTestMode::Uninitialized);
+      u64 previous_min = tester->results.min_time;
+
+      new_test_wave(tester, variant->byte_count, runner->cpu_timer_freq, runner->seconds_per_wave);
+      variant->func(tester, variant->context);
+
+      if (tester->test_mode != RepTestMode::Error && (first_wave || tester->results.min_time < previous_min)) {
+        improved = true;
+      }
+    }
+
+    printf("round %u done\r", runner->rounds);
+    fflush(stdout);
+
+    if (!improved) {
+      break;
+    }
+  }
+
+  printf("                    \r");
+}
+
+static void print_ranked_summary(RepRunner *runner) {
+  u32 order[REP_RUNNER_MAX_VARIANTS];
+  for (u32 index = 0; index < runner->variant_count; ++index) {
+    order[index] = index;
+  }
+
+  // insertion sort by min time, failed variants go to the bottom
+  for (u32 i = 1; i < runner->variant_count; ++i) {
+    u32 current = order[i];
+    RepTester *tester = &runner->variants[current].tester;
+    u64 key = (tester->test_mode == RepTestMode::Error) ? (u64)-1 : tester->results.min_time;
+
+    u32 j = i;
+    while (j > 0) {
+      RepTester *other = &runner->variants[order[j - 1]].tester;
+      u64 other_key = (other->test_mode == RepTestMode::Error) ? (u64)-1 : other->results.min_time;
+      if (other_key <= key) {
+        break;
+      }
+      order[j] = order[j - 1];
+      --j;
+    }
+    order[j] = current;
+  }
+
+  // a failed baseline has no time to compare against, the first variant that ran takes its place
+  RepTestVariant *baseline = runner->variants + runner->baseline_index;
+  for (u32 index = 0; index < runner->variant_count && (baseline->tester.test_mode == RepTestMode::Error || baseline->tester.results.test_count == 0); ++index) {
+    baseline = runner->variants + index;
+  }
+  bool has_baseline = baseline->tester.test_mode != RepTestMode::Error && baseline->tester.results.test_count != 0;
+  f64 baseline_min = (f64)baseline->tester.results.min_time;
+
+  if (!has_baseline) {
+    printf("%u rounds, every variant failed, no baseline\n\n", runner->rounds);
+  } else if (baseline != runner->variants + runner->baseline_index) {
+    printf("%u rounds, %s failed, baseline is %s\n\n", runner->rounds, runner->variants[runner->baseline_index].name, baseline->name);
+  } else {
+    printf("%u rounds, baseline is %s\n\n", runner->rounds, baseline->name);
+  }
+  printf("%-4s | %-24s | %10s | %10s | %12s | %8s | %8s\n", "rank", "variant", "min (ms)", "avg (ms)", "speed (gb/s)", "speedup", "unstable");
+  printf("-----------------------------------------------------------------------------------------------\n");
+
+  for (u32 rank = 0; rank < runner->variant_count; ++rank) {
+    RepTestVariant *variant = runner->variants + order[rank];
+    RepTester *tester = &variant->tester;
+    RepTestResults results = tester->results;
+
+    if (tester->test_mode == RepTestMode::Error || results.test_count == 0) {
+      printf("%4u | %-24s | failed\n", rank + 1, variant->name);
+      continue;
+    }
+
+    f64 min_seconds = seconds_from_cpu_time((f64)results.min_time, runner->cpu_timer_freq);
+    f64 avg_seconds = seconds_from_cpu_time((f64)results.total_time / (f64)results.test_count, runner->cpu_timer_freq);
+
+    f64 bandwidth = 0.0;
+    if (variant->byte_count && min_seconds > 0.0) {
+      f64 gigabyte = (1024.0f * 1024.0f * 1024.0f);
+      bandwidth = variant->byte_count / (gigabyte * min_seconds);
+    }
+
+    f64 speedup = baseline_min / (f64)results.min_time;
+
+    printf("%4u | %-24s | %10f | %10f | %12f | %7.2fx | %3u/%-4u%s\n", rank + 1, variant->name,
+           1000.0 * min_seconds, 1000.0 * avg_seconds, bandwidth, speedup,
+           results.unstable_wave_count, runner->rounds, (variant == baseline) ? " *" : "");
+  }
+  printf("\n");
+
+  u32 unstable_count = 0;
+  for (u32 index = 0; index < runner->variant_count; ++index) {
+    unstable_count += runner->variants[index].tester.results.unstable_wave_count;
+  }
+
+  if (unstable_count) {
+    printf("WARNING: %u unstable waves, the host is not quiet enough for these numbers to be trusted\n\n", unstable_count);
+  }
+}
+
 #endif // _RepTester_HPP_
 
@@ -0,0 +1,541 @@
+#ifndef _SUMMATION_HPP_
+#define _SUMMATION_HPP_
+
+#include <math.h>
+#include <string.h>
+
+#include "types.h"
+
+// summing the distances, five ways:
+//   naive     plain adds
+//   pairwise  leaves of 128 values summed as a binary tree, error grows with log n
+//   kahan     compensated, error doesn't grow with n
+//   neumaier  compensated and also right when a value is bigger than the running sum
+//   exact     every value goes into a fixed-point superaccumulator wide enough for any double,
+//             the result is the exact sum rounded once, whatever the order
+// naive, kahan and neumaier keep 8 lanes, value i going to lane i % 8, and pairwise leaves take
+// values 128 at a time by index, so the result only depends on the values and not on how they
+// were split across sum_values calls. the lanes are plain loops the compiler vectorizes, the same
+// adds in the same order at every width, so the sse2, avx2 and avx-512 variants agree bit for bit.
+//
+// threads each sum their own Summation and sum_merge folds them, in the order they are merged.
+// cutting the input into chunks of a fixed size and merging the chunks in order gives the same
+// result for any number of threads, and for exact it doesn't matter how it's cut at all
+enum SumMode : u32 {
+  SumMode_Naive,
+  SumMode_Pairwise,
+  SumMode_Kahan,
+  SumMode_Neumaier,
+  SumMode_Exact,
+  SumMode_Count,
+};
+
+static const char* sum_mode_names[SumMode_Count] = {"naive", "pairwise", "kahan", "neumaier", "exact"};
+
+#define SUM_LANES 8
+#define SUM_PAIRWISE_BLOCK 128
+
+// bit 0 of limb 0 is 2^-1074, the smallest subnormal, and a double's 53 bits shifted up to the
+// largest exponent end in limb 65. limbs hold 32 bits and carry lazily in the upper half, which
+// has room for 2^31 adds before it has to be normalized
+#define SUPER_LIMBS 67
+#define SUPER_NORMALIZE_EVERY (1u << 30)
+
+struct SuperAccumulator {
+  i64 limbs[SUPER_LIMBS];
+  u32 adds; // since the last normalize
+  u32 specials; // SUPER_POSITIVE_INFINITY, SUPER_NEGATIVE_INFINITY and SUPER_NAN bits
+};
+
+#define SUPER_POSITIVE_INFINITY 1
+#define SUPER_NEGATIVE_INFINITY 2
+#define SUPER_NAN 4
+
+// the exact mode adds mantissas of equal exponent in one i64 first, 512 of them fit under 2^62,
+// and only the exponents that were hit go into the superaccumulator
+#define SUM_EXPONENTS 2048
+#define SUM_BUCKET_FLUSH 512
+
+struct Summation {
+  SumMode mode;
+  u64 count;
+
+  // naive, kahan and neumaier
+  f64 sums[SUM_LANES];
+  f64 compensations[SUM_LANES];
+
+  // pairwise, the leaf being filled and one partial sum per level like the bits of a counter
+  f64 block[SUM_PAIRWISE_BLOCK];
+  u64 leaves;
+  f64 levels[64];
+
+  // what sum_merge brought in, kept apart so the lanes above stay as they are
+  f64 merged;
+  f64 merged_compensation;
+
+  // exact
+  SuperAccumulator exact;
+  i64 buckets[SUM_EXPONENTS];
+  u64 touched[SUM_EXPONENTS / 64];
+  u32 bucket_adds;
+};
+
+typedef void sum_values_func(Summation* sum, const f64* values, u64 count);
+
+[[maybe_unused]] static void sum_init(Summation* sum, SumMode mode);
+
+// values go in with the next indices, any split into calls gives the same sum
+[[maybe_unused]] static void sum_values(Summation* sum, const f64* values, u64 count);
+
+// folds from into sum, both have to be the same mode
+[[maybe_unused]] static void sum_merge(Summation* sum, const Summation* from);
+
+[[maybe_unused]] static f64 sum_result(Summation* sum);
+
+// one of sum_mode_names
+[[maybe_unused]] static bool parse_sum_mode(const char* name, SumMode* mode);
+
+// the superaccumulator on its own, one value at a time. it's the reference the exact mode is held to
+[[maybe_unused]] static void super_init(SuperAccumulator* acc);
+static void super_add(SuperAccumulator* acc, f64 value);
+static void super_merge(SuperAccumulator* acc, const SuperAccumulator* from);
+static f64 super_round(SuperAccumulator* acc);
+
+
+///////////////////////////////////////////////////////////////
+/// Superaccumulator
+static void super_init(SuperAccumulator* acc) {
+  memset(acc, 0, sizeof(*acc));
+}
+
+// every limb but the top one back in [0, 2^32), the top one keeps the sign
+static void super_normalize(SuperAccumulator* acc) {
+  for (u32 i = 0; i + 1 < SUPER_LIMBS; ++i) {
+    i64 carry = acc->limbs[i] >> 32;
+    acc->limbs[i] -= carry * ((i64)1 << 32);
+    acc->limbs[i + 1] += carry;
+  }
+  acc->adds = 0;
+}
+
+// magnitude * 2^(position - 1074), magnitude below 2^63
+static void super_add_bits(SuperAccumulator* acc, u64 magnitude, u32 position, bool negative) {
+  u32 limb = position >> 5;
+  unsigned __int128 shifted = (unsigned __int128)magnitude << (position & 31);
+
+  i64 parts[3] = {
+    (i64)(u64)(shifted & 0xffffffffu),
+    (i64)(u64)((shifted >> 32) & 0xffffffffu),
+    (i64)(u64)(shifted >> 64),
+  };
+  for (u32 i = 0; i < 3 && limb + i < SUPER_LIMBS; ++i) {
+    acc->limbs[limb + i] += negative ? -parts[i] : parts[i];
+  }
+
+  if (++acc->adds >= SUPER_NORMALIZE_EVERY) {
+    super_normalize(acc);
+  }
+}
+
+static void super_add(SuperAccumulator* acc, f64 value) {
+  u64 bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  bool negative = bits >> 63;
+  u32 exponent = (u32)(bits >> 52) & 0x7ff;
+  u64 mantissa = bits & (((u64)1 << 52) - 1);
+
+  if (exponent == 0x7ff) {
+    acc->specials |= mantissa ? SUPER_NAN : (negative ? SUPER_NEGATIVE_INFINITY : SUPER_POSITIVE_INFINITY);
+    return;
+  }
+
+  // subnormals sit at the same scale as the smallest normals, just without the implicit bit
+  if (exponent) {
+    super_add_bits(acc, mantissa | ((u64)1 << 52), exponent - 1, negative);
+  } else if (mantissa) {
+    super_add_bits(acc, mantissa, 0, negative);
+  }
+}
+
+static void super_merge(SuperAccumulator* acc, const SuperAccumulator* from) {
+  // both sides below 2^63 before the add
+  super_normalize(acc);
+  SuperAccumulator normalized = *from;
+  super_normalize(&normalized);
+
+  for (u32 i = 0; i < SUPER_LIMBS; ++i) {
+    acc->limbs[i] += normalized.limbs[i];
+  }
+  acc->specials |= from->specials;
+  super_normalize(acc);
+}
+
+static f64 super_round(SuperAccumulator* acc) {
+  if ((acc->specials & SUPER_NAN) || acc->specials == (SUPER_POSITIVE_INFINITY | SUPER_NEGATIVE_INFINITY)) {
+    return NAN;
+  }
+  if (acc->specials) {
+    return acc->specials == SUPER_POSITIVE_INFINITY ? INFINITY : -INFINITY;
+  }
+
+  super_normalize(acc);
+
+  // a negative total is rounded as its magnitude, the copy keeps acc as it was
+  i64 limbs[SUPER_LIMBS];
+  memcpy(limbs, acc->limbs, sizeof(limbs));
+  bool negative = limbs[SUPER_LIMBS - 1] < 0;
+  if (negative) {
+    for (u32 i = 0; i < SUPER_LIMBS; ++i) {
+      limbs[i] = -limbs[i];
+    }
+    for (u32 i = 0; i + 1 < SUPER_LIMBS; ++i) {
+      i64 carry = limbs[i] >> 32;
+      limbs[i] -= carry * ((i64)1 << 32);
+      limbs[i + 1] += carry;
+    }
+  }
+
+  i32 top = SUPER_LIMBS - 1;
+  while (top >= 0 && limbs[top] == 0) {
+    --top;
+  }
+  if (top < 0) {
+    return 0.0;
+  }
+
+  // the top three limbs hold at least 65 bits, enough for 53 and a rounding bit, the rest only
+  // matter as to whether they are zero
+  unsigned __int128 window = 0;
+  for (i32 i = top; i > top - 3; --i) {
+    window = (window << 32) | (u64)(i >= 0 ? limbs[i] : 0);
+  }
+  bool sticky = false;
+  for (i32 i = top - 3; i >= 0; --i) {
+    sticky |= limbs[i] != 0;
+  }
+
+  i32 window_shift = 32 * (top - 2); // bit 0 of window, counted from 2^-1074
+  i32 leading = 127;
+  while (!((window >> leading) & 1)) {
+    --leading;
+  }
+
+  // below 2^-1022 the total is a multiple of 2^-1074 under 2^52, a subnormal that is already exact
+  if (window_shift + leading < 52) {
+    f64 value = ldexp((f64)(u64)(window >> (window_shift < 0 ? -window_shift : 0)), -1074);
+    return negative ? -value : value;
+  }
+
+  i32 dropped = leading - 52;
+  u64 mantissa = (u64)(window >> dropped);
+  unsigned __int128 rest = window & ((((unsigned __int128)1) << dropped) - 1);
+  unsigned __int128 half = ((unsigned __int128)1) << (dropped - 1);
+  if (rest > half || (rest == half && (sticky || (mantissa & 1)))) {
+    ++mantissa;
+  }
+
+  // ldexp is exact here and goes to infinity past the largest double
+  f64 value = ldexp((f64)mantissa, window_shift + dropped - 1074);
+  return negative ? -value : value;
+}
+
+///////////////////////////////////////////////////////////////
+/// Lanes
+// neumaier's compensation is the exact rounding error of the add. knuth's two sum gets the same
+// error without comparing magnitudes first, so there is no branch to keep it from vectorizing
+static inline void two_sum_add(f64* sum, f64* compensation, f64 value) {
+  f64 total = *sum + value;
+  f64 value_part = total - *sum;
+  *compensation += (*sum - (total - value_part)) + (value - value_part);
+  *sum = total;
+}
+
+// the 8 lanes in a fixed tree
+static f64 combine_lanes(const f64* lanes) {
+  return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) + ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+}
+
+static f64 sum_block(const f64* values, u32 count) {
+  f64 lanes[SUM_LANES] = {};
+  u32 i = 0;
+  for (; i + SUM_LANES <= count; i += SUM_LANES) {
+    for (u32 j = 0; j < SUM_LANES; ++j) {
+      lanes[j] += values[i + j];
+    }
+  }
+  for (; i < count; ++i) {
+    lanes[i % SUM_LANES] += values[i];
+  }
+  return combine_lanes(lanes);
+}
+
+static void push_leaf(Summation* sum, f64 leaf) {
+  // like adding one to a binary counter, every carry is a pair of equal sized subtrees
+  u32 level = 0;
+  while ((sum->leaves >> level) & 1) {
+    leaf = sum->levels[level] + leaf;
+    ++level;
+  }
+  sum->levels[level] = leaf;
+  ++sum->leaves;
+}
+
+static void flush_buckets(Summation* sum) {
+  for (u32 word = 0; word < SUM_EXPONENTS / 64; ++word) {
+    u64 touched = sum->touched[word];
+    while (touched) {
+      u32 exponent = word * 64 + (u32)__builtin_ctzll(touched);
+      touched &= touched - 1;
+
+      i64 bucket = sum->buckets[exponent];
+      sum->buckets[exponent] = 0;
+      if (bucket) {
+        u64 magnitude = bucket < 0 ? (u64)-bucket : (u64)bucket;
+        super_add_bits(&sum->exact, magnitude, exponent ? exponent - 1 : 0, bucket < 0);
+      }
+    }
+    sum->touched[word] = 0;
+  }
+  sum->bucket_adds = 0;
+}
+
+// the same body for every target, the lane loops are what gets vectorized
+static inline __attribute__((always_inline)) void sum_values_body(Summation* sum, const f64* values, u64 count) {
+  u64 i = 0;
+  switch (sum->mode) {
+    case SumMode_Naive:
+    case SumMode_Kahan:
+    case SumMode_Neumaier: {
+      f64 sums[SUM_LANES];
+      f64 compensations[SUM_LANES];
+      memcpy(sums, sum->sums, sizeof(sums));
+      memcpy(compensations, sum->compensations, sizeof(compensations));
+
+      // up to the next multiple of 8 one at a time, then whole rows of lanes
+      u64 head = (SUM_LANES - sum->count % SUM_LANES) % SUM_LANES;
+      u64 lane = sum->count % SUM_LANES;
+      if (sum->mode == SumMode_Naive) {
+        for (; i < head && i < count; ++i, lane = (lane + 1) % SUM_LANES) {
+          sums[lane] += values[i];
+        }
+        for (; i + SUM_LANES <= count; i += SUM_LANES) {
+          for (u32 j = 0; j < SUM_LANES; ++j) {
+            sums[j] += values[i + j];
+          }
+        }
+        for (lane = 0; i < count; ++i, ++lane) {
+          sums[lane] += values[i];
+        }
+      } else if (sum->mode == SumMode_Kahan) {
+        // compensations hold what the sums are over by
+        for (; i < head && i < count; ++i, lane = (lane + 1) % SUM_LANES) {
+          f64 y = values[i] - compensations[lane];
+          f64 t = sums[lane] + y;
+          compensations[lane] = (t - sums[lane]) - y;
+          sums[lane] = t;
+        }
+        for (; i + SUM_LANES <= count; i += SUM_LANES) {
+          for (u32 j = 0; j < SUM_LANES; ++j) {
+            f64 y = values[i + j] - compensations[j];
+            f64 t = sums[j] + y;
+            compensations[j] = (t - sums[j]) - y;
+            sums[j] = t;
+          }
+        }
+        for (lane = 0; i < count; ++i, ++lane) {
+          f64 y = values[i] - compensations[lane];
+          f64 t = sums[lane] + y;
+          compensations[lane] = (t - sums[lane]) - y;
+          sums[lane] = t;
+        }
+      } else {
+        for (; i < head && i < count; ++i, lane = (lane + 1) % SUM_LANES) {
+          two_sum_add(sums + lane, compensations + lane, values[i]);
+        }
+        for (; i + SUM_LANES <= count; i += SUM_LANES) {
+          for (u32 j = 0; j < SUM_LANES; ++j) {
+            two_sum_add(sums + j, compensations + j, values[i + j]);
+          }
+        }
+        for (lane = 0; i < count; ++i, ++lane) {
+          two_sum_add(sums + lane, compensations + lane, values[i]);
+        }
+      }
+
+      memcpy(sum->sums, sums, sizeof(sums));
+      memcpy(sum->compensations, compensations, sizeof(compensations));
+      break;
+    }
+
+    case SumMode_Pairwise: {
+      while (i < count) {
+        u32 filled = (u32)(sum->count % SUM_PAIRWISE_BLOCK);
+        u64 take = SUM_PAIRWISE_BLOCK - filled;
+        take = take < count - i ? take : count - i;
+
+        if (filled == 0 && take == SUM_PAIRWISE_BLOCK) {
+          // whole leaves straight from the input
+          push_leaf(sum, sum_block(values + i, SUM_PAIRWISE_BLOCK));
+        } else {
+          memcpy(sum->block + filled, values + i, take * sizeof(f64));
+          if (filled + take == SUM_PAIRWISE_BLOCK) {
+            push_leaf(sum, sum_block(sum->block, SUM_PAIRWISE_BLOCK));
+          }
+        }
+
+        i += take;
+        sum->count += take;
+      }
+      return;
+    }
+
+    case SumMode_Exact: {
+      for (; i < count; ++i) {
+        u64 bits;
+        memcpy(&bits, values + i, sizeof(bits));
+        u32 exponent = (u32)(bits >> 52) & 0x7ff;
+        if (exponent == 0x7ff) {
+          super_add(&sum->exact, values[i]);
+          continue;
+        }
+
+        i64 mantissa = (i64)((bits & (((u64)1 << 52) - 1)) | ((u64)(exponent != 0) << 52));
+        sum->buckets[exponent] += (bits >> 63) ? -mantissa : mantissa;
+        sum->touched[exponent >> 6] |= (u64)1 << (exponent & 63);
+
+        if (++sum->bucket_adds == SUM_BUCKET_FLUSH) {
+          flush_buckets(sum);
+        }
+      }
+      break;
+    }
+
+    default: break;
+  }
+
+  sum->count += count;
+}
+
+///////////////////////////////////////////////////////////////
+/// Variants
+static void sum_values(Summation* sum, const f64* values, u64 count) {
+  sum_values_body(sum, values, count);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+[[maybe_unused]] static void sum_values_avx2(Summation* sum, const f64* values, u64 count) {
+  sum_values_body(sum, values, count);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+[[maybe_unused]] static void sum_values_avx512(Summation* sum, const f64* values, u64 count) {
+  sum_values_body(sum, values, count);
+}
+
+#endif // __x86_64__
+
+///////////////////////////////////////////////////////////////
+/// Results
+static void sum_init(Summation* sum, SumMode mode) {
+  memset(sum, 0, sizeof(*sum));
+  sum->mode = mode;
+}
+
+// what the lanes or the tree hold, as a sum and what it is short by
+static void sum_partial(Summation* sum, f64* total, f64* compensation) {
+  *total = 0.0;
+  *compensation = 0.0;
+
+  switch (sum->mode) {
+    case SumMode_Naive: {
+      *total = combine_lanes(sum->sums);
+    } break;
+
+    case SumMode_Pairwise: {
+      // the unfinished leaf, then the levels from the smallest up
+      f64 partial = sum_block(sum->block, (u32)(sum->count % SUM_PAIRWISE_BLOCK));
+      for (u32 level = 0; level < 64; ++level) {
+        if ((sum->leaves >> level) & 1) {
+          partial = sum->levels[level] + partial;
+        }
+      }
+      *total = partial;
+    } break;
+
+    case SumMode_Kahan:
+    case SumMode_Neumaier: {
+      // kahan keeps what it's over by, neumaier what it's short by
+      f64 sign = sum->mode == SumMode_Kahan ? -1.0 : 1.0;
+      for (u32 j = 0; j < SUM_LANES; ++j) {
+        two_sum_add(total, compensation, sum->sums[j]);
+      }
+      for (u32 j = 0; j < SUM_LANES; ++j) {
+        *compensation += sign * sum->compensations[j];
+      }
+    } break;
+
+    default: break;
+  }
+}
+
+static void sum_merge(Summation* sum, const Summation* from) {
+  if (sum->mode == SumMode_Exact) {
+    const Summation* source = from;
+    SuperAccumulator exact = source->exact;
+    // the buckets of from still have to go in, on a copy so from stays as it is
+    for (u32 exponent = 0; exponent < SUM_EXPONENTS; ++exponent) {
+      i64 bucket = source->buckets[exponent];
+      if (bucket) {
+        u64 magnitude = bucket < 0 ? (u64)-bucket : (u64)bucket;
+        super_add_bits(&exact, magnitude, exponent ? exponent - 1 : 0, bucket < 0);
+      }
+    }
+    super_merge(&sum->exact, &exact);
+  } else {
+    Summation copy = *from;
+    f64 total, compensation;
+    sum_partial(&copy, &total, &compensation);
+    total += from->merged;
+    compensation += from->merged_compensation;
+
+    if (sum->mode == SumMode_Naive || sum->mode == SumMode_Pairwise) {
+      sum->merged += total + compensation;
+    } else {
+      two_sum_add(&sum->merged, &sum->merged_compensation, total);
+      sum->merged_compensation += compensation;
+    }
+  }
+
+  sum->count += from->count;
+}
+
+static f64 sum_result(Summation* sum) {
+  if (sum->mode == SumMode_Exact) {
+    flush_buckets(sum);
+    return super_round(&sum->exact);
+  }
+
+  f64 total, compensation;
+  sum_partial(sum, &total, &compensation);
+  if (sum->mode == SumMode_Naive || sum->mode == SumMode_Pairwise) {
+    return total + sum->merged;
+  }
+
+  two_sum_add(&total, &compensation, sum->merged);
+  return total + (compensation + sum->merged_compensation);
+}
+
+static bool parse_sum_mode(const char* name, SumMode* mode) {
+  for (u32 i = 0; i < SumMode_Count; ++i) {
+    if (strcmp(name, sum_mode_names[i]) == 0) {
+      *mode = (SumMode)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif // _SUMMATION_HPP_
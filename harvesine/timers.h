@@ -3,34 +3,59 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+
+#if defined(__APPLE__)
 #include <sys/sysctl.h>
 #include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
 
 #if defined(__x86_64__)
 #include <x86intrin.h>
 #endif
 
-#if defined(__x86_64__)
+static inline uint64_t estimate_block_freq();
+
+#if defined(__APPLE__)
 
 static inline uint64_t read_os_timer_freq() {
-  LARGE_INTEGER freq;
-  QueryPerformanceFrequency(&freq);
-  return freq.QuadPart;
+  // documetation says its a nanoseconds https://developer.apple.com/documentation/kernel/1462446-mach_absolute_time
+  return 1e9;
 }
 
 static inline uint64_t read_os_timer() {
-  LARGE_INTEGER value;
-  QueryPerformanceCounter(&value);
-  return value.QuadPart;
+  return mach_absolute_time();
 }
 
+#else
+
+static inline uint64_t read_os_timer_freq() {
+  return 1000000000ull;
+}
+
+static inline uint64_t read_os_timer() {
+  struct timespec value;
+  clock_gettime(CLOCK_MONOTONIC, &value);
+  return (uint64_t)value.tv_sec * 1000000000ull + (uint64_t)value.tv_nsec;
+}
+
+#endif
+
+#if defined(__x86_64__)
+
 static inline uint64_t read_cpu_timer_freq() {
   uint64_t freq = 0;
-  size_t size = sizeof(freq);
 
+#if defined(__APPLE__)
+  size_t size = sizeof(freq);
   if (sysctlbyname("hw.cpufrequency", &freq, &size, NULL, 0) < 0) {
     // perror("sysctl");
   }
+#else
+  // linux does not expose the tsc frequency, so measure it against the os timer
+  freq = estimate_block_freq();
+#endif
 
   return freq;
 }
@@ -48,15 +73,6 @@ static inline uint64_t asm_rdtsc() {
 
 #elif defined(__aarch64__)
 
-static inline uint64_t read_os_timer_freq() {
-  // documetation says its a nanoseconds https://developer.apple.com/documentation/kernel/1462446-mach_absolute_time
-  return 1e9;
-}
-
-static inline uint64_t read_os_timer() {
-  return mach_absolute_time();
-}
-
 static inline uint64_t read_cpu_timer_freq() {
   uint64_t freq;
   __asm__ volatile("mrs %0, cntfrq_el0" : "=r" (freq));
@@ -71,7 +87,7 @@ static inline uint64_t read_cpu_timer() {
 
 #endif
 
-// not used by me
+// measures the cpu timer against the os timer, linux has no other way to get the tsc frequency
 static inline uint64_t estimate_block_freq() {
   uint64_t milliseconds_to_wait = 100;
   uint64_t os_freq = read_os_timer_freq();
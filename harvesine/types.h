@@ -1,12 +1,18 @@
 #ifndef TYPES_H_
 #define TYPES_H_
 
-typedef char          u8;
-typedef unsigned int  u32;
-typedef unsigned long u64;
-typedef signed int    i32;
-typedef long          i64;
-typedef double        f64;
+// shared with 8086/, its types.h includes this one
+#include <stdint.h>
 
-#endif
+typedef uint8_t  u8;
+typedef int8_t   i8;
+typedef uint16_t u16;
+typedef int16_t  i16;
+typedef uint32_t u32;
+typedef int32_t  i32;
+typedef uint64_t u64;
+typedef int64_t  i64;
+typedef float    f32;
+typedef double   f64;
 
+#endif